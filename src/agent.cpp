@@ -0,0 +1,150 @@
+#include "agent.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace ez {
+
+// a step of a few frames takes microseconds, sleeping right away would cost more than the wait itself. on a single
+// core the other side can't make progress while this one spins, so there it sleeps straight away
+static constexpr auto SPIN_DURATION = chrono::nanoseconds(50us);
+static const auto g_spinDuration = std::thread::hardware_concurrency() > 1 ? SPIN_DURATION : 0ns;
+
+static void cpuRelax() {
+#if defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// not FUTEX_PRIVATE_FLAG, the word is shared between processes
+static void futexWait(std::atomic<uint32_t>& word, uint32_t value, chrono::nanoseconds timeout) {
+    const auto seconds = chrono::duration_cast<chrono::seconds>(timeout);
+    auto ts = timespec{time_t(seconds.count()), long((timeout - seconds).count())};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value, &ts, nullptr, 0);
+}
+
+static void futexWakeAll(std::atomic<uint32_t>& word) { syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0); }
+
+// waits for word to move away from value. sleeping is raised around the futex wait so signal can skip the wake
+// syscall whenever nobody sleeps, which is every step the waiter catches while spinning
+static bool waitWhile(std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& sleeping, chrono::nanoseconds timeout) {
+    const auto start = chrono::steady_clock::now();
+    while (word.load(std::memory_order_acquire) == value) {
+        const auto waited = chrono::steady_clock::now() - start;
+        if (waited >= timeout) {
+            return false;
+        }
+        if (waited < g_spinDuration) {
+            cpuRelax();
+            continue;
+        }
+        // seq_cst on both sides, either the waker sees sleeping or this sees the new value
+        sleeping.store(1, std::memory_order_seq_cst);
+        if (word.load(std::memory_order_seq_cst) == value) {
+            futexWait(word, value, timeout - waited);
+        }
+        sleeping.store(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+static void signal(std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& sleeping) {
+    word.store(value, std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_seq_cst) != 0) {
+        futexWakeAll(word);
+    }
+}
+
+std::unique_ptr<AgentChannel> AgentChannel::create(const std::string& name) {
+    // a region left behind by an emulator that was killed is replaced
+    shm_unlink(name.c_str());
+    const auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        log_error("Failed to create shared memory {}: {}", name, strerror(errno));
+        return nullptr;
+    }
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, sizeof(AgentRegion)) == 0) {
+        memory = mmap(nullptr, sizeof(AgentRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        log_error("Failed to map shared memory {}: {}", name, strerror(errno));
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+    auto* region = new (memory) AgentRegion{};
+    region->version = AgentRegion::VERSION;
+    region->size = sizeof(AgentRegion);
+    // the magic goes last, an agent that attaches early sees a region that isn't ready rather than half of one
+    std::atomic_thread_fence(std::memory_order_release);
+    region->magic = AgentRegion::MAGIC;
+    return std::unique_ptr<AgentChannel>(new AgentChannel(region, name, true));
+}
+
+std::unique_ptr<AgentChannel> AgentChannel::attach(const std::string& name) {
+    const auto fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        log_error("Failed to open shared memory {}, is chip8-agent running? {}", name, strerror(errno));
+        return nullptr;
+    }
+    struct stat info {};
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) == sizeof(AgentRegion)) {
+        memory = mmap(nullptr, sizeof(AgentRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        log_error("Failed to map shared memory {}, or it isn't {} bytes", name, sizeof(AgentRegion));
+        return nullptr;
+    }
+    auto* region = static_cast<AgentRegion*>(memory);
+    if (region->magic != AgentRegion::MAGIC || region->version != AgentRegion::VERSION || region->size != sizeof(AgentRegion)) {
+        log_error("{} is not a version {} agent region", name, AgentRegion::VERSION);
+        munmap(memory, sizeof(AgentRegion));
+        return nullptr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return std::unique_ptr<AgentChannel>(new AgentChannel(region, name, false));
+}
+
+AgentChannel::AgentChannel(AgentRegion* region, std::string name, bool owner) : m_region(region), m_name(std::move(name)), m_owner(owner) {}
+
+AgentChannel::~AgentChannel() {
+    munmap(m_region, sizeof(AgentRegion));
+    if (m_owner) {
+        shm_unlink(m_name.c_str());
+    }
+}
+
+bool AgentChannel::waitForRequest(chrono::milliseconds timeout) {
+    return waitWhile(m_region->requestSeq, m_region->completedSeq.load(std::memory_order_relaxed), m_region->emulatorSleeping, timeout);
+}
+
+void AgentChannel::complete() { signal(m_region->completedSeq, m_region->requestSeq.load(std::memory_order_relaxed), m_region->agentSleeping); }
+
+void AgentChannel::request() {
+    const auto seq = m_region->completedSeq.load(std::memory_order_relaxed) + 1;
+    signal(m_region->requestSeq, seq, m_region->emulatorSleeping);
+    waitWhile(m_region->completedSeq, seq - 1, m_region->agentSleeping, chrono::nanoseconds::max());
+}
+
+void AgentChannel::step(KeypadInput keys, uint32_t frames) {
+    m_region->command = AgentCommand::Step;
+    m_region->keys = keys;
+    m_region->frames = frames;
+    request();
+}
+
+void AgentChannel::reset(uint64_t seed) {
+    m_region->command = AgentCommand::Reset;
+    m_region->seed = seed;
+    request();
+}
+
+} // namespace ez
@@ -0,0 +1,95 @@
+#pragma once
+#include "emu.h"
+#include <atomic>
+
+namespace ez {
+
+// what an external process sends to chip8-agent, see AgentRegion
+enum class AgentCommand : uint32_t {
+    // runs AgentRegion::frames frames of emulated time with AgentRegion::keys held
+    Step,
+    // back to power on, reseeded with AgentRegion::seed
+    Reset,
+    // the emulator unmaps the region and exits
+    Quit,
+};
+
+// the POSIX shared memory object chip8-agent and an agent process exchange steps through. nothing in it is
+// serialized, the machine state after every request sits in it as the emulator's own types, so an agent reads the
+// framebuffer and registers in place. linux only, a side that would otherwise spin sleeps on a futex.
+//
+// one request is in flight at a time: the agent fills in the request fields, bumps requestSeq and waits for
+// completedSeq to reach the same value. the machine fields belong to the emulator until then and to the agent after
+struct AgentRegion {
+    static constexpr std::array<uint8_t, 4> MAGIC = {'C', '8', 'A', 'G'};
+    // bumped whenever the layout changes, Emu::State::Cpu and Display::Planes included
+    static constexpr uint32_t VERSION = 1;
+
+    // written once by the emulator before the name is visible
+    std::array<uint8_t, 4> magic{};
+    uint32_t version = 0;
+    uint32_t size = 0;
+
+    // request, written by the agent. each side has its own line so neither polls on a line the other writes
+    alignas(64) std::atomic<uint32_t> requestSeq = 0;
+    // set by the emulator while it sleeps on requestSeq, the agent only pays for a wake when this is set
+    std::atomic<uint32_t> emulatorSleeping = 0;
+    AgentCommand command = AgentCommand::Step;
+    KeypadInput keys = 0;
+    uint32_t frames = 1;
+    uint64_t seed = 0;
+
+    // completion, written by the emulator
+    alignas(64) std::atomic<uint32_t> completedSeq = 0;
+    std::atomic<uint32_t> agentSleeping = 0;
+
+    // the machine after the completed request
+    alignas(64) Emu::State::Cpu cpu{};
+    bool hires = false;
+    bool exited = false;
+    Emu::Fault fault = Emu::Fault::None;
+    // Display::generation, changes whenever the framebuffer does, so an agent can skip unchanged frames
+    uint64_t displayGeneration = 0;
+    alignas(64) Display::Planes planes{};
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "the futex words have to be plain 32 bit integers");
+static_assert(std::is_standard_layout_v<AgentRegion>);
+
+// one side of a mapped AgentRegion, either end of the protocol goes through it
+class AgentChannel {
+  public:
+    // emulator side, creates the shared memory object with the given name (e.g. /chip8-agent) and removes it again
+    // when the channel goes away. null and logged if it can't be created
+    static std::unique_ptr<AgentChannel> create(const std::string& name);
+    // agent side, maps a region created by a running chip8-agent. null and logged if there is none or it is from
+    // another version
+    static std::unique_ptr<AgentChannel> attach(const std::string& name);
+    ~AgentChannel();
+
+    AgentChannel(AgentChannel&) = delete;
+    AgentChannel(AgentChannel&&) = delete;
+
+    AgentRegion& region() { return *m_region; }
+
+    // emulator side, waits for a request after the last completed one. spins for a little while first, a step
+    // usually comes right after the agent looked at the previous frame. false once the timeout passed without one
+    bool waitForRequest(chrono::milliseconds timeout);
+    // emulator side, publishes the machine fields for the pending request
+    void complete();
+
+    // agent side, sends the request fields and waits until the emulator completed them
+    void request();
+    // agent side shorthands for the request fields
+    void step(KeypadInput keys, uint32_t frames = 1);
+    void reset(uint64_t seed);
+
+  private:
+    AgentChannel(AgentRegion* region, std::string name, bool owner);
+
+    AgentRegion* const m_region;
+    const std::string m_name;
+    // the emulator side unlinks the name
+    const bool m_owner;
+};
+
+} // namespace ez
@@ -3,51 +3,67 @@
 
 namespace ez {
 
-static constexpr int SAMPLE_RATE = 44'100;
 static constexpr int FORMAT = AUDIO_F32;
-static constexpr int BUFFER_SIZE = 2048;
+// events further than this from the audio clock mean the emulator jumped (turbo, pause, rewind, rom switch) or the
+// clocks drifted apart, the audio clock snaps to the event instead of waiting for it or playing catch up
+static constexpr int64_t MAX_EVENT_DRIFT_SAMPLES = Synth::SAMPLE_RATE / 10;
 
 static void audioCallback(void* userdata, uint8_t* stream, int len) {
     auto& synth = *reinterpret_cast<Audio*>(userdata);
-    for (auto i = 0; i < len / int(sizeof(float)); ++i) {
-        reinterpret_cast<float*>(stream)[i] = synth.getNextSample();
-    }
+    synth.generate(reinterpret_cast<float*>(stream), size_t(len) / sizeof(float));
 }
 
-Audio::Audio() {
+Audio::Audio(int cyclesPerSecond, int bufferSamples) : m_cyclesPerSecond(cyclesPerSecond) {
     SDL_AudioSpec spec{};
-    spec.freq = SAMPLE_RATE;
+    spec.freq = Synth::SAMPLE_RATE;
     spec.format = FORMAT;
-    spec.samples = BUFFER_SIZE;
+    spec.channels = 1;
+    spec.samples = uint16_t(bufferSamples);
     spec.callback = audioCallback;
     spec.userdata = this;
-    assert(0 == SDL_OpenAudio(&spec, nullptr));
+    // no sound device isn't fatal, the emulator just runs silent
+    if (SDL_OpenAudio(&spec, nullptr) != 0) {
+        log_error("Failed to open audio: {}", SDL_GetError());
+        return;
+    }
     SDL_PauseAudio(0);
 }
 
 Audio::~Audio() { SDL_CloseAudio(); }
 
-float Audio::getNextSample() { 
-
-    // reduce/increase amplitude when pausing/unpausing instead of cutting off abruptly
-    static constexpr float amplitudeRamp = 10.0f;
-    static constexpr float maxAmplitude = 0.4f;
-    const auto dt = 1.0f / SAMPLE_RATE;
-    if(m_pause){
-        m_amplitudeScale -= amplitudeRamp * dt;
+void Audio::setSoundOn(bool on, uint64_t emulatedCycle) {
+    if (on == m_lastSentOn) {
+        return;
     }
-    else{
-        m_amplitudeScale += amplitudeRamp * dt;
+    // the queue only fills up if the audio thread stalls, the next change goes through once it drains
+    if (m_events.push({emulatedCycle, on})) {
+        m_lastSentOn = on;
     }
-    m_amplitudeScale = clamp(m_amplitudeScale, 0.0f, 1.0f);
+}
 
-    const auto time = m_sampleIdx++ * dt;
-    static constexpr auto frequencies = std::array<float, 3>{110.0f, 130.81, 164.81}; // Am
-    float sample = 0.0f;
-    for (auto f : frequencies) {
-        sample += sinf(float(2.0 * float(M_PI) * f * time));
+void Audio::generate(float* out, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        auto segment = count - done;
+        if (const auto event = m_events.front()) {
+            const auto eventPos = int64_t(event->emulatedCycle * Synth::SAMPLE_RATE / uint64_t(m_cyclesPerSecond));
+            auto offset = eventPos - m_samplePos;
+            if (offset < -MAX_EVENT_DRIFT_SAMPLES || offset > MAX_EVENT_DRIFT_SAMPLES) {
+                m_samplePos = eventPos;
+                offset = 0;
+            }
+            // late events apply right away, ones inside this buffer apply on their exact sample
+            if (offset <= 0) {
+                m_synth.setPlaying(event->on);
+                m_events.pop();
+                continue;
+            }
+            segment = std::min(segment, size_t(offset));
+        }
+        m_synth.generate(out + done, segment);
+        m_samplePos += int64_t(segment);
+        done += segment;
     }
-    return sample * maxAmplitude * m_amplitudeScale / float(frequencies.size());
 }
 
-} // namespace ez
\ No newline at end of file
+} // namespace ez
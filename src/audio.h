@@ -1,27 +1,47 @@
 #pragma once
 #include "base.h"
+#include "spsc_queue.h"
+#include "synth.h"
 
 namespace ez {
 
+// plays the tone on the SDL audio thread. the emulation thread only ever pushes timestamped on/off events, everything the
+// audio thread reads it owns, so the two never share mutable state beyond the queue
 class Audio {
   public:
-    Audio();
+    // samples per callback, about 12 ms at 44.1 kHz
+    static constexpr int DEFAULT_BUFFER_SAMPLES = 512;
+
+    // emulated time is measured in cycles at cyclesPerSecond
+    explicit Audio(int cyclesPerSecond, int bufferSamples = DEFAULT_BUFFER_SAMPLES);
     ~Audio();
 
     Audio(Audio&) = delete;
     Audio(Audio&&) = delete;
 
-    float getNextSample();
+    // emulation thread only. starts or stops the tone at the given point in emulated time, repeats are dropped
+    void setSoundOn(bool on, uint64_t emulatedCycle);
 
-    void setPause(bool p) { m_pause = p; }
-    bool isPaused() { return m_pause; }
+    // audio thread only, fills a whole buffer
+    void generate(float* out, size_t count);
 
   private:
-    bool m_pause = false;
+    struct SoundEvent {
+        uint64_t emulatedCycle = 0;
+        bool on = false;
+    };
+
+    int m_cyclesPerSecond = 0;
+
+    // emulation thread
+    bool m_lastSentOn = false;
 
-    float m_amplitudeScale = 0.0f;
+    SpscQueue<SoundEvent, 256> m_events;
 
-    size_t samplesSincePause = 0;
-    size_t m_sampleIdx = 0;
+    // audio thread
+    Synth m_synth;
+    // emulated time of the next output sample, in samples. only ever compared with event times so the absolute value
+    // just follows the emulator around
+    int64_t m_samplePos = 0;
 };
-} // namespace ez
\ No newline at end of file
+} // namespace ez
@@ -17,7 +17,9 @@ const char* to_string(LogLevel level) {
 }
 
 static auto as_local(const std::chrono::system_clock::time_point& tp) {
-    return std::chrono::zoned_time{std::chrono::current_zone(), tp};
+    // looking the zone up takes a lock and a search of the tz database, it doesn't change while we run
+    static const auto zone = std::chrono::current_zone();
+    return std::chrono::zoned_time{zone, tp};
 }
 
 std::string to_string(const std::chrono::system_clock::time_point& tp) {
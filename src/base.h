@@ -6,12 +6,16 @@
 #include <cstring>
 #include <filesystem>
 #include <format>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <source_location>
 #include <string_view>
 #include <vector>
 
+#include "logger.h"
+
 namespace ez {
 
 namespace chrono {
@@ -19,25 +23,30 @@ using namespace std::chrono;
 }
 using namespace std::literals::chrono_literals;
 
-enum class LogLevel { INFO, WARN, ERROR, CRITICAL };
-
 const char* to_string(LogLevel level);
 std::string to_string(const std::chrono::system_clock::time_point& tp);
 std::string to_string(const std::source_location& source);
 
+// formatting and output happen later on the logger thread, see logger.h, so the format has to be a string literal.
+// CRITICAL flushes everything and aborts
 template <LogLevel level, typename... TArgs> struct log {
-    log(std::string_view format, TArgs&&... args, std::source_location location = std::source_location::current()) {
-        std::cout << std::format("[{}] {} {} | {}\n", to_string(level), to_string(std::chrono::system_clock::now()), to_string(location),
-                                 std::vformat(format, std::make_format_args(std::forward<TArgs>(args)...)));
+    log(logging::Format format, TArgs&&... args, std::source_location location = std::source_location::current()) {
+        if constexpr (level == LogLevel::CRITICAL || int(level) >= EZ_LOG_MIN_LEVEL) {
+            logging::write<level>(format, location, args...);
+        } else {
+            ((void)args, ...);
+            (void)format;
+            (void)location;
+        }
 
         if constexpr (level == LogLevel::CRITICAL) {
-            std::cout.flush();
+            logging::flush();
             abort();
         }
     }
 };
 
-template <LogLevel level, typename... TArgs> log(std::string_view, TArgs&&...) -> log<level, TArgs...>;
+template <LogLevel level, typename... TArgs> log(logging::Format, TArgs&&...) -> log<level, TArgs...>;
 
 template <typename... TArgs> using log_info = log<LogLevel::INFO, TArgs...>;
 template <typename... TArgs> using log_warn = log<LogLevel::WARN, TArgs...>;
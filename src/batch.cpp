@@ -0,0 +1,572 @@
+#include "batch.h"
+#include "ops.h"
+#include "savestate.h"
+#include <bit>
+#include <ranges>
+#include <span>
+
+namespace ez {
+
+static constexpr uint16_t ADDRESS_MASK = BatchEmu::MEM_SIZE_BYTES - 1;
+
+BatchEmu::BatchEmu(const uint8_t* program, size_t size, size_t lanes, QuirkProfile quirks)
+    : m_lanes(lanes), m_regV(16 * lanes), m_regI(lanes), m_pc(lanes), m_sp(lanes), m_delayTimer(lanes), m_soundTimer(lanes),
+      m_stack(STACK_DEPTH * lanes), m_rng(lanes), m_waitingForKey(lanes), m_keyWaitRegIdx(lanes), m_keyWaitKeysDown(lanes),
+      m_fault(lanes), m_memory(MEM_SIZE_BYTES * lanes), m_rows(Display::HEIGHT_PX * lanes) {
+    m_groupKeys.reserve(lanes);
+    m_groupLanes.reserve(lanes);
+    m_laneGroups.reserve(lanes);
+    // at most half full
+    m_groupTable.resize(std::bit_ceil(2 * std::max<size_t>(lanes, 1)));
+
+    // boot through the interpreter so both start from exactly the same machine
+    const auto prototype = Emu(program, size, quirks);
+    auto snapshot = std::vector<uint8_t>{};
+    prototype.saveState(snapshot);
+    for (size_t lane = 0; lane < m_lanes; ++lane) {
+        const bool loaded = loadLaneState(lane, snapshot.data(), snapshot.size());
+        assert(loaded);
+        (void)loaded;
+    }
+}
+
+void BatchEmu::saveLaneState(size_t lane, std::vector<uint8_t>& out) const {
+    auto state = SnapshotState{};
+    for (auto reg = 0; reg < 16; ++reg) {
+        state.regV[reg] = m_regV[reg * m_lanes + lane];
+    }
+    state.regI = m_regI[lane];
+    // wrapped like Emu::saveState does
+    state.pc = uint16_t(m_pc[lane] & ADDRESS_MASK);
+    state.sp = m_sp[lane];
+    state.delayTimer = m_delayTimer[lane];
+    state.soundTimer = m_soundTimer[lane];
+    state.waitingForKey = m_waitingForKey[lane];
+    state.keyWaitRegIdx = m_keyWaitRegIdx[lane];
+    state.keyWaitKeysDown = m_keyWaitKeysDown[lane];
+    state.quirkProfile = m_quirkProfile;
+    state.cycleCount = m_cycleCount;
+    state.frameCount = m_frameCount;
+    state.timerPhase = m_timerPhase;
+    state.rngState = m_rng[lane].state;
+    memcpy(state.memory.data(), &m_memory[lane * MEM_SIZE_BYTES], MEM_SIZE_BYTES);
+    for (auto y = 0; y < Display::HEIGHT_PX; ++y) {
+        state.planes[0][y * Display::WORDS_PER_ROW] = laneRow(lane, y);
+    }
+    for (auto depth = 0; depth < m_sp[lane]; ++depth) {
+        state.stack.push_back(m_stack[depth * m_lanes + lane]);
+    }
+    writeSnapshot(state, out);
+}
+
+bool BatchEmu::loadLaneState(size_t lane, const uint8_t* data, size_t size) {
+    auto state = SnapshotState{};
+    if (!readSnapshot(data, size, state)) {
+        return false;
+    }
+    if (state.stack.size() > STACK_DEPTH) {
+        log_warn("Snapshot stack is deeper than the batch engine supports");
+        return false;
+    }
+    // lanes only have a lores single plane display and none of the extended registers
+    const auto plane1Used = std::any_of(state.planes[1].begin(), state.planes[1].end(), [](Display::Row word) { return word != 0; });
+    const auto defaults = SnapshotState{};
+    if (quirksOf(state.quirkProfile).memoryBytes() > MEM_SIZE_BYTES || state.hires || state.planeMask != defaults.planeMask || plane1Used ||
+        state.flagRegisters != defaults.flagRegisters || state.audioPattern != defaults.audioPattern || state.pitch != defaults.pitch ||
+        state.exited) {
+        log_warn("Snapshot uses SUPER-CHIP or XO-CHIP state the batch engine doesn't support");
+        return false;
+    }
+    // the clock and quirks are shared, a lane that disagrees with the others can't be stepped with them
+    if (lane != 0 && (state.cycleCount != m_cycleCount || state.timerPhase != m_timerPhase || state.quirkProfile != m_quirkProfile)) {
+        log_warn("Snapshot clock or quirks differ from lane 0");
+        return false;
+    }
+
+    for (auto reg = 0; reg < 16; ++reg) {
+        m_regV[reg * m_lanes + lane] = state.regV[reg];
+    }
+    m_regI[lane] = state.regI;
+    m_pc[lane] = state.pc;
+    m_sp[lane] = uint8_t(state.stack.size());
+    m_delayTimer[lane] = state.delayTimer;
+    m_soundTimer[lane] = state.soundTimer;
+    m_waitingLanes -= m_waitingForKey[lane];
+    m_waitingForKey[lane] = state.waitingForKey;
+    m_waitingLanes += m_waitingForKey[lane];
+    m_keyWaitRegIdx[lane] = state.keyWaitRegIdx;
+    m_keyWaitKeysDown[lane] = state.keyWaitKeysDown;
+    m_faultedLanes -= m_fault[lane] != Emu::Fault::None;
+    m_fault[lane] = Emu::Fault::None;
+    m_quirkProfile = state.quirkProfile;
+    m_quirks = quirksOf(m_quirkProfile);
+    m_cycleCount = state.cycleCount;
+    m_frameCount = state.frameCount;
+    m_timerPhase = state.timerPhase;
+    m_rng[lane].state = state.rngState;
+    memcpy(laneMemory(lane), state.memory.data(), MEM_SIZE_BYTES);
+    for (auto y = 0; y < Display::HEIGHT_PX; ++y) {
+        m_rows[lane * Display::HEIGHT_PX + y] = state.planes[0][y * Display::WORDS_PER_ROW];
+    }
+    for (size_t depth = 0; depth < state.stack.size(); ++depth) {
+        m_stack[depth * m_lanes + lane] = state.stack[depth];
+    }
+    return true;
+}
+
+void BatchEmu::runCycles(uint64_t n, const KeypadInput* keysDown) {
+    for (uint64_t i = 0; i < n; ++i) {
+        runCycle(keysDown);
+    }
+}
+
+void BatchEmu::runFrames(uint64_t n, const KeypadInput* keysDown) {
+    for (uint64_t i = 0; i < n; ++i) {
+        runCycles(cyclesUntilNextFrame(), keysDown);
+    }
+}
+
+uint64_t BatchEmu::cyclesUntilNextFrame() const {
+    return (Emu::INSTRUCTIONS_PER_SECOND - m_timerPhase + Emu::TIMERS_PER_SECOND - 1) / Emu::TIMERS_PER_SECOND;
+}
+
+OpCode BatchEmu::opCodeAt(size_t lane, uint16_t pc) const {
+    // pc wraps like in Emu::fetchInstruction, an instruction at the last byte takes its low half from address 0
+    const auto memory = &m_memory[lane * MEM_SIZE_BYTES];
+    return OpCode((memory[pc & ADDRESS_MASK] << 8) | memory[(pc + 1) & ADDRESS_MASK]);
+}
+
+void BatchEmu::runCycle(const KeypadInput* keysDown) {
+    // uniform if no lane is stuck in a key wait or a fault and all fetch the same opcode from the same address
+    const auto pc = m_pc[0];
+    const auto opCode = opCodeAt(0, pc);
+    bool uniform = m_waitingLanes == 0 && m_faultedLanes == 0;
+    for (size_t lane = 1; lane < m_lanes && uniform; ++lane) {
+        uniform = m_pc[lane] == pc && opCodeAt(lane, pc) == opCode;
+    }
+
+    if (uniform) {
+        m_uniformCycles += m_lanes > 1;
+        m_divergentCycles += m_lanes == 1;
+        execute(decode(opCode, m_quirks), std::views::iota(size_t(0), m_lanes), keysDown);
+        advanceClock();
+        return;
+    }
+
+    // faulted lanes sit still and waiting ones only poll the keypad, the rest run in groups that fetched the same
+    // opcode from the same address
+    m_groupKeys.clear();
+    for (size_t lane = 0; lane < m_lanes; ++lane) {
+        if (m_fault[lane] != Emu::Fault::None) {
+            continue;
+        }
+        if (m_waitingForKey[lane]) {
+            waitForKeypress(lane, keysDown[lane]);
+            continue;
+        }
+        m_groupKeys.push_back(uint64_t(m_pc[lane]) << 48 | uint64_t(opCodeAt(lane, m_pc[lane])) << 32 | lane);
+    }
+    groupLanes();
+    for (size_t group = 0; group + 1 < m_groupStarts.size(); ++group) {
+        const auto lanes = std::span<const uint32_t>(m_groupLanes).subspan(m_groupStarts[group], m_groupStarts[group + 1] - m_groupStarts[group]);
+        m_uniformCycles += lanes.size() > 1;
+        m_divergentCycles += lanes.size() == 1;
+        execute(decode(m_groupOpCodes[group], m_quirks), lanes, keysDown);
+    }
+    advanceClock();
+}
+
+void BatchEmu::groupLanes() {
+    const auto fetched = [](uint64_t key) { return uint32_t(key >> 32); };
+    m_groupLanes.clear();
+    m_groupStarts.clear();
+    m_groupOpCodes.clear();
+    if (m_groupKeys.empty()) {
+        return;
+    }
+    // a fault or a key wait leaves the others in step, that is one group of every running lane
+    const auto first = fetched(m_groupKeys.front());
+    if (std::all_of(m_groupKeys.begin(), m_groupKeys.end(), [&](uint64_t key) { return fetched(key) == first; })) {
+        for (const auto key : m_groupKeys) {
+            m_groupLanes.push_back(uint32_t(key));
+        }
+        m_groupStarts = {0, uint32_t(m_groupLanes.size())};
+        m_groupOpCodes.push_back(OpCode(first));
+        return;
+    }
+
+    // otherwise each lane finds its group in an open addressing table, stamped per use so it never needs clearing,
+    // then the lanes are counted into place group by group, keeping them in lane order within each
+    if (++m_groupStamp == 0) {
+        std::fill(m_groupTable.begin(), m_groupTable.end(), GroupSlot{});
+        m_groupStamp = 1;
+    }
+    const auto mask = m_groupTable.size() - 1;
+    m_laneGroups.clear();
+    for (const auto key : m_groupKeys) {
+        // fibonacci hashing, the low bits of pc and opcode alone would pile up in a few slots
+        auto slot = size_t(fetched(key) * 0x9E3779B1u) >> (32 - std::countr_zero(m_groupTable.size()));
+        while (m_groupTable[slot].stamp == m_groupStamp && m_groupTable[slot].fetched != fetched(key)) {
+            slot = (slot + 1) & mask;
+        }
+        auto& entry = m_groupTable[slot];
+        if (entry.stamp != m_groupStamp) {
+            entry = {fetched(key), m_groupStamp, uint32_t(m_groupOpCodes.size())};
+            m_groupOpCodes.push_back(OpCode(fetched(key)));
+            m_groupStarts.push_back(0);
+        }
+        ++m_groupStarts[entry.group];
+        m_laneGroups.push_back(entry.group);
+    }
+    // sizes to starts, the extra entry at the end closes the last group
+    uint32_t start = 0;
+    for (auto& size : m_groupStarts) {
+        start += std::exchange(size, start);
+    }
+    m_groupStarts.push_back(start);
+    m_groupLanes.resize(start);
+    // advances each group's start past its lanes, so afterwards every start sits where the next group begins
+    for (size_t i = 0; i < m_groupKeys.size(); ++i) {
+        m_groupLanes[m_groupStarts[m_laneGroups[i]]++] = uint32_t(m_groupKeys[i]);
+    }
+    std::rotate(m_groupStarts.begin(), m_groupStarts.end() - 1, m_groupStarts.end());
+    m_groupStarts.front() = 0;
+}
+
+void BatchEmu::waitForKeypress(size_t lane, KeypadInput keysDown) {
+    // mirrors Emu::waitForKeypress
+    m_keyWaitKeysDown[lane] |= keysDown;
+    if (const auto released = m_keyWaitKeysDown[lane] & ~keysDown) {
+        regV(m_keyWaitRegIdx[lane])[lane] = uint8_t(std::countr_zero(released));
+        m_waitingForKey[lane] = false;
+        m_keyWaitRegIdx[lane] = 0;
+        m_keyWaitKeysDown[lane] = 0;
+        --m_waitingLanes;
+    }
+}
+
+void BatchEmu::advanceClock() {
+    ++m_cycleCount;
+    m_timerPhase += Emu::TIMERS_PER_SECOND;
+    if (m_timerPhase >= Emu::INSTRUCTIONS_PER_SECOND) {
+        m_timerPhase -= Emu::INSTRUCTIONS_PER_SECOND;
+        ++m_frameCount;
+        for (size_t lane = 0; lane < m_lanes; ++lane) {
+            const bool running = m_fault[lane] == Emu::Fault::None;
+            m_delayTimer[lane] -= m_delayTimer[lane] > 0 && running;
+            m_soundTimer[lane] -= m_soundTimer[lane] > 0 && running;
+        }
+    }
+}
+
+void BatchEmu::fault(size_t lane, Emu::Fault reason) {
+    // back onto the faulting instruction, like EZ_FAULT in the interpreter
+    m_fault[lane] = reason;
+    m_pc[lane] -= 2;
+    ++m_faultedLanes;
+}
+
+template <typename Lanes> void BatchEmu::execute(const Instruction& instr, const Lanes& lanes, const KeypadInput* keysDown) {
+    auto vx = regV(instr.x);
+    auto vy = regV(instr.y);
+    auto vf = regV(0xF);
+    auto v0 = regV(0);
+
+    for (const auto lane : lanes) {
+        m_pc[lane] = uint16_t((m_pc[lane] & ADDRESS_MASK) + 2);
+    }
+
+    // every case is a plain loop over the lanes, operands are identical across them so these vectorize
+    const auto math = [&](auto op) {
+        for (const auto lane : lanes) {
+            const auto result = op(vx[lane], vy[lane]);
+            vx[lane] = result.vx;
+            vf[lane] = result.vf;
+        }
+    };
+    // or/and/xor only touch vf when the quirk says they clear it
+    const auto logic = [&](auto op) {
+        if (m_quirks.logicResetsVf) {
+            math(op);
+            return;
+        }
+        for (const auto lane : lanes) {
+            vx[lane] = op(vx[lane], vy[lane]).vx;
+        }
+    };
+    const auto shift = [&](auto op) {
+        const auto src = m_quirks.shiftVy ? vy : vx;
+        for (const auto lane : lanes) {
+            const auto result = op(src[lane]);
+            vx[lane] = result.vx;
+            vf[lane] = result.vf;
+        }
+    };
+    const auto skipIf = [&](auto cond) {
+        for (const auto lane : lanes) {
+            m_pc[lane] += cond(lane) ? 2 : 0;
+        }
+    };
+
+    switch (instr.op) {
+    case Op::Cls:
+        for (const auto lane : lanes) {
+            std::fill_n(&m_rows[lane * Display::HEIGHT_PX], Display::HEIGHT_PX, 0);
+        }
+        break;
+    case Op::Ret:
+        for (const auto lane : lanes) {
+            if (m_sp[lane] == 0) {
+                fault(lane, Emu::Fault::StackUnderflow);
+                continue;
+            }
+            --m_sp[lane];
+            m_pc[lane] = m_stack[m_sp[lane] * m_lanes + lane];
+        }
+        break;
+    case Op::Sys:
+        break;
+    case Op::Jp:
+        for (const auto lane : lanes) {
+            m_pc[lane] = instr.nnn;
+        }
+        break;
+    case Op::Call:
+        for (const auto lane : lanes) {
+            if (m_sp[lane] >= STACK_DEPTH) {
+                fault(lane, Emu::Fault::StackOverflow);
+                continue;
+            }
+            m_stack[m_sp[lane] * m_lanes + lane] = m_pc[lane];
+            ++m_sp[lane];
+            m_pc[lane] = instr.nnn;
+        }
+        break;
+    case Op::SeImm:
+        skipIf([&](size_t lane) { return vx[lane] == instr.kk; });
+        break;
+    case Op::SneImm:
+        skipIf([&](size_t lane) { return vx[lane] != instr.kk; });
+        break;
+    case Op::SeReg:
+        skipIf([&](size_t lane) { return vx[lane] == vy[lane]; });
+        break;
+    case Op::SneReg:
+        skipIf([&](size_t lane) { return vx[lane] != vy[lane]; });
+        break;
+    case Op::LdImm:
+        for (const auto lane : lanes) {
+            vx[lane] = instr.kk;
+        }
+        break;
+    case Op::AddImm:
+        for (const auto lane : lanes) {
+            vx[lane] += instr.kk;
+        }
+        break;
+    case Op::LdReg:
+        for (const auto lane : lanes) {
+            vx[lane] = vy[lane];
+        }
+        break;
+    case Op::Or:
+        logic(ops::bitOr);
+        break;
+    case Op::And:
+        logic(ops::bitAnd);
+        break;
+    case Op::Xor:
+        logic(ops::bitXor);
+        break;
+    case Op::AddReg:
+        math(ops::add);
+        break;
+    case Op::Sub:
+        math(ops::sub);
+        break;
+    case Op::Subn:
+        math(ops::subn);
+        break;
+    case Op::Shr:
+        shift(ops::shr);
+        break;
+    case Op::Shl:
+        shift(ops::shl);
+        break;
+    case Op::LdI:
+        for (const auto lane : lanes) {
+            m_regI[lane] = instr.nnn;
+        }
+        break;
+    case Op::JpOffset:
+        for (const auto lane : lanes) {
+            m_pc[lane] = m_quirks.jumpV0 ? uint16_t(v0[lane] + instr.nnn) : uint16_t(vx[lane] + instr.nnn);
+        }
+        break;
+    case Op::Rnd:
+        for (const auto lane : lanes) {
+            vx[lane] = ops::random(m_rng[lane], instr.kk);
+        }
+        break;
+    case Op::Drw:
+        if (m_quirks.superChip && instr.n == 0) {
+            // 16x16 sprites aren't implemented
+            for (const auto lane : lanes) {
+                fault(lane, Emu::Fault::InvalidOpcode);
+            }
+            break;
+        }
+        for (const auto lane : lanes) {
+            const uint8_t x = vx[lane] % Display::WIDTH_PX;
+            const uint8_t y = vy[lane] % Display::HEIGHT_PX;
+            // sprite data running off the end of memory wraps around to the start, like in Emu
+            const auto sprite = laneMemory(lane);
+            const auto address = m_regI[lane] & ADDRESS_MASK;
+            const auto height = std::min<int>(instr.n, Display::HEIGHT_PX - y);
+            const auto rows = &m_rows[lane * Display::HEIGHT_PX + y];
+            Display::Row collisions = 0;
+            for (auto i = 0; i < height; ++i) {
+                const auto spriteRow = ops::spriteRow(sprite[(address + i) & ADDRESS_MASK], x);
+                collisions |= rows[i] & spriteRow;
+                rows[i] ^= spriteRow;
+            }
+            vf[lane] = collisions != 0;
+        }
+        break;
+    case Op::Skp:
+        skipIf([&](size_t lane) { return ops::keyDown(keysDown[lane], vx[lane]); });
+        break;
+    case Op::Sknp:
+        skipIf([&](size_t lane) { return !ops::keyDown(keysDown[lane], vx[lane]); });
+        break;
+    case Op::LdVxDt:
+        for (const auto lane : lanes) {
+            vx[lane] = m_delayTimer[lane];
+        }
+        break;
+    case Op::LdVxKey:
+        for (const auto lane : lanes) {
+            m_waitingForKey[lane] = true;
+            m_keyWaitRegIdx[lane] = instr.x;
+            m_keyWaitKeysDown[lane] = 0;
+            ++m_waitingLanes;
+        }
+        break;
+    case Op::LdDtVx:
+        for (const auto lane : lanes) {
+            m_delayTimer[lane] = vx[lane];
+        }
+        break;
+    case Op::LdStVx:
+        for (const auto lane : lanes) {
+            m_soundTimer[lane] = vx[lane];
+        }
+        break;
+    case Op::AddI:
+        for (const auto lane : lanes) {
+            m_regI[lane] += vx[lane];
+        }
+        break;
+    case Op::LdFont:
+        for (const auto lane : lanes) {
+            m_regI[lane] = ops::fontAddress(vx[lane]);
+        }
+        break;
+    case Op::LdBcd:
+        for (const auto lane : lanes) {
+            const auto digits = ops::bcd(vx[lane]);
+            for (auto i = 0; i < int(digits.size()); ++i) {
+                laneMemory(lane)[(m_regI[lane] + i) & ADDRESS_MASK] = digits[i];
+            }
+        }
+        break;
+    case Op::StoreRegs:
+        for (const auto lane : lanes) {
+            for (auto reg = 0; reg <= instr.x; ++reg) {
+                laneMemory(lane)[(m_regI[lane] + reg) & ADDRESS_MASK] = regV(reg)[lane];
+            }
+            if (m_quirks.memoryIncrement) {
+                m_regI[lane] += instr.x + 1;
+            }
+        }
+        break;
+    case Op::LoadRegs:
+        for (const auto lane : lanes) {
+            for (auto reg = 0; reg <= instr.x; ++reg) {
+                regV(reg)[lane] = laneMemory(lane)[(m_regI[lane] + reg) & ADDRESS_MASK];
+            }
+            if (m_quirks.memoryIncrement) {
+                m_regI[lane] += instr.x + 1;
+            }
+        }
+        break;
+    case Op::ScrollDown:
+    case Op::ScrollRight:
+    case Op::ScrollLeft:
+    case Op::Exit:
+    case Op::Lores:
+    case Op::Hires:
+    case Op::LdBigFont:
+    case Op::StoreFlags:
+    case Op::LoadFlags:
+    case Op::ScrollUp:
+    case Op::StoreRange:
+    case Op::LoadRange:
+    case Op::LdILong:
+    case Op::Plane:
+    case Op::LdAudio:
+    case Op::Pitch:
+    case Op::Undecoded:
+    case Op::Invalid:
+    case Op::Count:
+        for (const auto lane : lanes) {
+            fault(lane, Emu::Fault::InvalidOpcode);
+        }
+        break;
+    }
+}
+
+std::string BatchEmu::verifyAgainstEmu(const uint8_t* program, size_t size, size_t lanes, QuirkProfile quirks, uint64_t cycles,
+                                       const std::function<KeypadInput(size_t lane, uint64_t cycle)>& input) {
+    assert(quirksOf(quirks).memoryBytes() <= MEM_SIZE_BYTES);
+    auto batch = BatchEmu(program, size, lanes, quirks);
+    auto emus = std::vector<std::unique_ptr<Emu>>{};
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        emus.push_back(std::make_unique<Emu>(program, size, quirks));
+        // give every lane its own random stream so divergence actually gets exercised
+        emus.back()->setRandomSeed(lane);
+        batch.setRandomSeed(lane, lane);
+    }
+
+    auto keys = std::vector<KeypadInput>(lanes);
+    auto expected = std::vector<uint8_t>{};
+    auto actual = std::vector<uint8_t>{};
+    for (uint64_t cycle = 0; cycle < cycles; ++cycle) {
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            keys[lane] = input(lane, cycle);
+            emus[lane]->runCycles(1, keys[lane]);
+        }
+        batch.runCycle(keys.data());
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            // a faulted Emu stops its clock while the batch one keeps going, so once both faulted there's nothing
+            // left to compare
+            const auto fault = emus[lane]->getFault();
+            if (fault != batch.getLaneFault(lane)) {
+                return std::format("Lane {} diverged from the interpreter at cycle {}, fault {} instead of {}", lane, cycle,
+                                   to_string(batch.getLaneFault(lane)), to_string(fault));
+            }
+            if (fault != Emu::Fault::None) {
+                continue;
+            }
+            emus[lane]->saveState(expected);
+            batch.saveLaneState(lane, actual);
+            if (expected != actual) {
+                const auto mismatch = std::mismatch(expected.begin(), expected.end(), actual.begin(), actual.end());
+                return std::format("Lane {} diverged from the interpreter at cycle {}, snapshot byte {}", lane, cycle, mismatch.first - expected.begin());
+            }
+        }
+    }
+    return {};
+}
+
+} // namespace ez
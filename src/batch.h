@@ -0,0 +1,119 @@
+#pragma once
+#include "emu.h"
+
+namespace ez {
+
+// steps many copies of one program in lockstep. state is stored structure of arrays with the lane index innermost,
+// so while every lane sits on the same instruction (the usual case for one ROM fed different inputs) each opcode
+// runs as a single loop across all lanes that the compiler vectorizes. once lanes diverge, fault or wait for a key,
+// the running ones are grouped by the instruction they fetched and each group still runs as one loop.
+// opcode semantics come from ops.h, the same code the interpreter uses, and verifyAgainstEmu checks the two agree.
+class BatchEmu {
+  public:
+    static constexpr int STACK_DEPTH = 16;
+    // lanes get the chip8 address space, the extended SUPER-CHIP and XO-CHIP machine only runs in Emu
+    static constexpr int MEM_SIZE_BYTES = 4096;
+
+    // every lane starts out identical to a freshly constructed Emu running the program
+    BatchEmu(const uint8_t* program, size_t size, size_t lanes, QuirkProfile quirks = QuirkProfile::Chip8);
+
+    size_t laneCount() const { return m_lanes; }
+
+    // keysDown holds one input per lane
+    void runCycles(uint64_t n, const KeypadInput* keysDown);
+    void runFrames(uint64_t n, const KeypadInput* keysDown);
+    uint64_t cyclesUntilNextFrame() const;
+    uint64_t getCycleCount() const { return m_cycleCount; }
+
+    void setRandomSeed(size_t lane, uint64_t seed) { m_rng[lane] = Rng{seed}; }
+
+    // lanes move in and out through the snapshot format shared with Emu::saveState/loadState
+    void saveLaneState(size_t lane, std::vector<uint8_t>& out) const;
+    bool loadLaneState(size_t lane, const uint8_t* data, size_t size);
+
+    Display::Row laneRow(size_t lane, int y) const { return m_rows[lane * Display::HEIGHT_PX + y]; }
+
+    // a lane faults where Emu would, and on the SUPER-CHIP and XO-CHIP opcodes lanes don't implement, which count as
+    // invalid. it then stays on the instruction with its timers stopped while the other lanes carry on, until a
+    // snapshot is loaded into it
+    Emu::Fault getLaneFault(size_t lane) const { return m_fault[lane]; }
+
+    // counted per group of lanes that ran an instruction together, a cycle where every running lane agrees is one
+    // group. uniform groups ran as one loop over several lanes, divergent ones were a lane on its own
+    uint64_t getUniformCycles() const { return m_uniformCycles; }
+    uint64_t getDivergentCycles() const { return m_divergentCycles; }
+
+    // runs every lane next to its own Emu fed the same inputs and compares full snapshots after every cycle, and
+    // faults once a lane has one. both run the program under quirks, which has to fit in a lane's memory. returns an
+    // empty string if all lanes matched, otherwise a description of the first divergence
+    static std::string verifyAgainstEmu(const uint8_t* program, size_t size, size_t lanes, QuirkProfile quirks, uint64_t cycles,
+                                        const std::function<KeypadInput(size_t lane, uint64_t cycle)>& input);
+
+  private:
+    void runCycle(const KeypadInput* keysDown);
+    // splits m_groupKeys into m_groupLanes, m_groupStarts and m_groupOpCodes
+    void groupLanes();
+    // runs instr on every lane in lanes, an index range or list. the caller guarantees they all fetched it
+    template <typename Lanes> void execute(const Instruction& instr, const Lanes& lanes, const KeypadInput* keysDown);
+    void waitForKeypress(size_t lane, KeypadInput keysDown);
+    void advanceClock();
+    void fault(size_t lane, Emu::Fault reason);
+
+    uint8_t* regV(int reg) { return &m_regV[reg * m_lanes]; }
+    uint8_t* laneMemory(size_t lane) { return &m_memory[lane * MEM_SIZE_BYTES]; }
+    OpCode opCodeAt(size_t lane, uint16_t pc) const;
+
+    size_t m_lanes = 0;
+
+    // [reg * lanes + lane]
+    std::vector<uint8_t> m_regV;
+    std::vector<uint16_t> m_regI;
+    std::vector<uint16_t> m_pc;
+    std::vector<uint8_t> m_sp;
+    std::vector<uint8_t> m_delayTimer;
+    std::vector<uint8_t> m_soundTimer;
+    // [depth * lanes + lane]
+    std::vector<uint16_t> m_stack;
+    std::vector<Rng> m_rng;
+
+    std::vector<uint8_t> m_waitingForKey;
+    std::vector<uint8_t> m_keyWaitRegIdx;
+    std::vector<KeypadInput> m_keyWaitKeysDown;
+    size_t m_waitingLanes = 0;
+
+    std::vector<Emu::Fault> m_fault;
+    size_t m_faultedLanes = 0;
+
+    // lanes write memory independently so each keeps its own copy, [lane * MEM_SIZE_BYTES + address]
+    std::vector<uint8_t> m_memory;
+    // [lane * HEIGHT_PX + y]
+    std::vector<Display::Row> m_rows;
+
+    // quirks and the virtual clock are shared, lanes never disagree on them
+    // each opcode is one loop across the lanes, so a quirk costs a branch per batch step rather than per lane
+    QuirkProfile m_quirkProfile = QuirkProfile::Chip8;
+    Quirks m_quirks;
+    uint64_t m_cycleCount = 0;
+    uint64_t m_frameCount = 0;
+    int m_timerPhase = 0;
+
+    // scratch for grouping lanes by what they fetched. a key per running lane holds the pc, the opcode and the lane
+    // from the top down, the lanes of group g are m_groupLanes[m_groupStarts[g], m_groupStarts[g + 1])
+    struct GroupSlot {
+        uint32_t fetched = 0;
+        uint32_t stamp = 0;
+        uint32_t group = 0;
+    };
+    std::vector<uint64_t> m_groupKeys;
+    std::vector<uint32_t> m_groupLanes;
+    std::vector<uint32_t> m_groupStarts;
+    std::vector<OpCode> m_groupOpCodes;
+    std::vector<uint32_t> m_laneGroups;
+    std::vector<GroupSlot> m_groupTable;
+    uint32_t m_groupStamp = 0;
+
+    uint64_t m_uniformCycles = 0;
+    uint64_t m_divergentCycles = 0;
+};
+
+} // namespace ez
@@ -0,0 +1,391 @@
+#include "capture.h"
+#include "render.h"
+
+namespace ez {
+
+static constexpr int CANVAS_WIDTH = Display::HIRES_WIDTH_PX;
+static constexpr int CANVAS_HEIGHT = Display::HIRES_HEIGHT_PX;
+
+// raw captures are a magic + version header and the frame rate, then one record per changed frame:
+//     uint64 frame, uint8 flags, Display::Planes as little endian words
+// flags bit 0 is hires. a last record with flags 0x80 and no planes holds the frame after the end of the capture
+static constexpr std::array<uint8_t, 4> RAW_MAGIC = {'C', '8', 'F', 'C'};
+static constexpr uint16_t RAW_VERSION = 1;
+static constexpr uint8_t RAW_HIRES = 0x01;
+static constexpr uint8_t RAW_END = 0x80;
+
+static void writeBytes(std::ofstream& out, const void* data, size_t size) { out.write(static_cast<const char*>(data), std::streamsize(size)); }
+
+template <typename T> static void writeBigEndian(std::vector<uint8_t>& out, T value) {
+    for (auto shift = int(sizeof(T) * 8) - 8; shift >= 0; shift -= 8) {
+        out.push_back(uint8_t(value >> shift));
+    }
+}
+
+class FrameCapture::Encoder {
+  public:
+    explicit Encoder(std::ofstream out) : m_out(std::move(out)) {}
+    virtual ~Encoder() = default;
+
+    // a frame that differs from the previous one, shown from frame.frame until the next one
+    virtual void write(const Frame& frame) = 0;
+    // end is the frame after the last one captured, returns false if anything failed to write
+    virtual bool finish(uint64_t end) = 0;
+
+  protected:
+    // colour index 0 - 3 of a canvas pixel
+    static int colourAt(const Frame& frame, int x, int y) {
+        if (!frame.hires) {
+            x /= 2;
+            y /= 2;
+        }
+        const auto word = y * Display::WORDS_PER_ROW + x / 64;
+        const auto bit = 63 - x % 64;
+        return int((frame.planes[0][word] >> bit) & 0b1) | int(((frame.planes[1][word] >> bit) & 0b1) << 1);
+    }
+
+    std::ofstream m_out;
+};
+
+// the palette is all greys today, the conversion doesn't rely on it
+class FrameCapture::Y4mEncoder : public Encoder {
+  public:
+    explicit Y4mEncoder(std::ofstream out) : Encoder(std::move(out)) {
+        const auto header = std::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444\n", CANVAS_WIDTH, CANVAS_HEIGHT, Emu::TIMERS_PER_SECOND);
+        writeBytes(m_out, header.data(), header.size());
+        // bt.601 limited range
+        for (auto i = 0; i < 4; ++i) {
+            const auto rgb = paletteRgb888(i);
+            const auto r = double((rgb >> 16) & 0xFF), g = double((rgb >> 8) & 0xFF), b = double(rgb & 0xFF);
+            m_yuv[i][0] = uint8_t(16.5 + 0.257 * r + 0.504 * g + 0.098 * b);
+            m_yuv[i][1] = uint8_t(128.5 - 0.148 * r - 0.291 * g + 0.439 * b);
+            m_yuv[i][2] = uint8_t(128.5 + 0.439 * r - 0.368 * g - 0.071 * b);
+        }
+    }
+
+    void write(const Frame& frame) override {
+        if (m_pending) {
+            repeatPending(frame.frame);
+        }
+        for (auto y = 0; y < CANVAS_HEIGHT; ++y) {
+            for (auto x = 0; x < CANVAS_WIDTH; ++x) {
+                const auto& yuv = m_yuv[colourAt(frame, x, y)];
+                for (auto plane = 0; plane < 3; ++plane) {
+                    m_image[plane * CANVAS_WIDTH * CANVAS_HEIGHT + y * CANVAS_WIDTH + x] = yuv[plane];
+                }
+            }
+        }
+        m_pendingFrame = frame.frame;
+        m_pending = true;
+    }
+
+    bool finish(uint64_t end) override {
+        if (m_pending) {
+            repeatPending(end);
+        }
+        m_out.flush();
+        return bool(m_out);
+    }
+
+  private:
+    // y4m has no timestamps, a frame is in the file once for every emulated frame it was on screen
+    void repeatPending(uint64_t until) {
+        for (auto frame = m_pendingFrame; frame < until; ++frame) {
+            writeBytes(m_out, "FRAME\n", 6);
+            writeBytes(m_out, m_image.data(), m_image.size());
+        }
+    }
+
+    std::array<std::array<uint8_t, 3>, 4> m_yuv{};
+    std::array<uint8_t, 3 * CANVAS_WIDTH * CANVAS_HEIGHT> m_image{};
+    uint64_t m_pendingFrame = 0;
+    bool m_pending = false;
+};
+
+// 2 bit indexed colour. the image data goes into stored deflate blocks, the frames are small and mostly repeat
+// whole, so real compression would buy little for the dependency it brings
+class FrameCapture::ApngEncoder : public Encoder {
+  public:
+    explicit ApngEncoder(std::ofstream out) : Encoder(std::move(out)) {
+        static constexpr std::array<uint8_t, 8> SIGNATURE = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        writeBytes(m_out, SIGNATURE.data(), SIGNATURE.size());
+
+        auto data = std::vector<uint8_t>{};
+        writeBigEndian(data, uint32_t(CANVAS_WIDTH));
+        writeBigEndian(data, uint32_t(CANVAS_HEIGHT));
+        // bit depth 2, indexed colour, deflate, adaptive filtering, not interlaced
+        data.insert(data.end(), {2, 3, 0, 0, 0});
+        writeChunk("IHDR", data);
+
+        // patched with the real frame count by finish
+        m_actlPosition = m_out.tellp();
+        writeActl(0);
+
+        data.clear();
+        for (auto i = 0; i < 4; ++i) {
+            const auto rgb = paletteRgb888(i);
+            data.insert(data.end(), {uint8_t(rgb >> 16), uint8_t(rgb >> 8), uint8_t(rgb)});
+        }
+        writeChunk("PLTE", data);
+    }
+
+    void write(const Frame& frame) override {
+        if (m_pending) {
+            writePending(frame.frame);
+        }
+        m_pendingFrame = frame;
+        m_pending = true;
+    }
+
+    bool finish(uint64_t end) override {
+        if (!m_pending) {
+            // a png needs an image, an empty capture is one blank frame
+            m_pendingFrame = Frame{};
+            m_pendingFrame.frame = end > 0 ? end - 1 : 0;
+            end = m_pendingFrame.frame + 1;
+        }
+        writePending(end);
+        writeChunk("IEND", {});
+        m_out.seekp(m_actlPosition);
+        writeActl(m_frames);
+        m_out.flush();
+        return bool(m_out);
+    }
+
+  private:
+    void writePending(uint64_t until) {
+        // delays are 16 bit, a frame held for longer is written again
+        for (auto held = until - m_pendingFrame.frame; held > 0;) {
+            const auto delay = uint16_t(std::min<uint64_t>(held, UINT16_MAX));
+            writeFrame(m_pendingFrame, delay);
+            held -= delay;
+        }
+    }
+
+    void writeFrame(const Frame& frame, uint16_t delay) {
+        auto control = std::vector<uint8_t>{};
+        writeBigEndian(control, m_sequence++);
+        writeBigEndian(control, uint32_t(CANVAS_WIDTH));
+        writeBigEndian(control, uint32_t(CANVAS_HEIGHT));
+        writeBigEndian(control, uint32_t(0));
+        writeBigEndian(control, uint32_t(0));
+        writeBigEndian(control, delay);
+        writeBigEndian(control, uint16_t(Emu::TIMERS_PER_SECOND));
+        // no disposal, every frame covers the whole canvas
+        control.insert(control.end(), {0, 0});
+        writeChunk("fcTL", control);
+
+        // scanlines of 2 bit pixels, each behind a filter type byte of 0
+        constexpr auto ROW_BYTES = 1 + CANVAS_WIDTH * 2 / 8;
+        constexpr auto IMAGE_BYTES = ROW_BYTES * CANVAS_HEIGHT;
+        static_assert(IMAGE_BYTES <= UINT16_MAX, "one stored block holds the whole image");
+        auto image = std::array<uint8_t, IMAGE_BYTES>{};
+        for (auto y = 0; y < CANVAS_HEIGHT; ++y) {
+            for (auto x = 0; x < CANVAS_WIDTH; ++x) {
+                image[y * ROW_BYTES + 1 + x / 4] |= uint8_t(colourAt(frame, x, y) << (6 - 2 * (x % 4)));
+            }
+        }
+
+        auto data = std::vector<uint8_t>{};
+        // the first frame is the default image, later ones carry a sequence number of their own
+        if (m_frames > 0) {
+            writeBigEndian(data, m_sequence++);
+        }
+        // zlib header, one final stored block, adler-32 of the data
+        data.insert(data.end(), {0x78, 0x01, 0x01, uint8_t(IMAGE_BYTES), uint8_t(IMAGE_BYTES >> 8), uint8_t(~IMAGE_BYTES),
+                                 uint8_t(~IMAGE_BYTES >> 8)});
+        data.insert(data.end(), image.begin(), image.end());
+        uint32_t a = 1, b = 0;
+        for (const auto byte : image) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        writeBigEndian(data, (b << 16) | a);
+        writeChunk(m_frames > 0 ? "fdAT" : "IDAT", data);
+        ++m_frames;
+    }
+
+    void writeActl(uint32_t frames) {
+        auto data = std::vector<uint8_t>{};
+        writeBigEndian(data, frames);
+        // loop forever
+        writeBigEndian(data, uint32_t(0));
+        writeChunk("acTL", data);
+    }
+
+    void writeChunk(const char (&type)[5], const std::vector<uint8_t>& data) {
+        auto header = std::vector<uint8_t>{};
+        writeBigEndian(header, uint32_t(data.size()));
+        writeBytes(m_out, header.data(), header.size());
+        writeBytes(m_out, type, 4);
+        writeBytes(m_out, data.data(), data.size());
+        auto crc = crc32(~uint32_t(0), reinterpret_cast<const uint8_t*>(type), 4);
+        crc = ~crc32(crc, data.data(), data.size());
+        auto trailer = std::vector<uint8_t>{};
+        writeBigEndian(trailer, crc);
+        writeBytes(m_out, trailer.data(), trailer.size());
+    }
+
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+        static const auto table = []() {
+            auto table = std::array<uint32_t, 256>{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                auto c = i;
+                for (auto bit = 0; bit < 8; ++bit) {
+                    c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                table[i] = c;
+            }
+            return table;
+        }();
+        for (size_t i = 0; i < size; ++i) {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    std::streampos m_actlPosition = 0;
+    uint32_t m_sequence = 0;
+    uint32_t m_frames = 0;
+    Frame m_pendingFrame{};
+    bool m_pending = false;
+};
+
+class FrameCapture::RawEncoder : public Encoder {
+  public:
+    explicit RawEncoder(std::ofstream out) : Encoder(std::move(out)) {
+        writeBytes(m_out, RAW_MAGIC.data(), RAW_MAGIC.size());
+        writeBytes(m_out, &RAW_VERSION, sizeof(RAW_VERSION));
+        const auto framesPerSecond = uint16_t(Emu::TIMERS_PER_SECOND);
+        writeBytes(m_out, &framesPerSecond, sizeof(framesPerSecond));
+    }
+
+    void write(const Frame& frame) override {
+        const uint8_t flags = frame.hires ? RAW_HIRES : 0;
+        writeBytes(m_out, &frame.frame, sizeof(frame.frame));
+        writeBytes(m_out, &flags, sizeof(flags));
+        writeBytes(m_out, frame.planes.data(), sizeof(frame.planes));
+    }
+
+    bool finish(uint64_t end) override {
+        writeBytes(m_out, &end, sizeof(end));
+        writeBytes(m_out, &RAW_END, sizeof(RAW_END));
+        m_out.flush();
+        return bool(m_out);
+    }
+};
+
+std::optional<FrameCapture::Format> FrameCapture::parseFormat(std::string_view name) {
+    if (name == "y4m") {
+        return Format::Y4m;
+    }
+    if (name == "apng") {
+        return Format::Apng;
+    }
+    if (name == "raw") {
+        return Format::Raw;
+    }
+    return std::nullopt;
+}
+
+const char* FrameCapture::extension(Format format) {
+    switch (format) {
+    case Format::Y4m:
+        return ".y4m";
+    case Format::Apng:
+        return ".png";
+    case Format::Raw:
+        return ".c8f";
+    }
+    return "";
+}
+
+std::unique_ptr<FrameCapture> FrameCapture::open(const std::filesystem::path& path, Format format) {
+    auto out = std::ofstream(path, std::ios::binary);
+    if (!out) {
+        log_error("Failed to create capture {}", path.string());
+        return nullptr;
+    }
+    auto encoder = std::unique_ptr<Encoder>{};
+    switch (format) {
+    case Format::Y4m:
+        encoder = std::make_unique<Y4mEncoder>(std::move(out));
+        break;
+    case Format::Apng:
+        encoder = std::make_unique<ApngEncoder>(std::move(out));
+        break;
+    case Format::Raw:
+        encoder = std::make_unique<RawEncoder>(std::move(out));
+        break;
+    }
+    return std::unique_ptr<FrameCapture>(new FrameCapture(path, std::move(encoder)));
+}
+
+FrameCapture::FrameCapture(std::filesystem::path path, std::unique_ptr<Encoder> encoder)
+    : m_path(std::move(path)), m_encoder(std::move(encoder)) {
+    m_thread = std::thread([this]() { run(); });
+}
+
+FrameCapture::~FrameCapture() {
+    m_stopping.store(true, std::memory_order_release);
+    m_pushed.fetch_add(1, std::memory_order_release);
+    m_pushed.notify_one();
+    m_thread.join();
+    log_info("Captured {} frames to {}, {} of them changed, {} dropped", m_received, m_path.string(), m_written, m_dropped);
+}
+
+bool FrameCapture::push(const Display& display, uint64_t frame, bool wait) {
+    const auto item = Frame{display.planes(), display.isHires(), frame};
+    for (;;) {
+        const auto popped = m_popped.load(std::memory_order_acquire);
+        if (m_queue.push(item)) {
+            break;
+        }
+        if (!wait) {
+            ++m_dropped;
+            return false;
+        }
+        m_popped.wait(popped, std::memory_order_acquire);
+    }
+    m_pushed.fetch_add(1, std::memory_order_release);
+    m_pushed.notify_one();
+    return true;
+}
+
+void FrameCapture::run() {
+    // the last frame written, compared in full. a couple of KB, and a hash collision would silently drop a frame
+    auto lastPlanes = Display::Planes{};
+    bool lastHires = false;
+    uint64_t end = 0;
+    for (;;) {
+        const auto pushed = m_pushed.load(std::memory_order_acquire);
+        const auto frame = m_queue.front();
+        if (!frame) {
+            // frames pushed before stopping was set are still picked up by the next look at the queue
+            if (m_stopping.load(std::memory_order_acquire) && !m_queue.front()) {
+                break;
+            }
+            m_pushed.wait(pushed, std::memory_order_acquire);
+            continue;
+        }
+
+        // identical consecutive frames are the common case, a chip8 program redraws rarely
+        if (m_received == 0 || frame->hires != lastHires || frame->planes != lastPlanes) {
+            m_encoder->write(*frame);
+            lastPlanes = frame->planes;
+            lastHires = frame->hires;
+            ++m_written;
+        }
+        ++m_received;
+        end = frame->frame + 1;
+
+        m_queue.pop();
+        m_popped.fetch_add(1, std::memory_order_release);
+        m_popped.notify_one();
+    }
+    if (!m_encoder->finish(end)) {
+        log_error("Failed to write capture {}", m_path.string());
+    }
+}
+
+} // namespace ez
@@ -0,0 +1,77 @@
+#pragma once
+#include "emu.h"
+#include "spsc_queue.h"
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+namespace ez {
+
+// records frames to a video file on a background thread. the emulation side copies each finished frame into a
+// bounded queue and carries on, the encoder thread drops frames whose content hasn't changed since the previous one
+// and writes the rest. every format uses a fixed 128x64 canvas with lores pixels doubled, and time is emulated time,
+// one unit per timer tick
+class FrameCapture {
+  public:
+    enum class Format : uint8_t {
+        // uncompressed 4:4:4 video at 60 fps, every emulated frame is in the file, held ones are repeated
+        Y4m,
+        // animated png, only the frames that changed, each shown for as long as the emulator held it
+        Apng,
+        // the bit planes of every changed frame with its frame number, see capture.cpp for the layout
+        Raw,
+    };
+    // frames the encoder may fall behind by
+    static constexpr size_t QUEUE_FRAMES = 64;
+
+    // y4m, apng or raw
+    static std::optional<Format> parseFormat(std::string_view name);
+    // .y4m, .png or .c8f
+    static const char* extension(Format format);
+
+    // creates the file and starts the encoder thread, null if the file can't be written
+    static std::unique_ptr<FrameCapture> open(const std::filesystem::path& path, Format format);
+    // encodes whatever is still queued, finishes the file and logs what was captured
+    ~FrameCapture();
+
+    FrameCapture(FrameCapture&) = delete;
+    FrameCapture(FrameCapture&&) = delete;
+
+    // emulation thread only, queues the display as it is at the given frame. when the queue is full the frame is
+    // dropped and false returned, unless wait is set, then it waits for the encoder instead. frame numbers must
+    // increase from call to call
+    bool push(const Display& display, uint64_t frame, bool wait = false);
+
+  private:
+    struct Frame {
+        Display::Planes planes{};
+        bool hires = false;
+        uint64_t frame = 0;
+    };
+    class Encoder;
+    class Y4mEncoder;
+    class ApngEncoder;
+    class RawEncoder;
+
+    FrameCapture(std::filesystem::path path, std::unique_ptr<Encoder> encoder);
+    void run();
+
+    const std::filesystem::path m_path;
+    const std::unique_ptr<Encoder> m_encoder;
+    SpscQueue<Frame, QUEUE_FRAMES> m_queue;
+    // bumped after every push and pop, both sides sleep on the other one's counter
+    std::atomic<uint32_t> m_pushed = 0;
+    std::atomic<uint32_t> m_popped = 0;
+    std::atomic<bool> m_stopping = false;
+
+    // emulation thread
+    uint64_t m_dropped = 0;
+
+    // encoder thread
+    uint64_t m_received = 0;
+    uint64_t m_written = 0;
+
+    std::thread m_thread;
+};
+
+} // namespace ez
@@ -0,0 +1,189 @@
+#include "chip8.h"
+#include "emu.h"
+
+#include <mutex>
+
+using namespace ez;
+
+// the handle owns the machine in place, so load_rom replaces it without moving the framebuffer get_display handed out
+struct chip8_emu {
+    Emu emu;
+};
+
+namespace {
+
+// one byte stands in for the missing program of a freshly created machine
+constexpr uint8_t NO_PROGRAM[1] = {};
+
+chip8_status statusOf(const Emu& emu) {
+    switch (emu.getFault()) {
+    case Emu::Fault::None:
+        break;
+    case Emu::Fault::InvalidOpcode:
+        return CHIP8_FAULT_INVALID_OPCODE;
+    case Emu::Fault::StackUnderflow:
+        return CHIP8_FAULT_STACK_UNDERFLOW;
+    case Emu::Fault::StackOverflow:
+        return CHIP8_FAULT_STACK_OVERFLOW;
+    }
+    return emu.shouldExit() ? CHIP8_EXITED : CHIP8_OK;
+}
+
+// the tools linking the core log to stdout, a host process only gets the log if it asked for it with chip8_set_log
+std::once_flag g_logDefault;
+
+static_assert(CHIP8_LOG_INFO == int(LogLevel::INFO) && CHIP8_LOG_CRITICAL == int(LogLevel::CRITICAL), "chip8_log_level mirrors LogLevel");
+
+void silenceLogByDefault() {
+    std::call_once(g_logDefault, []() { logging::setSink(nullptr); });
+}
+
+// nothing may unwind into a C caller
+template <typename F> chip8_status guarded(F&& fn) {
+    try {
+        return fn();
+    } catch (const std::bad_alloc&) {
+        return CHIP8_ERROR_OUT_OF_MEMORY;
+    } catch (...) {
+        return CHIP8_ERROR_INTERNAL;
+    }
+}
+
+} // namespace
+
+uint32_t chip8_abi_version(void) { return CHIP8_ABI_VERSION; }
+
+const char* chip8_status_string(chip8_status status) {
+    switch (status) {
+    case CHIP8_OK:
+        return "ok";
+    case CHIP8_ERROR_INVALID_ARGUMENT:
+        return "invalid argument";
+    case CHIP8_ERROR_ROM_TOO_LARGE:
+        return "rom too large";
+    case CHIP8_ERROR_OUT_OF_MEMORY:
+        return "out of memory";
+    case CHIP8_ERROR_INTERNAL:
+        return "internal error";
+    case CHIP8_EXITED:
+        return "exited";
+    case CHIP8_FAULT_INVALID_OPCODE:
+        return "invalid opcode";
+    case CHIP8_FAULT_STACK_UNDERFLOW:
+        return "stack underflow";
+    case CHIP8_FAULT_STACK_OVERFLOW:
+        return "stack overflow";
+    }
+    return "unknown status";
+}
+
+void chip8_set_log(chip8_log_fn fn, void* user) {
+    // an earlier chip8_set_log counts as the host having chosen, chip8_create won't silence it afterwards
+    std::call_once(g_logDefault, []() {});
+    if (!fn) {
+        logging::setSink(nullptr);
+        return;
+    }
+    logging::setSink([fn, user](LogLevel level, std::string_view line) { fn(chip8_log_level(level), std::string(line).c_str(), user); });
+}
+
+chip8_status chip8_create(chip8_emu** out) {
+    if (!out) {
+        return CHIP8_ERROR_INVALID_ARGUMENT;
+    }
+    silenceLogByDefault();
+    return guarded([&]() {
+        *out = new chip8_emu{Emu(NO_PROGRAM, 0)};
+        return CHIP8_OK;
+    });
+}
+
+void chip8_destroy(chip8_emu* emu) { delete emu; }
+
+chip8_status chip8_load_rom(chip8_emu* emu, const uint8_t* rom, size_t size, chip8_quirks quirks, uint64_t seed) {
+    if (!emu || (!rom && size > 0) || quirks < CHIP8_QUIRKS_AUTO || quirks > CHIP8_QUIRKS_XOCHIP) {
+        return CHIP8_ERROR_INVALID_ARGUMENT;
+    }
+    if (!rom) {
+        rom = NO_PROGRAM;
+    }
+    const auto forced = quirks == CHIP8_QUIRKS_AUTO ? std::nullopt : std::optional(QuirkProfile(quirks - CHIP8_QUIRKS_CHIP8));
+    // the chip8 and schip machines only have 4 KB
+    if (size > Emu::maxProgramSize(Emu::profileFor(rom, size, forced))) {
+        return CHIP8_ERROR_ROM_TOO_LARGE;
+    }
+    return guarded([&]() {
+        // in place, chip8_get_display's plane pointers stay valid. the backend is a setting of the handle rather than
+        // the rom, it carries over
+        emu->emu.load(rom, size, Emu::profileFor(rom, size, forced));
+        emu->emu.setRandomSeed(seed);
+        return CHIP8_OK;
+    });
+}
+
+chip8_status chip8_set_jit(chip8_emu* emu, int enabled) {
+    if (!emu) {
+        return CHIP8_ERROR_INVALID_ARGUMENT;
+    }
+    return guarded([&]() {
+        emu->emu.setBackend(enabled ? Emu::Backend::Jit : Emu::Backend::Interpreter);
+        return CHIP8_OK;
+    });
+}
+
+chip8_status chip8_step(chip8_emu* const* emus, const uint32_t* keys, size_t count, uint64_t frames, chip8_status* statuses) {
+    if (count > 0 && (!emus || !keys)) {
+        return CHIP8_ERROR_INVALID_ARGUMENT;
+    }
+    auto result = CHIP8_OK;
+    for (size_t i = 0; i < count; ++i) {
+        auto status = CHIP8_ERROR_INVALID_ARGUMENT;
+        if (emus[i]) {
+            status = guarded([&]() {
+                emus[i]->emu.runFrames(frames, keys[i]);
+                return statusOf(emus[i]->emu);
+            });
+        }
+        if (statuses) {
+            statuses[i] = status;
+        }
+        if (result == CHIP8_OK) {
+            result = status;
+        }
+    }
+    return result;
+}
+
+chip8_status chip8_get_cpu(const chip8_emu* emu, chip8_cpu* out) {
+    if (!emu || !out) {
+        return CHIP8_ERROR_INVALID_ARGUMENT;
+    }
+    const auto& cpu = emu->emu.getState().cpu;
+    std::copy(cpu.regV.begin(), cpu.regV.end(), out->v);
+    out->i = cpu.regI;
+    out->pc = cpu.pc;
+    out->sp = cpu.sp;
+    out->delay_timer = cpu.delayTimer;
+    out->sound_timer = cpu.soundTimer;
+    out->waiting_for_key = cpu.waitingForKey;
+    out->cycles = cpu.cycleCount;
+    out->frames = cpu.frameCount;
+    return CHIP8_OK;
+}
+
+chip8_status chip8_get_display(const chip8_emu* emu, chip8_display* out) {
+    if (!emu || !out) {
+        return CHIP8_ERROR_INVALID_ARGUMENT;
+    }
+    static_assert(Display::PLANES == 2 && std::is_same_v<Display::Row, uint64_t>, "chip8_display exposes the planes as they are");
+    const auto& display = emu->emu.getState().display;
+    for (auto plane = 0; plane < Display::PLANES; ++plane) {
+        out->planes[plane] = display.planes()[plane].data();
+    }
+    out->width = uint32_t(display.width());
+    out->height = uint32_t(display.height());
+    out->words_per_row = Display::WORDS_PER_ROW;
+    out->hires = display.isHires();
+    out->generation = display.generation();
+    return CHIP8_OK;
+}
@@ -0,0 +1,127 @@
+/* the C interface of the chip8core library, for embedding the emulator in other programs and languages. nothing in
+ * it changes between releases without CHIP8_ABI_VERSION changing too, the C++ classes behind it carry no such
+ * promise. every call reports problems through chip8_status rather than aborting, and none of them keep pointers to
+ * what is passed in. a chip8_emu is not thread safe, different ones can be used from different threads */
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define CHIP8_API
+#else
+#define CHIP8_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIP8_ABI_VERSION 1
+
+typedef struct chip8_emu chip8_emu;
+
+typedef enum chip8_status {
+    CHIP8_OK = 0,
+    /* a null handle or pointer, or an enum value out of range */
+    CHIP8_ERROR_INVALID_ARGUMENT = 1,
+    /* the rom doesn't fit between 0x200 and the end of memory, 4 KB unless the profile is XO-CHIP */
+    CHIP8_ERROR_ROM_TOO_LARGE = 2,
+    CHIP8_ERROR_OUT_OF_MEMORY = 3,
+    /* anything else that went wrong inside the library */
+    CHIP8_ERROR_INTERNAL = 4,
+
+    /* the machine stopped and stays where it is until another rom is loaded */
+    /* the program ran 00FD */
+    CHIP8_EXITED = 16,
+    CHIP8_FAULT_INVALID_OPCODE = 17,
+    /* 00EE with nothing on the stack */
+    CHIP8_FAULT_STACK_UNDERFLOW = 18,
+    /* 2nnn with 16 return addresses already on the stack */
+    CHIP8_FAULT_STACK_OVERFLOW = 19,
+} chip8_status;
+
+typedef enum chip8_quirks {
+    /* whatever the built in database has for the rom, chip8 if it doesn't know it */
+    CHIP8_QUIRKS_AUTO = 0,
+    /* the original COSMAC VIP interpreter */
+    CHIP8_QUIRKS_CHIP8 = 1,
+    /* SUPER-CHIP 1.1 on the HP48 */
+    CHIP8_QUIRKS_SCHIP = 2,
+    /* Octo's XO-CHIP */
+    CHIP8_QUIRKS_XOCHIP = 3,
+} chip8_quirks;
+
+typedef struct chip8_cpu {
+    uint8_t v[16];
+    uint16_t i;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    /* Fx0A is waiting for a key */
+    uint8_t waiting_for_key;
+    /* instructions and 60 hz frames since power on */
+    uint64_t cycles;
+    uint64_t frames;
+} chip8_cpu;
+
+typedef enum chip8_log_level {
+    CHIP8_LOG_INFO = 0,
+    CHIP8_LOG_WARN = 1,
+    CHIP8_LOG_ERROR = 2,
+    /* the library is about to abort the process */
+    CHIP8_LOG_CRITICAL = 3,
+} chip8_log_level;
+
+/* one log line, without a trailing newline. it's only valid during the call */
+typedef void (*chip8_log_fn)(chip8_log_level level, const char* line, void* user);
+
+/* the framebuffer as the machine keeps it, 1 bit per pixel with the leftmost pixel in the most significant bit.
+ * each plane holds 64 rows of words_per_row words whatever the mode, a lores frame uses the first word of the first
+ * 32 rows. a pixel's colour index is its bit from plane 0 plus twice its bit from plane 1 */
+typedef struct chip8_display {
+    const uint64_t* planes[2];
+    uint32_t width;
+    uint32_t height;
+    uint32_t words_per_row;
+    uint8_t hires;
+    /* changes whenever the framebuffer does, so unchanged frames can be skipped */
+    uint64_t generation;
+} chip8_display;
+
+CHIP8_API uint32_t chip8_abi_version(void);
+CHIP8_API const char* chip8_status_string(chip8_status status);
+
+/* the library keeps its log to itself unless fn is set, it then gets every line on a thread of the library's, one
+ * call at a time. null turns the log off again. this is process wide, not per machine */
+CHIP8_API void chip8_set_log(chip8_log_fn fn, void* user);
+
+/* a powered on machine with no program, *out is only written on success */
+CHIP8_API chip8_status chip8_create(chip8_emu** out);
+/* null is fine */
+CHIP8_API void chip8_destroy(chip8_emu* emu);
+
+/* powers the machine on with a new rom, Cxkk draws from a generator seeded with seed. the rom is copied */
+CHIP8_API chip8_status chip8_load_rom(chip8_emu* emu, const uint8_t* rom, size_t size, chip8_quirks quirks, uint64_t seed);
+/* compiles hot code to x86-64 where supported, otherwise the machine stays on the interpreter and this still
+ * succeeds. the results are the same either way */
+CHIP8_API chip8_status chip8_set_jit(chip8_emu* emu, int enabled);
+
+/* runs frames frames of emulated time on each of count machines, emus[n] with keys[n] held (bit k for hex key k).
+ * one call for a whole batch keeps the per call overhead off every machine. statuses, if not null, receives each
+ * machine's state afterwards. returns CHIP8_OK if every machine is still running, otherwise the first status that
+ * isn't. the same machine must not appear twice */
+CHIP8_API chip8_status chip8_step(chip8_emu* const* emus, const uint32_t* keys, size_t count, uint64_t frames, chip8_status* statuses);
+
+CHIP8_API chip8_status chip8_get_cpu(const chip8_emu* emu, chip8_cpu* out);
+/* the plane pointers point into the machine itself, they stay valid and show every later change until the machine
+ * is destroyed */
+CHIP8_API chip8_status chip8_get_display(const chip8_emu* emu, chip8_display* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
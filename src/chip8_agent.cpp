@@ -0,0 +1,184 @@
+// runs one rom on behalf of another process, e.g. a reinforcement learning agent, through shared memory rather than a
+// pipe or socket. the agent writes keys and a frame count into the region, the emulator runs that many frames and
+// leaves the registers and framebuffer in the region for the agent to read in place. see agent.h for the layout and
+// the protocol, AgentChannel::attach and step are all a C++ agent needs
+//
+// usage: chip8-agent [--name /chip8-agent] [--quirks profile] [--seed n] [--jit] <rom>
+//        chip8-agent --client [--name /chip8-agent] [--steps n] [--frames n]
+//
+// the emulator creates the shared memory object --name and serves requests until an agent sends Quit or the process
+// is interrupted. the rom runs with the profile the quirk database has for it unless --quirks overrides it, Reset
+// goes back to power on with the seed the agent gives, --seed is the one it starts with.
+//
+// --client is a stand-in agent for measuring the round trip: it sends --steps steps of --frames frames each with
+// changing keys, then Quit, and logs how many steps a second made it through
+
+#include "agent.h"
+#include "base.h"
+
+#include <csignal>
+#include <fstream>
+
+using namespace ez;
+
+namespace {
+
+constexpr auto DEFAULT_NAME = "/chip8-agent";
+constexpr uint64_t DEFAULT_STEPS = 100000;
+// how often the emulator looks for an interrupt while no request comes
+constexpr auto INTERRUPT_POLL_INTERVAL = chrono::milliseconds(100);
+
+volatile std::sig_atomic_t g_interrupted = 0;
+
+// copies the machine into the region. only the framebuffer rows changed since the agent last saw them are copied,
+// most frames change a handful of rows or none
+void publish(Emu& emu, AgentRegion& region) {
+    const auto& state = emu.getState();
+    region.cpu = state.cpu;
+    region.exited = state.exited;
+    region.fault = state.fault;
+
+    const auto& display = emu.getDisplay();
+    region.hires = display.isHires();
+    const auto rows = display.dirtyRowsSince(region.displayGeneration);
+    for (auto y = 0; y < Display::HIRES_HEIGHT_PX; ++y) {
+        if ((rows >> y) & 0b1) {
+            for (auto plane = 0; plane < Display::PLANES; ++plane) {
+                const auto first = display.planes()[plane].begin() + y * Display::WORDS_PER_ROW;
+                std::copy(first, first + Display::WORDS_PER_ROW, region.planes[plane].begin() + y * Display::WORDS_PER_ROW);
+            }
+        }
+    }
+    region.displayGeneration = display.generation();
+}
+
+int serve(const std::string& name, const std::filesystem::path& romPath, std::optional<QuirkProfile> quirks, uint64_t seed, Emu::Backend backend) {
+    auto is = std::ifstream(romPath, std::ios::binary);
+    if (!is) {
+        log_error("Failed to open rom {}", romPath.string());
+        return 1;
+    }
+    const auto rom = std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+    const auto profile = Emu::profileFor(rom.data(), rom.size(), quirks);
+    if (rom.size() > Emu::maxProgramSize(profile)) {
+        log_error("Rom {} is {} bytes, too large to load under the {} profile", romPath.string(), rom.size(), to_string(profile));
+        return 1;
+    }
+
+    auto emu = Emu::fromRom(rom.data(), rom.size(), quirks);
+    emu.setRandomSeed(seed);
+    emu.setBackend(backend);
+    // Reset copies back only what the episode changed, see resetToCheckpoint
+    emu.setCheckpoint();
+
+    const auto channel = AgentChannel::create(name);
+    if (!channel) {
+        return 1;
+    }
+    auto& region = channel->region();
+    publish(emu, region);
+    log_info("Serving {} on {}", romPath.filename().string(), name);
+
+    std::signal(SIGINT, [](int) { g_interrupted = 1; });
+    std::signal(SIGTERM, [](int) { g_interrupted = 1; });
+    uint64_t requests = 0;
+    bool quit = false;
+    while (!quit && !g_interrupted) {
+        if (!channel->waitForRequest(INTERRUPT_POLL_INTERVAL)) {
+            continue;
+        }
+        switch (region.command) {
+        case AgentCommand::Step:
+            emu.runFrames(region.frames, region.keys);
+            break;
+        case AgentCommand::Reset:
+            emu.resetToCheckpoint();
+            emu.setRandomSeed(region.seed);
+            break;
+        case AgentCommand::Quit:
+            quit = true;
+            break;
+        }
+        publish(emu, region);
+        channel->complete();
+        ++requests;
+    }
+    log_info("Served {} requests, {} frames", requests, emu.getFrameCount());
+    return 0;
+}
+
+int runClient(const std::string& name, uint64_t steps, uint32_t frames) {
+    const auto channel = AgentChannel::attach(name);
+    if (!channel) {
+        return 1;
+    }
+    auto& region = channel->region();
+    channel->reset(0);
+    uint64_t changedFrames = 0;
+    auto lastGeneration = region.displayGeneration;
+    const auto start = chrono::steady_clock::now();
+    for (uint64_t step = 0; step < steps; ++step) {
+        // a different key every few steps, enough to get most roms past their title screen
+        channel->step(KeypadInput(1) << (step / 8 % 16), frames);
+        changedFrames += region.displayGeneration != lastGeneration;
+        lastGeneration = region.displayGeneration;
+    }
+    const auto elapsed = chrono::duration<double>(chrono::steady_clock::now() - start);
+    region.command = AgentCommand::Quit;
+    channel->request();
+    log_info("{} steps of {} frames in {:.3f}s, {:.0f} steps/s, {:.2f} us per round trip, the framebuffer changed on {}", steps, frames,
+             elapsed.count(), double(steps) / elapsed.count(), elapsed.count() * 1e6 / double(steps), changedFrames);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto name = std::string(DEFAULT_NAME);
+    auto quirks = std::optional<QuirkProfile>{};
+    uint64_t seed = 0;
+    auto backend = Emu::Backend::Interpreter;
+    bool client = false;
+    auto steps = DEFAULT_STEPS;
+    uint32_t frames = 1;
+    auto romPath = std::filesystem::path{};
+
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--name" && hasValue) {
+            name = argv[++i];
+        } else if (arg == "--seed" && hasValue) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg == "--steps" && hasValue) {
+            steps = std::stoull(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            frames = uint32_t(std::stoul(argv[++i]));
+        } else if (arg == "--client") {
+            client = true;
+        } else if (arg == "--jit") {
+            backend = Emu::Backend::Jit;
+        } else if (arg == "--quirks" && hasValue) {
+            quirks = parseQuirkProfile(argv[++i]);
+            if (!quirks) {
+                log_error("Unknown quirk profile {}, expected chip8, schip or xochip", argv[i]);
+                return 1;
+            }
+        } else if (arg.starts_with("--")) {
+            log_error("Unknown option {}", arg);
+            return 1;
+        } else {
+            romPath = arg;
+        }
+    }
+
+    if (client) {
+        return runClient(name, steps, frames);
+    }
+    if (romPath.empty()) {
+        log_error("usage: chip8-agent [--name /chip8-agent] [--quirks profile] [--seed n] [--jit] <rom>\n"
+                  "       chip8-agent --client [--name /chip8-agent] [--steps n] [--frames n]");
+        return 1;
+    }
+    return serve(name, romPath, quirks, seed, backend);
+}
@@ -0,0 +1,436 @@
+// headless runner for rom corpora, runs every job on its own Emu spread across all cores and prints one csv line each
+//
+// usage: chip8-batch [--threads n] [--frames n] [--jit] [--quirks profile] [--no-idle-skip] [--output file] [--profile dir]
+//                    [--capture dir] [--capture-format y4m|apng|raw] [--trace dir] [--trace-records n] <job list | rom>...
+//
+// a job list has one job per line, blank lines and anything after # are ignored:
+//     <rom path> <frames | -> [input script | movie | -] [seed]
+// roms given directly on the command line run for --frames frames with no input and seed 0.
+//
+// an input script holds the keypad state per frame, each line replaces the held keys from that frame onwards:
+//     <frame> [hex key digit]...
+// e.g. "120 4 6" holds keys 4 and 6 from frame 120 until the next line, "300" releases everything.
+//
+// a movie recorded in the interactive frontend (see movie.h) works as an input too. it brings its own quirk profile
+// and seed, which win over --quirks and the job's seed, and has to be replayed on the rom it was recorded on. frames
+// can be - to run exactly as long as the movie.
+//
+// every rom runs with the quirk profile the database in quirks.cpp has for it, --quirks chip8|schip|xochip overrides it.
+// --profile writes <job index>-<rom>.profile.json and .trace.json per job into dir, see profiler.h
+// --no-idle-skip interprets every iteration of busy waits instead of fast-forwarding them, the results are the same
+// --capture writes every frame of each job to <job index>-<rom>.png (or .y4m, .c8f) in dir, see capture.h. the job
+// then runs a frame at a time and waits for its encoder whenever that falls behind, the results are the same
+// --trace records every instruction of each job into <job index>-<rom>.c8t in dir, a ring of the last --trace-records
+// instructions (4M by default), see trace.h. chip8-trace reads them. idle loops then run instruction by instruction,
+// the results are the same
+
+#include "base.h"
+#include "capture.h"
+#include "emu.h"
+#include "movie.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <sstream>
+
+using namespace ez;
+
+namespace {
+
+constexpr uint64_t DEFAULT_FRAMES = 600;
+
+struct InputScript {
+    // sorted by frame, the keys held from that frame until the next entry
+    std::vector<std::pair<uint64_t, KeypadInput>> changes;
+
+    // what a movie was recorded with, it only replays the same way on the same rom with the same profile and seed
+    struct Recording {
+        uint64_t romHash = 0;
+        QuirkProfile quirks = QuirkProfile::Chip8;
+        uint64_t seed = 0;
+        uint64_t frames = 0;
+    };
+    std::optional<Recording> recording;
+
+    KeypadInput keysAt(uint64_t frame, size_t& cursor) const {
+        while (cursor < changes.size() && changes[cursor].first <= frame) {
+            ++cursor;
+        }
+        return cursor == 0 ? 0 : changes[cursor - 1].second;
+    }
+};
+
+struct Job {
+    std::filesystem::path romPath;
+    std::filesystem::path inputPath;
+    uint64_t frames = DEFAULT_FRAMES;
+    // frames was given as -, run as long as the movie
+    bool framesFromInput = false;
+    uint64_t seed = 0;
+    // the movie's profile, wins over the command line
+    std::optional<QuirkProfile> quirks;
+
+    // shared between jobs that use the same files
+    std::shared_ptr<const std::vector<uint8_t>> rom;
+    std::shared_ptr<const InputScript> input;
+};
+
+struct Result {
+    uint64_t cycles = 0;
+    uint64_t skippedCycles = 0;
+    uint64_t framebufferHash = 0;
+    chrono::nanoseconds wallTime = 0ns;
+};
+
+std::optional<std::vector<uint8_t>> readRom(const std::filesystem::path& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    if (!is) {
+        log_error("Failed to open rom {}", path.string());
+        return std::nullopt;
+    }
+    auto rom = std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+    // whether it fits the profile it runs with is checked once that is known
+    if (rom.size() > Emu::maxProgramSize(QuirkProfile::XoChip)) {
+        log_error("Rom {} is {} bytes, too large to load", path.string(), rom.size());
+        return std::nullopt;
+    }
+    return rom;
+}
+
+std::optional<InputScript> readMovie(const std::vector<uint8_t>& data, const std::filesystem::path& path) {
+    const auto movie = Movie::read(data.data(), data.size());
+    if (!movie) {
+        log_error("Failed to read movie {}", path.string());
+        return std::nullopt;
+    }
+    auto script = InputScript{};
+    KeypadInput held = 0;
+    for (uint64_t frame = 0; frame < movie->frames(); ++frame) {
+        if (movie->keysAt(frame) != held) {
+            held = movie->keysAt(frame);
+            script.changes.emplace_back(frame, held);
+        }
+    }
+    // nothing is held past the end of a movie
+    if (held != 0) {
+        script.changes.emplace_back(movie->frames(), 0);
+    }
+    script.recording = InputScript::Recording{movie->romHash(), movie->quirkProfile(), movie->seed(), movie->frames()};
+    return script;
+}
+
+std::optional<InputScript> readInputScript(const std::filesystem::path& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    if (!is) {
+        log_error("Failed to open input script {}", path.string());
+        return std::nullopt;
+    }
+    const auto data = std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+    if (Movie::isMovie(data.data(), data.size())) {
+        return readMovie(data, path);
+    }
+    auto text = std::istringstream(std::string(data.begin(), data.end()));
+    auto script = InputScript{};
+    auto line = std::string{};
+    for (auto lineNum = 1; std::getline(text, line); ++lineNum) {
+        line = line.substr(0, line.find('#'));
+        auto fields = std::istringstream(line);
+        uint64_t frame = 0;
+        if (!(fields >> frame)) {
+            if (!line.empty() && line.find_first_not_of(" \t\r") != std::string::npos) {
+                log_error("{}:{}: expected a frame number", path.string(), lineNum);
+                return std::nullopt;
+            }
+            continue;
+        }
+        KeypadInput keys = 0;
+        auto key = std::string{};
+        while (fields >> key) {
+            if (key.size() != 1 || !std::isxdigit(uint8_t(key[0]))) {
+                log_error("{}:{}: '{}' is not a key, expected a single hex digit", path.string(), lineNum, key);
+                return std::nullopt;
+            }
+            keys |= KeypadInput(1) << std::stoi(key, nullptr, 16);
+        }
+        if (!script.changes.empty() && script.changes.back().first >= frame) {
+            log_error("{}:{}: frames must be increasing", path.string(), lineNum);
+            return std::nullopt;
+        }
+        script.changes.emplace_back(frame, keys);
+    }
+    return script;
+}
+
+bool readJobList(const std::filesystem::path& path, std::vector<Job>& jobs) {
+    auto is = std::ifstream(path);
+    if (!is) {
+        log_error("Failed to open job list {}", path.string());
+        return false;
+    }
+    // paths in a job list are relative to the list itself
+    const auto base = path.parent_path();
+    auto line = std::string{};
+    for (auto lineNum = 1; std::getline(is, line); ++lineNum) {
+        line = line.substr(0, line.find('#'));
+        auto fields = std::istringstream(line);
+        auto rom = std::string{};
+        if (!(fields >> rom)) {
+            continue;
+        }
+        auto job = Job{};
+        job.romPath = base / rom;
+        auto frames = std::string{};
+        fields >> frames;
+        job.framesFromInput = frames == "-";
+        if (!job.framesFromInput && !(std::istringstream(frames) >> job.frames)) {
+            log_error("{}:{}: expected a frame count after the rom", path.string(), lineNum);
+            return false;
+        }
+        auto input = std::string{};
+        if (fields >> input && input != "-") {
+            job.inputPath = base / input;
+        }
+        fields >> job.seed;
+        jobs.push_back(std::move(job));
+    }
+    return true;
+}
+
+Result runJob(const Job& job, Emu::Backend backend, std::optional<QuirkProfile> quirks, bool idleSkipping,
+              const std::filesystem::path& profilePrefix, const std::filesystem::path& capturePath, FrameCapture::Format captureFormat,
+              const std::filesystem::path& tracePath, uint32_t traceRecords) {
+    const auto start = chrono::steady_clock::now();
+
+    auto emu = Emu::fromRom(job.rom->data(), job.rom->size(), job.quirks ? job.quirks : quirks);
+    emu.setRandomSeed(job.seed);
+    emu.setBackend(backend);
+    emu.setIdleSkipping(idleSkipping);
+    emu.setProfiling(!profilePrefix.empty());
+    const auto capture = capturePath.empty() ? nullptr : FrameCapture::open(capturePath, captureFormat);
+    const auto tracer = tracePath.empty() ? nullptr : TraceWriter::create(tracePath, emu.getQuirkProfile(), traceRecords);
+    emu.setTrace(tracer.get());
+
+    size_t cursor = 0;
+    for (uint64_t frame = 0; frame < job.frames;) {
+        const auto keys = job.input ? job.input->keysAt(frame, cursor) : 0;
+        // every frame until the keys next change runs in one go, so busy waits can be skipped across frames
+        auto next = job.input && cursor < job.input->changes.size() ? std::min(job.frames, job.input->changes[cursor].first) : job.frames;
+        if (capture) {
+            next = frame + 1;
+        }
+        emu.runFrames(next - frame, keys);
+        if (capture) {
+            capture->push(emu.getDisplay(), frame, true);
+        }
+        frame = next;
+    }
+    if (emu.getFault() != Emu::Fault::None) {
+        log_warn("{} stopped at {:x}: {}", job.romPath.string(), emu.getPc(), to_string(emu.getFault()));
+    }
+
+    auto result = Result{};
+    result.cycles = emu.getCycleCount();
+    result.skippedCycles = emu.getSkippedCycles();
+    result.framebufferHash = emu.getDisplay().hash();
+    result.wallTime = chrono::steady_clock::now() - start;
+
+    if (const auto profiler = emu.getProfiler()) {
+        auto json = std::ofstream(profilePrefix.string() + ".profile.json");
+        profiler->writeJson(json);
+        auto trace = std::ofstream(profilePrefix.string() + ".trace.json");
+        profiler->writeChromeTrace(trace, emu.getCycleCount());
+    }
+    return result;
+}
+
+bool isRomPath(const std::filesystem::path& path) { return path.extension() == ".ch8" || path.extension() == ".rom"; }
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto threads = size_t(std::thread::hardware_concurrency());
+    auto frames = DEFAULT_FRAMES;
+    auto backend = Emu::Backend::Interpreter;
+    bool idleSkipping = true;
+    auto quirks = std::optional<QuirkProfile>{};
+    auto outputPath = std::filesystem::path{};
+    auto profileDir = std::filesystem::path{};
+    auto captureDir = std::filesystem::path{};
+    auto captureFormat = FrameCapture::Format::Apng;
+    auto traceDir = std::filesystem::path{};
+    auto traceRecords = TraceWriter::DEFAULT_CAPACITY;
+    auto jobArgs = std::vector<std::string_view>{};
+
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue) {
+            threads = std::stoul(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            frames = std::stoull(argv[++i]);
+        } else if (arg == "--output" && hasValue) {
+            outputPath = argv[++i];
+        } else if (arg == "--profile" && hasValue) {
+            profileDir = argv[++i];
+        } else if (arg == "--capture" && hasValue) {
+            captureDir = argv[++i];
+        } else if (arg == "--capture-format" && hasValue) {
+            const auto format = FrameCapture::parseFormat(argv[++i]);
+            if (!format) {
+                log_error("Unknown capture format {}, expected y4m, apng or raw", argv[i]);
+                return 1;
+            }
+            captureFormat = *format;
+        } else if (arg == "--trace" && hasValue) {
+            traceDir = argv[++i];
+        } else if (arg == "--trace-records" && hasValue) {
+            traceRecords = uint32_t(std::stoul(argv[++i]));
+        } else if (arg == "--jit") {
+            backend = Emu::Backend::Jit;
+        } else if (arg == "--no-idle-skip") {
+            idleSkipping = false;
+        } else if (arg == "--quirks" && hasValue) {
+            quirks = parseQuirkProfile(argv[++i]);
+            if (!quirks) {
+                log_error("Unknown quirk profile {}, expected chip8, schip or xochip", argv[i]);
+                return 1;
+            }
+        } else if (arg.starts_with("--")) {
+            log_error("Unknown option {}", arg);
+            return 1;
+        } else {
+            jobArgs.push_back(arg);
+        }
+    }
+
+    auto jobs = std::vector<Job>{};
+    for (const auto arg : jobArgs) {
+        if (isRomPath(arg)) {
+            auto& job = jobs.emplace_back();
+            job.romPath = arg;
+            job.frames = frames;
+        } else if (!readJobList(arg, jobs)) {
+            return 1;
+        }
+    }
+    if (jobs.empty()) {
+        log_error("usage: chip8-batch [--threads n] [--frames n] [--jit] [--quirks profile] [--no-idle-skip] [--output file] [--profile dir] "
+                  "[--capture dir] [--capture-format y4m|apng|raw] [--trace dir] [--trace-records n] <job list | rom>...");
+        return 1;
+    }
+
+    // load every file once up front so bad inputs fail before any work starts
+    auto roms = std::map<std::filesystem::path, std::shared_ptr<const std::vector<uint8_t>>>{};
+    auto inputs = std::map<std::filesystem::path, std::shared_ptr<const InputScript>>{};
+    for (auto& job : jobs) {
+        auto& rom = roms[job.romPath];
+        if (!rom) {
+            auto data = readRom(job.romPath);
+            if (!data) {
+                return 1;
+            }
+            rom = std::make_shared<const std::vector<uint8_t>>(std::move(*data));
+        }
+        job.rom = rom;
+
+        if (!job.inputPath.empty()) {
+            auto& input = inputs[job.inputPath];
+            if (!input) {
+                auto script = readInputScript(job.inputPath);
+                if (!script) {
+                    return 1;
+                }
+                input = std::make_shared<const InputScript>(std::move(*script));
+            }
+            job.input = input;
+        }
+
+        if (const auto& recording = job.input ? job.input->recording : std::nullopt) {
+            if (recording->romHash != romHash(rom->data(), rom->size())) {
+                log_error("{} was recorded on another rom than {}", job.inputPath.string(), job.romPath.string());
+                return 1;
+            }
+            job.quirks = recording->quirks;
+            job.seed = recording->seed;
+            if (job.framesFromInput) {
+                job.frames = recording->frames;
+            }
+        } else if (job.framesFromInput) {
+            log_error("Job {} runs for - frames, but {} is not a movie", job.romPath.string(), job.inputPath.string());
+            return 1;
+        }
+
+        const auto profile = Emu::profileFor(rom->data(), rom->size(), job.quirks ? job.quirks : quirks);
+        if (rom->size() > Emu::maxProgramSize(profile)) {
+            log_error("Rom {} is {} bytes, too large to load under the {} profile", job.romPath.string(), rom->size(), to_string(profile));
+            return 1;
+        }
+    }
+
+    if (!profileDir.empty()) {
+        std::filesystem::create_directories(profileDir);
+    }
+    if (!captureDir.empty()) {
+        std::filesystem::create_directories(captureDir);
+    }
+    if (!traceDir.empty()) {
+        std::filesystem::create_directories(traceDir);
+    }
+
+    // every Emu is self contained, workers share nothing but the read only roms and scripts
+    auto results = std::vector<Result>(jobs.size());
+    const auto start = chrono::steady_clock::now();
+    {
+        auto pool = ThreadPool(threads);
+        // longest jobs first so a big one isn't left running alone at the end
+        auto order = std::vector<size_t>(jobs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return jobs[a].frames > jobs[b].frames; });
+        for (const auto idx : order) {
+            const auto profilePrefix =
+                profileDir.empty() ? std::filesystem::path{} : profileDir / std::format("{}-{}", idx, jobs[idx].romPath.stem().string());
+            const auto capturePath = captureDir.empty() ? std::filesystem::path{}
+                                                        : captureDir / std::format("{}-{}{}", idx, jobs[idx].romPath.stem().string(), FrameCapture::extension(captureFormat));
+            const auto tracePath =
+                traceDir.empty() ? std::filesystem::path{} : traceDir / std::format("{}-{}.c8t", idx, jobs[idx].romPath.stem().string());
+            pool.submit([&, idx, profilePrefix, capturePath, tracePath]() {
+                results[idx] = runJob(jobs[idx], backend, quirks, idleSkipping, profilePrefix, capturePath, captureFormat, tracePath, traceRecords);
+            });
+        }
+        pool.wait();
+    }
+    const auto wallTime = chrono::steady_clock::now() - start;
+
+    auto file = std::ofstream{};
+    if (!outputPath.empty()) {
+        file.open(outputPath);
+        if (!file) {
+            log_error("Failed to open output {}", outputPath.string());
+            return 1;
+        }
+    }
+    auto& out = outputPath.empty() ? std::cout : file;
+
+    out << "rom,input,seed,frames,cycles,framebuffer_hash,wall_ms,skipped_cycles\n";
+    uint64_t totalCycles = 0;
+    uint64_t totalSkipped = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const auto& job = jobs[i];
+        const auto& result = results[i];
+        out << std::format("{},{},{},{},{},{:016x},{:.3f},{}\n", job.romPath.string(), job.inputPath.string(), job.seed,
+                           job.frames, result.cycles, result.framebufferHash,
+                           chrono::duration<double, std::milli>(result.wallTime).count(), result.skippedCycles);
+        totalCycles += result.cycles;
+        totalSkipped += result.skippedCycles;
+    }
+
+    const auto seconds = chrono::duration<double>(wallTime).count();
+    std::cerr << std::format("{} jobs on {} threads in {:.3f}s, {:.1f}M instructions/s, {:.1f}% of cycles skipped as busy waits\n",
+                             jobs.size(), std::min(threads, jobs.size()), seconds, totalCycles / seconds / 1e6,
+                             totalCycles == 0 ? 0.0 : 100.0 * totalSkipped / totalCycles);
+    return 0;
+}
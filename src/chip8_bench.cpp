@@ -0,0 +1,489 @@
+// micro and macro benchmarks for the emulator hot paths, prints a json report so runs can be compared between commits
+//
+// usage: chip8-bench [--filter text] [--min-time ms] [--repetitions n] [--frames n] [--roms dir] [--output file] [--list]
+//
+// every benchmark is first calibrated until one batch takes at least --min-time, then timed --repetitions times.
+// results are reported per item, an item being whatever the benchmark unit says (instruction, draw, sample, ...).
+
+#include "base.h"
+#include "emu.h"
+#include "render.h"
+#include "synth.h"
+
+#include <algorithm>
+#include <fstream>
+
+using namespace ez;
+
+namespace {
+
+// results are folded into this so the optimizer can't drop the work being measured
+volatile uint64_t g_sink = 0;
+
+// what one call of a benchmark did
+struct Work {
+    // not explicit, most benchmarks only return the item count
+    Work(uint64_t items, std::optional<double> skippedFraction = std::nullopt) : items(items), skippedFraction(skippedFraction) {}
+
+    uint64_t items;
+    // rom benchmarks, the fraction of emulated cycles that idle skipping fast-forwarded
+    std::optional<double> skippedFraction;
+};
+
+struct Benchmark {
+    std::string name;
+    std::string unit;
+    // runs the benchmark iterations times, returns how many units of work that was
+    std::function<Work(uint64_t iterations)> run;
+};
+
+struct Result {
+    std::string name;
+    std::string unit;
+    uint64_t iterations = 0;
+    uint64_t items = 0;
+    // per repetition, sorted
+    std::vector<double> nsPerItem;
+    std::optional<double> skippedFraction;
+};
+
+struct Settings {
+    chrono::nanoseconds minTime = 100ms;
+    int repetitions = 5;
+    uint64_t romFrames = 3600;
+    std::filesystem::path romDir = "roms";
+};
+
+Result measure(const Benchmark& bench, const Settings& settings) {
+    auto work = Work{0};
+    const auto timeBatch = [&](uint64_t iterations) {
+        const auto start = chrono::steady_clock::now();
+        work = bench.run(iterations);
+        return chrono::nanoseconds(chrono::steady_clock::now() - start);
+    };
+
+    // calibration doubles as warm up for caches, the jit and the branch predictors
+    uint64_t iterations = 1;
+    for (;;) {
+        const auto elapsed = timeBatch(iterations);
+        if (elapsed >= settings.minTime) {
+            break;
+        }
+        const auto scale = elapsed.count() > 0 ? 1.2 * double(settings.minTime.count()) / double(elapsed.count()) : 100.0;
+        iterations = uint64_t(double(iterations) * clamp(scale, 2.0, 100.0));
+    }
+
+    auto result = Result{};
+    result.name = bench.name;
+    result.unit = bench.unit;
+    result.iterations = iterations;
+    result.items = work.items;
+    for (auto rep = 0; rep < settings.repetitions; ++rep) {
+        const auto elapsed = timeBatch(iterations);
+        result.nsPerItem.push_back(double(elapsed.count()) / double(std::max<uint64_t>(work.items, 1)));
+    }
+    std::sort(result.nsPerItem.begin(), result.nsPerItem.end());
+    result.skippedFraction = work.skippedFraction;
+    return result;
+}
+
+const char* backendName(Emu::Backend backend) { return backend == Emu::Backend::Interpreter ? "interpreter" : "jit"; }
+
+std::vector<Emu::Backend> backends() {
+    if (Jit::isSupported()) {
+        return {Emu::Backend::Interpreter, Emu::Backend::Jit};
+    }
+    return {Emu::Backend::Interpreter};
+}
+
+std::vector<uint8_t> toBytes(const std::vector<OpCode>& ops) {
+    auto rom = std::vector<uint8_t>{};
+    for (const auto op : ops) {
+        rom.push_back(uint8_t(op >> 8));
+        rom.push_back(uint8_t(op));
+    }
+    return rom;
+}
+
+constexpr int LOOP_REPEATS = 32;
+
+// builds a rom that runs setup once and then loops over body repeated a fixed number of times, so the closing jump
+// is only a small fraction of the instructions measured
+std::vector<uint8_t> loopRom(std::vector<OpCode> setup, const std::vector<OpCode>& body) {
+    auto ops = std::move(setup);
+    const auto loopStart = OpCode(Emu::PROGRAM_START + 2 * ops.size());
+    for (auto i = 0; i < LOOP_REPEATS; ++i) {
+        ops.insert(ops.end(), body.begin(), body.end());
+    }
+    ops.push_back(OpCode(0x1000 | loopStart));
+    return toBytes(ops);
+}
+
+// a chain of jumps to the next instruction with the last one closing the loop
+std::vector<uint8_t> jumpChainRom() {
+    auto ops = std::vector<OpCode>{};
+    for (auto i = 1; i <= LOOP_REPEATS; ++i) {
+        ops.push_back(OpCode(0x1000 | (Emu::PROGRAM_START + 2 * (i % LOOP_REPEATS))));
+    }
+    return toBytes(ops);
+}
+
+void addOpcodeBenchmarks(std::vector<Benchmark>& benchmarks) {
+    // scratch memory well past the end of every generated rom
+    static constexpr OpCode SCRATCH = 0xE00;
+
+    struct OpcodeClass {
+        const char* name;
+        std::vector<uint8_t> rom;
+    };
+    const auto classes = std::vector<OpcodeClass>{
+        {"load", loopRom({}, {0x6012, 0x6134, 0x6256, 0x8310})},
+        {"alu", loopRom({}, {0x7001, 0x8014, 0x8015, 0x8016, 0x8011, 0x8012, 0x8013, 0x8017, 0x801E})},
+        // only 5010 is taken, it skips the 6000 after it
+        {"skip", loopRom({0x6000, 0x6100}, {0x3001, 0x4000, 0x5010, 0x6000, 0x9010, 0xE09E})},
+        {"jump", jumpChainRom()},
+        // the setup jumps over a subroutine that only returns
+        {"call", loopRom({0x1204, 0x00EE}, {0x2202})},
+        {"index", loopRom({0x6003}, {0xA123, 0xF01E, 0xF029})},
+        {"memory", loopRom({0x6012}, {OpCode(0xA000 | SCRATCH), 0xF355, OpCode(0xA000 | SCRATCH), 0xF365, 0xF033})},
+        {"timers", loopRom({}, {0xF007, 0xF015, 0xF018})},
+        {"random", loopRom({}, {0xC0FF, 0xC10F})},
+        // starts past the edges so every draw wraps, and a second one is clipped at the bottom right
+        {"draw", loopRom({0x6046, 0x6128, 0x623C, 0x631D, 0xA000}, {0xD015, 0xD235})},
+        {"clear", loopRom({}, {0x00E0})},
+    };
+    for (const auto& opClass : classes) {
+        for (const auto backend : backends()) {
+            auto emu = std::make_shared<Emu>(opClass.rom.data(), opClass.rom.size());
+            emu->setBackend(backend);
+            benchmarks.push_back({std::format("opcodes/{}/{}", opClass.name, backendName(backend)), "instruction",
+                                  [emu](uint64_t iterations) {
+                                      emu->runCycles(iterations, 0);
+                                      g_sink = g_sink + emu->getDisplay().row(0);
+                                      return iterations;
+                                  }});
+        }
+    }
+}
+
+void addDisplayBenchmarks(std::vector<Benchmark>& benchmarks) {
+    static constexpr auto sprite = std::array<uint8_t, 15>{0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20,
+                                                             0x20, 0x70, 0xAA, 0x55, 0xAA, 0x55, 0xFF};
+    struct Placement {
+        const char* name;
+        uint8_t x, y;
+    };
+    // coordinates are already wrapped by Dxyn before they get here, the opcode benchmark covers that part
+    static constexpr auto placements = std::array<Placement, 3>{{{"aligned", 8, 4}, {"unaligned", 13, 4}, {"clipped", 60, 28}}};
+    for (const auto height : {1, 5, 15}) {
+        for (const auto& placement : placements) {
+            auto display = std::make_shared<Display>();
+            benchmarks.push_back({std::format("display/draw/h{}/{}", height, placement.name), "draw",
+                                  [display, height, placement](uint64_t iterations) {
+                                      uint64_t collisions = 0;
+                                      for (uint64_t i = 0; i < iterations; ++i) {
+                                          collisions += display->drawSprite(placement.x, placement.y, sprite.data(), height);
+                                      }
+                                      g_sink = g_sink + collisions;
+                                      return iterations;
+                                  }});
+        }
+    }
+
+    auto display = std::make_shared<Display>();
+    benchmarks.push_back({"display/clear/empty", "clear", [display](uint64_t iterations) {
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  display->clear();
+                              }
+                              g_sink = g_sink + display->generation();
+                              return iterations;
+                          }});
+    // every clear has something to erase, the fill is part of what's measured
+    benchmarks.push_back({"display/clear/full", "clear", [display](uint64_t iterations) {
+                              auto full = Display::Planes{};
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  for (auto y = 0; y < Display::HEIGHT_PX; ++y) {
+                                      full[0][y * Display::WORDS_PER_ROW] = ~Display::Row(i);
+                                  }
+                                  display->restore(full, false, 0b01);
+                                  display->clear();
+                              }
+                              g_sink = g_sink + display->generation();
+                              return iterations;
+                          }});
+
+    // SUPER-CHIP 16x16 sprites straddling the two words of a hires row, on both planes as XO-CHIP draws them
+    static constexpr auto wideSprite = [] {
+        auto data = std::array<uint8_t, 16 * 2 * Display::PLANES>{};
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = uint8_t(0xA5 ^ (i * 0x1D));
+        }
+        return data;
+    }();
+    for (const uint8_t planeMask : {0b01, 0b11}) {
+        auto hires = std::make_shared<Display>();
+        hires->setHires(true);
+        hires->setPlaneMask(planeMask);
+        benchmarks.push_back({std::format("display/draw/wide/planes{}", std::popcount(planeMask)), "draw", [hires](uint64_t iterations) {
+                                  uint64_t collisions = 0;
+                                  for (uint64_t i = 0; i < iterations; ++i) {
+                                      collisions += hires->drawSprite(57, 20, wideSprite.data(), 16, true);
+                                  }
+                                  g_sink = g_sink + collisions;
+                                  return iterations;
+                              }});
+    }
+
+    // scrolls move every row of a full hires frame
+    auto scrolled = std::make_shared<Display>();
+    scrolled->setHires(true);
+    for (auto y = 0; y < Display::HIRES_HEIGHT_PX; y += 16) {
+        for (auto x = 0; x < Display::HIRES_WIDTH_PX; x += 16) {
+            scrolled->drawSprite(x, y, wideSprite.data(), 16, true);
+        }
+    }
+    benchmarks.push_back({"display/scroll/down", "scroll", [scrolled](uint64_t iterations) {
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  scrolled->scrollDown(4);
+                              }
+                              g_sink = g_sink + scrolled->generation();
+                              return iterations;
+                          }});
+    benchmarks.push_back({"display/scroll/right", "scroll", [scrolled](uint64_t iterations) {
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  scrolled->scrollRight(4);
+                              }
+                              g_sink = g_sink + scrolled->generation();
+                              return iterations;
+                          }});
+}
+
+void addRenderBenchmarks(std::vector<Benchmark>& benchmarks) {
+    // a busy checker pattern, the expansion kernels don't branch on pixel values but the scalar fallback might
+    auto display = std::make_shared<Display>();
+    auto planes = Display::Planes{};
+    for (auto y = 0; y < Display::HEIGHT_PX; ++y) {
+        planes[0][y * Display::WORDS_PER_ROW] = y % 2 ? 0xAAAA'AAAA'AAAA'AAAAull : 0x5555'5555'5555'5555ull;
+    }
+    display->restore(planes, false, 0b01);
+
+    static constexpr auto PITCH = Display::WIDTH_PX * int(sizeof(uint32_t));
+    auto pixels = std::make_shared<std::vector<uint8_t>>(size_t(PITCH) * Display::HEIGHT_PX);
+    benchmarks.push_back({std::format("render/expand_frame/{}", rgbKernelName()), "frame", [display, pixels](uint64_t iterations) {
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  expandRowsRgb888(*display, 0, Display::HEIGHT_PX - 1, pixels->data(), PITCH);
+                              }
+                              g_sink = g_sink + (*pixels)[PITCH + 4];
+                              return iterations;
+                          }});
+    benchmarks.push_back({std::format("render/expand_row/{}", rgbKernelName()), "row", [pixels](uint64_t iterations) {
+                              auto dst = reinterpret_cast<uint32_t*>(pixels->data());
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  expandRowRgb888(Display::Row(i) * 0x9E37'79B9'7F4A'7C15ull, dst);
+                              }
+                              g_sink = g_sink + dst[7];
+                              return iterations;
+                          }});
+}
+
+void addAudioBenchmarks(std::vector<Benchmark>& benchmarks) {
+    // Audio::DEFAULT_BUFFER_SAMPLES, what the sdl callback asks for
+    static constexpr size_t BLOCK_SIZE = 512;
+    auto synth = std::make_shared<Synth>();
+    synth->setPlaying(true);
+    auto block = std::make_shared<std::vector<float>>(BLOCK_SIZE);
+    benchmarks.push_back({"audio/generate_block", "sample", [synth, block](uint64_t iterations) {
+                              for (uint64_t i = 0; i < iterations; ++i) {
+                                  synth->generate(block->data(), block->size());
+                              }
+                              g_sink = g_sink + uint64_t((*block)[0] * 1000.0f);
+                              return iterations * BLOCK_SIZE;
+                          }});
+}
+
+bool addRomBenchmarks(std::vector<Benchmark>& benchmarks, const Settings& settings) {
+    if (!std::filesystem::is_directory(settings.romDir)) {
+        log_error("Rom directory {} not found", settings.romDir.string());
+        return false;
+    }
+    auto paths = std::vector<std::filesystem::path>{};
+    for (const auto& file : std::filesystem::directory_iterator(settings.romDir)) {
+        const auto& path = file.path();
+        if (path.extension() == ".ch8" || path.extension() == ".rom") {
+            paths.push_back(path);
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    for (const auto& path : paths) {
+        auto is = std::ifstream(path, std::ios::binary);
+        const auto rom = std::make_shared<const std::vector<uint8_t>>(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        if (rom->size() > Emu::maxProgramSize(QuirkProfile::Chip8)) {
+            log_warn("Skipping {}, too large to load", path.string());
+            continue;
+        }
+        for (const auto backend : backends()) {
+            for (const auto idleSkipping : {true, false}) {
+                const auto name = std::format("roms/{}/{}/{}", path.filename().string(), backendName(backend),
+                                              idleSkipping ? "idle-skip" : "no-idle-skip");
+                const auto frames = settings.romFrames;
+                // booted once per batch, every iteration then starts from the same checkpoint so each one runs the
+                // exact same instructions and the boot and first jit compiles stay out of the per-iteration cost.
+                // items are the instructions actually executed, cycles idle skipping jumped over don't count
+                benchmarks.push_back({name, "instruction",
+                                      [rom, backend, idleSkipping, frames](uint64_t iterations) {
+                                          auto emu = std::make_unique<Emu>(rom->data(), rom->size());
+                                          emu->setBackend(backend);
+                                          emu->setIdleSkipping(idleSkipping);
+                                          emu->setCheckpoint();
+                                          uint64_t cycles = 0;
+                                          uint64_t skipped = 0;
+                                          for (uint64_t i = 0; i < iterations; ++i) {
+                                              emu->resetToCheckpoint();
+                                              const auto skippedBefore = emu->getSkippedCycles();
+                                              emu->runFrames(frames, 0);
+                                              cycles += emu->getCycleCount();
+                                              skipped += emu->getSkippedCycles() - skippedBefore;
+                                              g_sink = g_sink + emu->getDisplay().hash();
+                                          }
+                                          return Work{cycles - skipped, cycles > 0 ? double(skipped) / double(cycles) : 0.0};
+                                      }});
+            }
+        }
+    }
+    return true;
+}
+
+std::string jsonEscape(std::string_view s) {
+    auto out = std::string{};
+    for (const auto c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (uint8_t(c) < 0x20) {
+            out += std::format("\\u{:04x}", int(c));
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+const char* compilerName() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results, const Settings& settings) {
+    out << "{\n";
+    out << "  \"schema\": 2,\n";
+    out << std::format("  \"timestamp\": \"{:%FT%TZ}\",\n", chrono::floor<chrono::seconds>(chrono::system_clock::now()));
+    out << "  \"build\": {\n";
+    out << std::format("    \"compiler\": \"{}\",\n", jsonEscape(compilerName()));
+#ifdef NDEBUG
+    out << "    \"assertions\": false,\n";
+#else
+    out << "    \"assertions\": true,\n";
+#endif
+    out << std::format("    \"rgb_kernel\": \"{}\",\n", rgbKernelName());
+    out << std::format("    \"jit_supported\": {}\n", Jit::isSupported());
+    out << "  },\n";
+    out << "  \"settings\": {\n";
+    out << std::format("    \"min_time_ms\": {},\n", chrono::duration_cast<chrono::milliseconds>(settings.minTime).count());
+    out << std::format("    \"repetitions\": {},\n", settings.repetitions);
+    out << std::format("    \"rom_frames\": {}\n", settings.romFrames);
+    out << "  },\n";
+    out << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        const auto median = r.nsPerItem[r.nsPerItem.size() / 2];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {";
+        out << std::format("\"name\": \"{}\", \"unit\": \"{}\", \"iterations\": {}, \"items\": {}, ", jsonEscape(r.name),
+                           r.unit, r.iterations, r.items);
+        out << std::format("\"ns_per_item\": {:.4f}, \"ns_per_item_min\": {:.4f}, \"ns_per_item_max\": {:.4f}, ", median,
+                           r.nsPerItem.front(), r.nsPerItem.back());
+        out << std::format("\"items_per_second\": {:.1f}", 1e9 / median);
+        if (r.skippedFraction) {
+            out << std::format(", \"skipped_fraction\": {:.4f}", *r.skippedFraction);
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto settings = Settings{};
+    auto filter = std::string{};
+    auto outputPath = std::filesystem::path{};
+    auto listOnly = false;
+
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--filter" && hasValue) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && hasValue) {
+            settings.minTime = chrono::milliseconds(std::stoll(argv[++i]));
+        } else if (arg == "--repetitions" && hasValue) {
+            settings.repetitions = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--frames" && hasValue) {
+            settings.romFrames = std::stoull(argv[++i]);
+        } else if (arg == "--roms" && hasValue) {
+            settings.romDir = argv[++i];
+        } else if (arg == "--output" && hasValue) {
+            outputPath = argv[++i];
+        } else if (arg == "--list") {
+            listOnly = true;
+        } else {
+            log_error("usage: chip8-bench [--filter text] [--min-time ms] [--repetitions n] [--frames n] [--roms dir] "
+                      "[--output file] [--list]");
+            return 1;
+        }
+    }
+
+    auto benchmarks = std::vector<Benchmark>{};
+    addOpcodeBenchmarks(benchmarks);
+    addDisplayBenchmarks(benchmarks);
+    addRenderBenchmarks(benchmarks);
+    addAudioBenchmarks(benchmarks);
+    if (!addRomBenchmarks(benchmarks, settings)) {
+        return 1;
+    }
+    std::erase_if(benchmarks, [&](const Benchmark& b) { return b.name.find(filter) == std::string::npos; });
+
+    if (listOnly) {
+        for (const auto& bench : benchmarks) {
+            std::cout << bench.name << "\n";
+        }
+        return 0;
+    }
+
+    auto results = std::vector<Result>{};
+    for (const auto& bench : benchmarks) {
+        results.push_back(measure(bench, settings));
+        const auto& r = results.back();
+        std::cerr << std::format("{:<40} {:>12.3f} ns/{}\n", r.name, r.nsPerItem[r.nsPerItem.size() / 2], r.unit);
+    }
+
+    if (outputPath.empty()) {
+        writeJson(std::cout, results, settings);
+        return 0;
+    }
+    auto file = std::ofstream(outputPath);
+    if (!file) {
+        log_error("Failed to open output {}", outputPath.string());
+        return 1;
+    }
+    writeJson(file, results, settings);
+    return 0;
+}
@@ -0,0 +1,363 @@
+// in-process fuzzer for rom toolchains. every input is a program, run on one machine that is booted once up front and
+// reset to that point between inputs, so an execution only costs the instructions it runs plus copying back the
+// memory pages and framebuffer rows it wrote
+//
+// usage: chip8-fuzz [--runs n] [--seconds n] [--frames n] [--quirks profile] [--faults dir] [--seed n] [seed rom]...
+//
+// the seed roms start the corpus, the built in mutator keeps every input that reaches an address or opcode nothing
+// before it did. each input runs for --frames frames, keys and Cxkk come from a generator seeded by the input's hash
+// so any input replays exactly. faults stop the run and are counted per kind and address rather than ending the
+// process, --faults writes the first input to hit each of them into dir. fuzzing stops after --seconds, or after
+// --runs mutated inputs if that is given, --runs 0 only runs the seeds.
+//
+// built with CHIP8_LIBFUZZER (clang only, see CMakeLists.txt) libFuzzer drives instead of the built in loop and takes
+// the emulated coverage as extra counters beside its own. CHIP8_FUZZ_QUIRKS picks the profile there
+
+#include "base.h"
+#include "emu.h"
+
+#include <fstream>
+#include <map>
+
+using namespace ez;
+
+namespace {
+
+constexpr uint64_t DEFAULT_FRAMES = 10;
+constexpr double DEFAULT_SECONDS = 10.0;
+
+// one map for the process, the harness isn't meant to share a process with another thread running it
+#if CHIP8_LIBFUZZER
+// libFuzzer treats byte counters in this section as coverage beside its native edges, so an input that reaches new
+// emulated addresses is kept even when it takes the same path through the interpreter as an old one
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+Emu::CoverageMap g_coverage{};
+
+// FNV-1a a word at a time, romHash goes byte by byte and would cost as much as a short run
+uint64_t inputHash(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+struct Outcome {
+    Emu::Fault fault = Emu::Fault::None;
+    uint16_t pc = 0;
+};
+
+// a machine booted once and reset for every input
+class Harness {
+  public:
+    Harness(QuirkProfile quirks, uint64_t frames)
+        : m_emu(BOOT_PROGRAM.data(), 0, quirks), m_quirks(quirksOf(quirks)), m_frames(frames),
+          m_maxProgramSize(Emu::maxProgramSize(quirks)) {
+        m_emu.setCoverage(&g_coverage);
+        m_emu.setCheckpoint();
+    }
+
+    size_t maxProgramSize() const { return m_maxProgramSize; }
+    const Quirks& quirks() const { return m_quirks; }
+
+    Outcome run(const uint8_t* data, size_t size) {
+        size = std::min(size, m_maxProgramSize);
+        m_emu.resetToCheckpoint();
+        m_emu.loadProgram(data, size);
+        auto rng = Rng{inputHash(data, size)};
+        m_emu.setRandomSeed(rng.next());
+        for (uint64_t frame = 0; frame < m_frames && m_emu.getFault() == Emu::Fault::None && !m_emu.shouldExit(); ++frame) {
+            m_emu.runFrames(1, KeypadInput(rng.next() & 0xFFFF));
+        }
+        return {m_emu.getFault(), m_emu.getPc()};
+    }
+
+  private:
+    static constexpr std::array<uint8_t, 1> BOOT_PROGRAM{};
+
+    Emu m_emu;
+    Quirks m_quirks;
+    uint64_t m_frames = DEFAULT_FRAMES;
+    size_t m_maxProgramSize = 0;
+};
+
+#if CHIP8_LIBFUZZER
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static auto harness = []() {
+        const auto env = std::getenv("CHIP8_FUZZ_QUIRKS");
+        const auto quirks = env ? parseQuirkProfile(env) : QuirkProfile::Chip8;
+        if (!quirks) {
+            fail("Unknown quirk profile {} in CHIP8_FUZZ_QUIRKS, expected chip8, schip or xochip", env);
+        }
+        return Harness(*quirks, DEFAULT_FRAMES);
+    }();
+    harness.run(data, size);
+    return 0;
+}
+
+#else
+
+std::optional<std::vector<uint8_t>> readRom(const std::filesystem::path& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    if (!is) {
+        log_error("Failed to open rom {}", path.string());
+        return std::nullopt;
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+}
+
+class Fuzzer {
+  public:
+    Fuzzer(Harness& harness, uint64_t seed, std::filesystem::path faultDir)
+        : m_harness(harness), m_rng{seed}, m_faultDir(std::move(faultDir)) {
+        // the extended ops don't decode in every profile, those are left out of the coverage report
+        for (uint32_t opCode = 0; opCode <= 0xFFFF; ++opCode) {
+            m_decodableOps[size_t(decode(OpCode(opCode), m_harness.quirks()).op)] = true;
+        }
+    }
+
+    // runs an input and keeps it if it reached anything new
+    void execute(const std::vector<uint8_t>& input) {
+        const auto outcome = m_harness.run(input.data(), input.size());
+        ++m_execs;
+        if (collectCoverage()) {
+            m_corpus.push_back(input);
+        }
+        if (outcome.fault != Emu::Fault::None) {
+            auto& count = m_faults[{outcome.fault, outcome.pc}];
+            if (count++ == 0) {
+                saveFault(outcome, input);
+            }
+        }
+    }
+
+    // a mutation of a random corpus entry, valid until the next call
+    const std::vector<uint8_t>& next() {
+        if (m_corpus.empty()) {
+            m_input = {m_rng.nextByte(), m_rng.nextByte()};
+        } else {
+            // assigning reuses the buffer, so nothing allocates per run
+            m_input = m_corpus[m_rng.next() % m_corpus.size()];
+            mutate(m_input);
+        }
+        return m_input;
+    }
+
+    void report(std::ostream& out, double seconds) const {
+        const auto pcs = std::count(m_seenPcs.begin(), m_seenPcs.end(), true);
+        auto unreached = std::string{};
+        size_t ops = 0;
+        for (size_t op = 0; op < size_t(Op::Count); ++op) {
+            if (m_seenOps[op]) {
+                ++ops;
+            } else if (m_decodableOps[op]) {
+                unreached += std::format(" {}", to_string(Op(op)));
+            }
+        }
+        const auto decodable = std::count(m_decodableOps.begin(), m_decodableOps.end(), true);
+        out << std::format("{} execs in {:.1f}s, {:.2f}M execs/s, corpus of {}, {} of {} addresses, {} of {} ops\n", m_execs,
+                           seconds, m_execs / seconds / 1e6, m_corpus.size(), pcs, m_seenPcs.size(), ops, decodable);
+        if (!unreached.empty()) {
+            out << std::format("never ran:{}\n", unreached);
+        }
+        auto byKind = std::map<Emu::Fault, std::pair<uint64_t, size_t>>{};
+        for (const auto& [site, count] : m_faults) {
+            byKind[site.first].first += count;
+            ++byKind[site.first].second;
+        }
+        for (const auto& [fault, counts] : byKind) {
+            out << std::format("{}: {} runs at {} addresses\n", to_string(fault), counts.first, counts.second);
+        }
+    }
+
+  private:
+    // folds the counters of the last run into what was seen so far and clears them, true if anything was new
+    bool collectCoverage() {
+        bool found = false;
+        // a short run leaves nearly all of it zero, skipped a cache line at a time with one branch each
+        constexpr size_t CHUNK_BYTES = 64;
+        auto& pcs = g_coverage.pcs;
+        for (size_t i = 0; i < pcs.size(); i += CHUNK_BYTES) {
+            uint64_t any = 0;
+            for (auto j = i; j < i + CHUNK_BYTES; j += sizeof(uint64_t)) {
+                uint64_t word = 0;
+                memcpy(&word, &pcs[j], sizeof(word));
+                any |= word;
+            }
+            if (any == 0) {
+                continue;
+            }
+            for (auto j = i; j < i + CHUNK_BYTES; ++j) {
+                if (pcs[j] != 0 && !m_seenPcs[j]) {
+                    m_seenPcs[j] = true;
+                    found = true;
+                }
+            }
+            memset(&pcs[i], 0, CHUNK_BYTES);
+        }
+        for (size_t op = 0; op < g_coverage.ops.size(); ++op) {
+            if (g_coverage.ops[op] != 0 && !m_seenOps[op]) {
+                m_seenOps[op] = true;
+                found = true;
+            }
+        }
+        g_coverage.ops.fill(0);
+        return found;
+    }
+
+    // programs are sequences of two byte instructions, most mutations work on whole ones
+    void mutate(std::vector<uint8_t>& input) {
+        const auto count = 1 + m_rng.next() % 4;
+        for (uint64_t i = 0; i < count; ++i) {
+            const auto words = input.size() / 2;
+            const auto word = words == 0 ? 0 : 2 * (m_rng.next() % words);
+            switch (m_rng.next() % 6) {
+            case 0:
+                if (!input.empty()) {
+                    input[m_rng.next() % input.size()] ^= uint8_t(1 << m_rng.next() % 8);
+                }
+                break;
+            case 1:
+                if (!input.empty()) {
+                    input[m_rng.next() % input.size()] = m_rng.nextByte();
+                }
+                break;
+            case 2:
+                if (words > 0) {
+                    input[word] = m_rng.nextByte();
+                    input[word + 1] = m_rng.nextByte();
+                }
+                break;
+            case 3:
+                input.insert(input.begin() + word, {m_rng.nextByte(), m_rng.nextByte()});
+                break;
+            case 4:
+                if (words > 1) {
+                    input.erase(input.begin() + word, input.begin() + word + 2);
+                }
+                break;
+            case 5: {
+                // the same stretch from another entry, carries over whole routines and sprite data
+                const auto& other = m_corpus[m_rng.next() % m_corpus.size()];
+                if (word < other.size()) {
+                    const auto length = std::min<size_t>(other.size() - word, 2 + 2 * (m_rng.next() % 16));
+                    if (input.size() < word + length) {
+                        input.resize(word + length);
+                    }
+                    std::copy_n(other.begin() + word, length, input.begin() + word);
+                }
+                break;
+            }
+            }
+        }
+        if (input.size() > m_harness.maxProgramSize()) {
+            input.resize(m_harness.maxProgramSize());
+        }
+    }
+
+    void saveFault(const Outcome& outcome, const std::vector<uint8_t>& input) const {
+        if (m_faultDir.empty()) {
+            return;
+        }
+        auto name = std::string(to_string(outcome.fault));
+        std::replace(name.begin(), name.end(), ' ', '-');
+        const auto path = m_faultDir / std::format("{}-{:04x}.ch8", name, outcome.pc);
+        auto os = std::ofstream(path, std::ios::binary);
+        os.write(reinterpret_cast<const char*>(input.data()), std::streamsize(input.size()));
+        if (!os) {
+            log_error("Failed to write {}", path.string());
+        }
+    }
+
+    Harness& m_harness;
+    Rng m_rng;
+    std::filesystem::path m_faultDir;
+
+    std::vector<std::vector<uint8_t>> m_corpus;
+    std::vector<uint8_t> m_input;
+    std::array<bool, std::tuple_size_v<decltype(Emu::CoverageMap::pcs)>> m_seenPcs{};
+    std::array<bool, size_t(Op::Count)> m_seenOps{};
+    std::array<bool, size_t(Op::Count)> m_decodableOps{};
+    // runs that faulted, by kind and address
+    std::map<std::pair<Emu::Fault, uint16_t>, uint64_t> m_faults;
+    uint64_t m_execs = 0;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto runs = std::optional<uint64_t>{};
+    auto seconds = DEFAULT_SECONDS;
+    auto frames = DEFAULT_FRAMES;
+    auto quirks = QuirkProfile::Chip8;
+    uint64_t seed = 0;
+    auto faultDir = std::filesystem::path{};
+    auto seedPaths = std::vector<std::filesystem::path>{};
+
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--runs" && hasValue) {
+            runs = std::stoull(argv[++i]);
+        } else if (arg == "--seconds" && hasValue) {
+            seconds = std::stod(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            frames = std::stoull(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg == "--faults" && hasValue) {
+            faultDir = argv[++i];
+        } else if (arg == "--quirks" && hasValue) {
+            const auto parsed = parseQuirkProfile(argv[++i]);
+            if (!parsed) {
+                log_error("Unknown quirk profile {}, expected chip8, schip or xochip", argv[i]);
+                return 1;
+            }
+            quirks = *parsed;
+        } else if (arg.starts_with("--")) {
+            log_error("Unknown option {}", arg);
+            log_error("usage: chip8-fuzz [--runs n] [--seconds n] [--frames n] [--quirks profile] [--faults dir] [--seed n] [seed rom]...");
+            return 1;
+        } else {
+            seedPaths.emplace_back(arg);
+        }
+    }
+    if (!faultDir.empty()) {
+        std::filesystem::create_directories(faultDir);
+    }
+
+    auto harness = Harness(quirks, frames);
+    auto fuzzer = Fuzzer(harness, seed, faultDir);
+    const auto start = chrono::steady_clock::now();
+    for (const auto& path : seedPaths) {
+        const auto rom = readRom(path);
+        if (!rom) {
+            return 1;
+        }
+        fuzzer.execute(*rom);
+    }
+
+    const auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    for (uint64_t run = 0; !runs || run < *runs; ++run) {
+        // the clock costs about as much as a short run, only look every so often
+        if (!runs && run % 4096 == 0 && chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        fuzzer.execute(fuzzer.next());
+    }
+
+    fuzzer.report(std::cerr, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    return 0;
+}
+
+#endif
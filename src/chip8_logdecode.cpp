@@ -0,0 +1,35 @@
+// prints a binary log written with chip8 --log-file as the same text the console shows
+//
+// usage: chip8-logdecode <log file> [output file]
+
+#include "base.h"
+
+#include <fstream>
+
+using namespace ez;
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "usage: chip8-logdecode <log file> [output file]\n";
+        return 1;
+    }
+    auto in = std::ifstream(argv[1], std::ios::binary);
+    if (!in) {
+        std::cerr << std::format("Failed to open {}\n", argv[1]);
+        return 1;
+    }
+    auto file = std::ofstream{};
+    if (argc == 3) {
+        file.open(argv[2]);
+        if (!file) {
+            std::cerr << std::format("Failed to open {}\n", argv[2]);
+            return 1;
+        }
+    }
+    auto& out = argc == 3 ? file : std::cout;
+    if (!logging::decodeBinaryLog(in, out)) {
+        std::cerr << std::format("{} is not a chip8 log or is truncated\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,300 @@
+// disassembles an execution trace written with chip8 --trace or chip8-batch --trace, see trace.h
+//
+// usage: chip8-trace [--pc addr[-addr]] [--reg vX] [--writes addr] [--last n] [--quirks profile] <trace file>
+//
+// prints one line per traced instruction, oldest first: the cycle it ran on, its address and opcode, the disassembly,
+// i and vf after it and the other register it changed. an instruction marked unfinished faulted, or was running when
+// the trace ended. addresses are hex.
+//
+// --pc only shows instructions in the address range, a single address if no range is given
+// --reg shows the history of one register, every instruction that changed it with the value before and after
+// --writes shows the stores (Fx33, Fx55, 5xy2) that covered the address, with the value they wrote
+// --last only shows the last n of the instructions the other options let through
+// --quirks decodes with another profile than the traced machine ran
+//
+// register values are worked out from the records, so they are only known from the first instruction in the trace
+// that changed them. key waits set their register outside any instruction and loads from memory only record the
+// lowest register they changed, the others show as ? until the next instruction that changes them
+
+#include "base.h"
+#include "decode.h"
+#include "trace.h"
+
+#include <cctype>
+#include <deque>
+
+using namespace ez;
+
+namespace {
+
+// register values as far as the trace tells them
+using Registers = std::array<std::optional<uint8_t>, 16>;
+
+std::string disassemble(const Instruction& instr, const Quirks& quirks) {
+    const auto x = instr.x;
+    const auto y = instr.y;
+    switch (instr.op) {
+    case Op::Cls: return "CLS";
+    case Op::Ret: return "RET";
+    case Op::Sys: return std::format("SYS {:03x}", instr.nnn);
+    case Op::Jp: return std::format("JP {:03x}", instr.nnn);
+    case Op::Call: return std::format("CALL {:03x}", instr.nnn);
+    case Op::SeImm: return std::format("SE V{:X}, {:02x}", x, instr.kk);
+    case Op::SneImm: return std::format("SNE V{:X}, {:02x}", x, instr.kk);
+    case Op::SeReg: return std::format("SE V{:X}, V{:X}", x, y);
+    case Op::LdImm: return std::format("LD V{:X}, {:02x}", x, instr.kk);
+    case Op::AddImm: return std::format("ADD V{:X}, {:02x}", x, instr.kk);
+    case Op::LdReg: return std::format("LD V{:X}, V{:X}", x, y);
+    case Op::Or: return std::format("OR V{:X}, V{:X}", x, y);
+    case Op::And: return std::format("AND V{:X}, V{:X}", x, y);
+    case Op::Xor: return std::format("XOR V{:X}, V{:X}", x, y);
+    case Op::AddReg: return std::format("ADD V{:X}, V{:X}", x, y);
+    case Op::Sub: return std::format("SUB V{:X}, V{:X}", x, y);
+    case Op::Shr: return std::format("SHR V{:X}, V{:X}", x, y);
+    case Op::Subn: return std::format("SUBN V{:X}, V{:X}", x, y);
+    case Op::Shl: return std::format("SHL V{:X}, V{:X}", x, y);
+    case Op::SneReg: return std::format("SNE V{:X}, V{:X}", x, y);
+    case Op::LdI: return std::format("LD I, {:03x}", instr.nnn);
+    case Op::JpOffset: return quirks.jumpV0 ? std::format("JP V0, {:03x}", instr.nnn) : std::format("JP V{:X}, {:03x}", x, instr.nnn);
+    case Op::Rnd: return std::format("RND V{:X}, {:02x}", x, instr.kk);
+    case Op::Drw: return std::format("DRW V{:X}, V{:X}, {:x}", x, y, instr.n);
+    case Op::Skp: return std::format("SKP V{:X}", x);
+    case Op::Sknp: return std::format("SKNP V{:X}", x);
+    case Op::LdVxDt: return std::format("LD V{:X}, DT", x);
+    case Op::LdVxKey: return std::format("LD V{:X}, K", x);
+    case Op::LdDtVx: return std::format("LD DT, V{:X}", x);
+    case Op::LdStVx: return std::format("LD ST, V{:X}", x);
+    case Op::AddI: return std::format("ADD I, V{:X}", x);
+    case Op::LdFont: return std::format("LD F, V{:X}", x);
+    case Op::LdBcd: return std::format("LD B, V{:X}", x);
+    case Op::StoreRegs: return std::format("LD [I], V{:X}", x);
+    case Op::LoadRegs: return std::format("LD V{:X}, [I]", x);
+    case Op::ScrollDown: return std::format("SCD {:x}", instr.n);
+    case Op::ScrollRight: return "SCR";
+    case Op::ScrollLeft: return "SCL";
+    case Op::Exit: return "EXIT";
+    case Op::Lores: return "LOW";
+    case Op::Hires: return "HIGH";
+    case Op::LdBigFont: return std::format("LD HF, V{:X}", x);
+    case Op::StoreFlags: return std::format("LD R, V{:X}", x);
+    case Op::LoadFlags: return std::format("LD V{:X}, R", x);
+    case Op::ScrollUp: return std::format("SCU {:x}", instr.n);
+    case Op::StoreRange: return std::format("SAVE V{:X} - V{:X}", x, y);
+    case Op::LoadRange: return std::format("LOAD V{:X} - V{:X}", x, y);
+    // the address is the word after the opcode, the record has it as i
+    case Op::LdILong: return "LD I, LONG";
+    case Op::Plane: return std::format("PLANE {:x}", x);
+    case Op::LdAudio: return "AUDIO";
+    case Op::Pitch: return std::format("PITCH V{:X}", x);
+    case Op::Undecoded:
+    case Op::Invalid:
+    case Op::Count:
+        break;
+    }
+    return "???";
+}
+
+std::string formatValue(const std::optional<uint8_t>& value) { return value ? std::format("{:02x}", *value) : "?"; }
+
+// the registers a load from memory may have written, in the order it writes them
+std::vector<int> loadedRegisters(const Instruction& instr) {
+    auto regs = std::vector<int>{};
+    if (instr.op == Op::LoadRegs || instr.op == Op::LoadFlags) {
+        for (auto i = 0; i <= instr.x; ++i) {
+            regs.push_back(i);
+        }
+    } else if (instr.op == Op::LoadRange) {
+        const auto step = instr.x <= instr.y ? 1 : -1;
+        for (auto i = 0; i <= std::abs(instr.y - instr.x); ++i) {
+            regs.push_back(instr.x + i * step);
+        }
+    }
+    return regs;
+}
+
+// applies what the record says the instruction did
+void update(Registers& regs, const TraceRecord& record, const Instruction& instr) {
+    if (record.flags & TraceRecord::MORE_REGISTERS) {
+        // the record has the lowest register that changed, the ones above it are lost
+        for (const auto reg : loadedRegisters(instr)) {
+            if (reg > record.reg) {
+                regs[size_t(reg)].reset();
+            }
+        }
+    }
+    if (record.reg != TraceRecord::NO_REGISTER) {
+        regs[record.reg] = record.value;
+    }
+    regs[0xF] = record.vf;
+    if (instr.op == Op::LdVxKey) {
+        regs[instr.x].reset();
+    }
+}
+
+// the bytes a store wrote, by address
+std::vector<std::pair<uint16_t, std::optional<uint8_t>>> storedBytes(const TraceRecord& record, const Instruction& instr, const Quirks& quirks,
+                                                                     const Registers& regs) {
+    // the record has i as the store left it, unless it never finished
+    auto regI = record.regI;
+    if (instr.op == Op::StoreRegs && quirks.memoryIncrement && (record.flags & TraceRecord::FINISHED)) {
+        regI = uint16_t(regI - instr.x - 1);
+    }
+    const auto mask = uint16_t(quirks.memoryBytes() - 1);
+    auto bytes = std::vector<std::pair<uint16_t, std::optional<uint8_t>>>{};
+    switch (instr.op) {
+    case Op::LdBcd:
+        for (auto i = 0; i < 3; ++i) {
+            const auto& value = regs[instr.x];
+            constexpr std::array<int, 3> DIVISORS = {100, 10, 1};
+            bytes.emplace_back(uint16_t((regI + i) & mask), value ? std::optional(uint8_t(*value / DIVISORS[size_t(i)] % 10)) : std::nullopt);
+        }
+        break;
+    case Op::StoreRegs:
+        for (auto i = 0; i <= instr.x; ++i) {
+            bytes.emplace_back(uint16_t((regI + i) & mask), regs[size_t(i)]);
+        }
+        break;
+    case Op::StoreRange: {
+        const auto step = instr.x <= instr.y ? 1 : -1;
+        for (auto i = 0; i <= std::abs(instr.y - instr.x); ++i) {
+            bytes.emplace_back(uint16_t((regI + i) & mask), regs[size_t(instr.x + i * step)]);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return bytes;
+}
+
+std::optional<uint16_t> parseAddress(std::string_view text) {
+    try {
+        size_t end = 0;
+        const auto value = std::stoul(std::string(text), &end, 16);
+        return end == text.size() && value <= 0xFFFF ? std::optional(uint16_t(value)) : std::nullopt;
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+std::optional<uint8_t> parseRegister(std::string_view text) {
+    if (text.size() != 2 || (text[0] != 'v' && text[0] != 'V') || !std::isxdigit(uint8_t(text[1]))) {
+        return std::nullopt;
+    }
+    return uint8_t(std::stoi(std::string(1, text[1]), nullptr, 16));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto firstPc = std::optional<uint16_t>{};
+    auto lastPc = std::optional<uint16_t>{};
+    auto reg = std::optional<uint8_t>{};
+    auto writes = std::optional<uint16_t>{};
+    auto last = std::optional<size_t>{};
+    auto quirks = std::optional<QuirkProfile>{};
+    auto tracePath = std::filesystem::path{};
+
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--pc" && hasValue) {
+            const auto range = std::string_view(argv[++i]);
+            const auto dash = range.find('-');
+            firstPc = parseAddress(range.substr(0, dash));
+            lastPc = dash == std::string_view::npos ? firstPc : parseAddress(range.substr(dash + 1));
+            if (!firstPc || !lastPc) {
+                log_error("Expected a hex address or range like 200-2ff, got {}", range);
+                return 1;
+            }
+        } else if (arg == "--reg" && hasValue) {
+            reg = parseRegister(argv[++i]);
+            if (!reg) {
+                log_error("Expected a register v0 - vF, got {}", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--writes" && hasValue) {
+            writes = parseAddress(argv[++i]);
+            if (!writes) {
+                log_error("Expected a hex address, got {}", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--last" && hasValue) {
+            last = std::stoull(argv[++i]);
+        } else if (arg == "--quirks" && hasValue) {
+            quirks = parseQuirkProfile(argv[++i]);
+            if (!quirks) {
+                log_error("Unknown quirk profile {}, expected chip8, schip or xochip", argv[i]);
+                return 1;
+            }
+        } else if (arg.starts_with("--")) {
+            log_error("Unknown option {}", arg);
+            return 1;
+        } else {
+            tracePath = arg;
+        }
+    }
+    if (tracePath.empty()) {
+        log_error("usage: chip8-trace [--pc addr[-addr]] [--reg vX] [--writes addr] [--last n] [--quirks profile] <trace file>");
+        return 1;
+    }
+
+    const auto trace = Trace::load(tracePath);
+    if (!trace) {
+        return 1;
+    }
+    const auto profile = quirks.value_or(trace->quirks);
+    const auto decodeQuirks = quirksOf(profile);
+
+    auto regs = Registers{};
+    auto lines = std::deque<std::string>{};
+    for (const auto& record : trace->records) {
+        const auto instr = decode(record.opcode, decodeQuirks);
+        const auto before = regs;
+        const auto stored = storedBytes(record, instr, decodeQuirks, regs);
+        update(regs, record, instr);
+
+        if (firstPc && (record.pc < *firstPc || record.pc > *lastPc)) {
+            continue;
+        }
+        // a key wait or a load can leave a register unknown that was unknown before, that still counts
+        const auto loaded = loadedRegisters(instr);
+        const auto touched = reg && (before[*reg] != regs[*reg] || record.reg == *reg || (instr.op == Op::LdVxKey && instr.x == *reg) ||
+                                     ((record.flags & TraceRecord::MORE_REGISTERS) && std::find(loaded.begin(), loaded.end(), *reg) != loaded.end()));
+        if (reg && !touched) {
+            continue;
+        }
+        const auto store = writes ? std::find_if(stored.begin(), stored.end(), [&](const auto& byte) { return byte.first == *writes; }) : stored.end();
+        if (writes && store == stored.end()) {
+            continue;
+        }
+
+        auto line = std::format("{:>12} {:04x}  {:04x}  {:<18} i={:04x} vf={:02x}", record.cycle(), record.pc, record.opcode,
+                                disassemble(instr, decodeQuirks), record.regI, record.vf);
+        if (record.reg != TraceRecord::NO_REGISTER) {
+            line += std::format(" v{:x}={:02x}", record.reg, record.value);
+        }
+        if (record.flags & TraceRecord::MORE_REGISTERS) {
+            line += " ...";
+        }
+        if (!(record.flags & TraceRecord::FINISHED)) {
+            line += " unfinished";
+        }
+        if (reg) {
+            line += std::format("  v{:x}: {} -> {}", *reg, formatValue(before[*reg]), formatValue(regs[*reg]));
+        }
+        if (writes) {
+            line += std::format("  [{:04x}] <- {}", store->first, formatValue(store->second));
+        }
+        lines.push_back(std::move(line));
+        if (last && lines.size() > *last) {
+            lines.pop_front();
+        }
+    }
+
+    std::cout << std::format("# {} of {} instructions traced, {}\n", trace->records.size(), trace->written, to_string(profile));
+    for (const auto& line : lines) {
+        std::cout << line << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include "decode.h"
+
+namespace ez {
+
+Instruction decode(OpCode opCode, const Quirks& quirks) {
+    const auto nib3 = (0xF000 & opCode) >> 12;
+    const auto nib0 = (0x000F & opCode);
+    const auto lowByte = uint8_t(0xFF & opCode);
+
+    auto instr = Instruction{};
+    instr.x = uint8_t((0x0F00 & opCode) >> 8);
+    instr.y = uint8_t((0x00F0 & opCode) >> 4);
+    instr.n = uint8_t(nib0);
+    instr.kk = lowByte;
+    instr.nnn = uint16_t(0x0FFF & opCode);
+
+    switch (nib3) {
+    case 0x0:
+        instr.op = opCode == 0x00E0 ? Op::Cls : opCode == 0x00EE ? Op::Ret : Op::Sys;
+        if (quirks.superChip) {
+            switch (opCode & 0xFFF0) {
+            case 0x00C0: instr.op = Op::ScrollDown; break;
+            case 0x00D0: instr.op = quirks.xoChip ? Op::ScrollUp : Op::Sys; break;
+            }
+            switch (opCode) {
+            case 0x00FB: instr.op = Op::ScrollRight; break;
+            case 0x00FC: instr.op = Op::ScrollLeft; break;
+            case 0x00FD: instr.op = Op::Exit; break;
+            case 0x00FE: instr.op = Op::Lores; break;
+            case 0x00FF: instr.op = Op::Hires; break;
+            }
+        }
+        break;
+    case 0x1:
+        instr.op = Op::Jp;
+        break;
+    case 0x2:
+        instr.op = Op::Call;
+        break;
+    case 0x3:
+        instr.op = Op::SeImm;
+        break;
+    case 0x4:
+        instr.op = Op::SneImm;
+        break;
+    case 0x5:
+        if (quirks.xoChip && nib0 == 0x2) {
+            instr.op = Op::StoreRange;
+        } else if (quirks.xoChip && nib0 == 0x3) {
+            instr.op = Op::LoadRange;
+        } else {
+            instr.op = nib0 == 0 ? Op::SeReg : Op::Invalid;
+        }
+        break;
+    case 0x6:
+        instr.op = Op::LdImm;
+        break;
+    case 0x7:
+        instr.op = Op::AddImm;
+        break;
+    case 0x8:
+        switch (nib0) {
+        case 0x0: instr.op = Op::LdReg; break;
+        case 0x1: instr.op = Op::Or; break;
+        case 0x2: instr.op = Op::And; break;
+        case 0x3: instr.op = Op::Xor; break;
+        case 0x4: instr.op = Op::AddReg; break;
+        case 0x5: instr.op = Op::Sub; break;
+        case 0x6: instr.op = Op::Shr; break;
+        case 0x7: instr.op = Op::Subn; break;
+        case 0xE: instr.op = Op::Shl; break;
+        default: instr.op = Op::Invalid; break;
+        }
+        break;
+    case 0x9:
+        instr.op = nib0 == 0 ? Op::SneReg : Op::Invalid;
+        break;
+    case 0xA:
+        instr.op = Op::LdI;
+        break;
+    case 0xB:
+        instr.op = Op::JpOffset;
+        break;
+    case 0xC:
+        instr.op = Op::Rnd;
+        break;
+    case 0xD:
+        instr.op = Op::Drw;
+        break;
+    case 0xE:
+        if (lowByte == 0x9E) {
+            instr.op = Op::Skp;
+        } else {
+            instr.op = lowByte == 0xA1 ? Op::Sknp : Op::Invalid;
+        }
+        break;
+    case 0xF:
+        switch (lowByte) {
+        case 0x07: instr.op = Op::LdVxDt; break;
+        case 0x0A: instr.op = Op::LdVxKey; break;
+        case 0x15: instr.op = Op::LdDtVx; break;
+        case 0x18: instr.op = Op::LdStVx; break;
+        case 0x1E: instr.op = Op::AddI; break;
+        case 0x29: instr.op = Op::LdFont; break;
+        case 0x33: instr.op = Op::LdBcd; break;
+        case 0x55: instr.op = Op::StoreRegs; break;
+        case 0x65: instr.op = Op::LoadRegs; break;
+        case 0x30: instr.op = quirks.superChip ? Op::LdBigFont : Op::Invalid; break;
+        case 0x75: instr.op = quirks.superChip ? Op::StoreFlags : Op::Invalid; break;
+        case 0x85: instr.op = quirks.superChip ? Op::LoadFlags : Op::Invalid; break;
+        case 0x01: instr.op = quirks.xoChip ? Op::Plane : Op::Invalid; break;
+        case 0x02: instr.op = quirks.xoChip && instr.x == 0 ? Op::LdAudio : Op::Invalid; break;
+        case 0x3A: instr.op = quirks.xoChip ? Op::Pitch : Op::Invalid; break;
+        case 0x00: instr.op = quirks.xoChip && instr.x == 0 ? Op::LdILong : Op::Invalid; break;
+        default: instr.op = Op::Invalid; break;
+        }
+        break;
+    }
+    return instr;
+}
+
+const char* to_string(Op op) {
+    switch (op) {
+    case Op::Undecoded: return "Undecoded";
+    case Op::Cls: return "Cls";
+    case Op::Ret: return "Ret";
+    case Op::Sys: return "Sys";
+    case Op::Jp: return "Jp";
+    case Op::Call: return "Call";
+    case Op::SeImm: return "SeImm";
+    case Op::SneImm: return "SneImm";
+    case Op::SeReg: return "SeReg";
+    case Op::LdImm: return "LdImm";
+    case Op::AddImm: return "AddImm";
+    case Op::LdReg: return "LdReg";
+    case Op::Or: return "Or";
+    case Op::And: return "And";
+    case Op::Xor: return "Xor";
+    case Op::AddReg: return "AddReg";
+    case Op::Sub: return "Sub";
+    case Op::Shr: return "Shr";
+    case Op::Subn: return "Subn";
+    case Op::Shl: return "Shl";
+    case Op::SneReg: return "SneReg";
+    case Op::LdI: return "LdI";
+    case Op::JpOffset: return "JpOffset";
+    case Op::Rnd: return "Rnd";
+    case Op::Drw: return "Drw";
+    case Op::Skp: return "Skp";
+    case Op::Sknp: return "Sknp";
+    case Op::LdVxDt: return "LdVxDt";
+    case Op::LdVxKey: return "LdVxKey";
+    case Op::LdDtVx: return "LdDtVx";
+    case Op::LdStVx: return "LdStVx";
+    case Op::AddI: return "AddI";
+    case Op::LdFont: return "LdFont";
+    case Op::LdBcd: return "LdBcd";
+    case Op::StoreRegs: return "StoreRegs";
+    case Op::LoadRegs: return "LoadRegs";
+    case Op::ScrollDown: return "ScrollDown";
+    case Op::ScrollRight: return "ScrollRight";
+    case Op::ScrollLeft: return "ScrollLeft";
+    case Op::Exit: return "Exit";
+    case Op::Lores: return "Lores";
+    case Op::Hires: return "Hires";
+    case Op::LdBigFont: return "LdBigFont";
+    case Op::StoreFlags: return "StoreFlags";
+    case Op::LoadFlags: return "LoadFlags";
+    case Op::ScrollUp: return "ScrollUp";
+    case Op::StoreRange: return "StoreRange";
+    case Op::LoadRange: return "LoadRange";
+    case Op::LdILong: return "LdILong";
+    case Op::Plane: return "Plane";
+    case Op::LdAudio: return "LdAudio";
+    case Op::Pitch: return "Pitch";
+    case Op::Invalid: return "Invalid";
+    case Op::Count: break;
+    }
+    abort();
+}
+
+} // namespace ez
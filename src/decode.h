@@ -0,0 +1,42 @@
+#pragma once
+#include "base.h"
+#include "quirks.h"
+
+namespace ez {
+
+using OpCode = uint16_t;
+
+// every opcode the core knows, Undecoded marks an empty slot in a decode cache
+enum class Op : uint8_t {
+    Undecoded,
+    Cls, Ret, Sys, Jp, Call, SeImm, SneImm, SeReg, LdImm, AddImm,
+    LdReg, Or, And, Xor, AddReg, Sub, Shr, Subn, Shl, SneReg,
+    LdI, JpOffset, Rnd, Drw, Skp, Sknp,
+    LdVxDt, LdVxKey, LdDtVx, LdStVx, AddI, LdFont, LdBcd, StoreRegs, LoadRegs,
+    // SUPER-CHIP
+    ScrollDown, ScrollRight, ScrollLeft, Exit, Lores, Hires, LdBigFont, StoreFlags, LoadFlags,
+    // XO-CHIP
+    ScrollUp, StoreRange, LoadRange, LdILong, Plane, LdAudio, Pitch,
+    Invalid,
+    Count
+};
+
+// an opcode with its operands pulled out ahead of time
+struct Instruction {
+    Op op = Op::Undecoded;
+    uint8_t x = 0;
+    uint8_t y = 0;
+    uint8_t n = 0;
+    uint8_t kk = 0;
+    // set by Emu when a compiled jit block starts at this address, decode leaves it clear
+    bool native = false;
+    uint16_t nnn = 0;
+};
+static_assert(sizeof(Instruction) == 8);
+
+// the extended opcodes only decode when the quirks enable their instruction set, anything else keeps its chip8 meaning
+Instruction decode(OpCode opCode, const Quirks& quirks = {});
+
+const char* to_string(Op op);
+
+} // namespace ez
\ No newline at end of file
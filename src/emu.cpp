@@ -1,4 +1,7 @@
 #include "emu.h"
+#include "ops.h"
+#include "savestate.h"
+#include <bit>
 
 namespace ez {
 
@@ -20,300 +23,1396 @@ static const std::array<uint8_t, 0x80> font = {
     0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
-static const int BYTES_PER_FONT_GLYPH = 5;
+// SUPER-CHIP only had the digits, the letters are the ones Octo added for XO-CHIP
+static const std::array<uint8_t, 16 * Emu::BYTES_PER_BIG_FONT_GLYPH> bigFont = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+static_assert(Emu::BIG_FONT_START >= 16 * Emu::BYTES_PER_FONT_GLYPH && Emu::BIG_FONT_START + bigFont.size() <= Emu::PROGRAM_START);
+
+// empties decode cache entries [first, last). a plain fill stores field by field, which is most of the cost of a reset
+static void clearDecoded(std::array<Instruction, Emu::MEM_SIZE_BYTES>& decoded, size_t first, size_t last) {
+    static_assert(std::is_trivially_copyable_v<Instruction> && Op::Undecoded == Op(0));
+    memset(static_cast<void*>(decoded.data() + first), 0, (last - first) * sizeof(Instruction));
+}
+
+static_assert(std::is_trivially_copyable_v<Emu::State> && std::is_standard_layout_v<Emu::State>);
+// registers and the rest of the small state, up to memory, are copied back in one go
+static constexpr size_t STATE_REGISTERS_BYTES = offsetof(Emu::State, memory);
+
+struct Emu::Checkpoint {
+    State state;
+    // the framebuffer generation state.display was taken at, rows changed after it need copying back
+    uint64_t displayGeneration = 0;
+};
 
-Emu::Emu(const uint8_t* program, size_t size) {
+Emu::Emu(const uint8_t* program, size_t size, QuirkProfile quirks) {
+    setQuirkProfile(quirks);
 
-    memcpy(m_memory.data(), font.data(), font.size());
+    memcpy(m_state.memory.data(), font.data(), font.size());
+    memcpy(m_state.memory.data() + BIG_FONT_START, bigFont.data(), bigFont.size());
 
-    const auto programStart = 0x200;
-    assert(size < MEM_SIZE_BYTES - programStart);
-    memcpy(m_memory.data() + programStart, program, size);
-    m_pc = programStart;
+    assert(size <= maxProgramSize(quirks));
+    memcpy(m_state.memory.data() + PROGRAM_START, program, size);
+    m_state.cpu.pc = PROGRAM_START;
 }
 
-Emu::OpCode Emu::fetchInstruction() {
-    auto bytes = (m_memory.data() + m_pc);
-    uint16_t code = (bytes[0] << 8) | bytes[1];
-    m_pc += 2;
-    assert(m_pc < MEM_SIZE_BYTES);
-    return code;
+void Emu::load(const uint8_t* program, size_t size, QuirkProfile quirks) {
+    assert(size <= maxProgramSize(quirks));
+    const auto previous = m_state.quirkProfile;
+    std::destroy_at(&m_state);
+    std::construct_at(&m_state);
+
+    memcpy(m_state.memory.data(), font.data(), font.size());
+    memcpy(m_state.memory.data() + BIG_FONT_START, bigFont.data(), bigFont.size());
+    memcpy(m_state.memory.data() + PROGRAM_START, program, size);
+    m_state.cpu.pc = PROGRAM_START;
+
+    // same as setState, setQuirkProfile has to see the profile change to switch interpreters
+    m_state.quirkProfile = previous;
+    m_checkpoint.reset();
+    m_skippedCycles = 0;
+    invalidateAll();
+    setQuirkProfile(quirks);
 }
 
-void Emu::tick(KeypadInput keysDown) {
+QuirkProfile Emu::profileFor(const uint8_t* program, size_t size, std::optional<QuirkProfile> forced) {
+    return forced.value_or(lookupQuirkProfile(program, size).value_or(QuirkProfile::Chip8));
+}
 
-    const auto now = chrono::steady_clock::now();
-    if (!m_pause) {
+Emu Emu::fromRom(const uint8_t* program, size_t size, std::optional<QuirkProfile> forced) {
+    const auto profile = profileFor(program, size, forced);
+    if (!forced && lookupQuirkProfile(program, size)) {
+        log_info("Rom {:016x} is in the quirk database, using the {} profile", romHash(program, size), to_string(profile));
+    }
+    return Emu(program, size, profile);
+}
 
-        constexpr auto timerDuration = chrono::duration_cast<chrono::nanoseconds>(16.66666ms); // 60 hz
-        constexpr auto instructionDuration = chrono::duration_cast<chrono::nanoseconds>(2ms);        // 500 hz
+Emu::~Emu() = default;
+Emu::Emu(Emu&&) noexcept = default;
+Emu& Emu::operator=(Emu&&) noexcept = default;
 
-        m_timeElapsedSinceLastTimerTick += now - m_lastTickTime;
-        while (m_timeElapsedSinceLastTimerTick > timerDuration) {
-            m_timeElapsedSinceLastTimerTick -= timerDuration;
-            if (m_delayTimer > 0) {
-                --m_delayTimer;
-            }
-            if (m_soundTimer > 0) {
-                --m_soundTimer;
+void Emu::setQuirkProfile(QuirkProfile profile) {
+    const bool changed = profile != m_state.quirkProfile;
+    m_state.quirkProfile = profile;
+    m_quirks = quirksOf(profile);
+    switch (profile) {
+    case QuirkProfile::Chip8:
+        m_interpret = &Emu::runInstructions<NoProfiling, QuirkProfile::Chip8>;
+        m_interpretProfiled = &Emu::runInstructions<Profiling, QuirkProfile::Chip8>;
+        m_interpretCoverage = &Emu::runInstructions<Coverage, QuirkProfile::Chip8>;
+        m_interpretTraced = &Emu::runInstructions<Tracing, QuirkProfile::Chip8>;
+        m_interpretNative = &Emu::runInstructions<NativeBlocks, QuirkProfile::Chip8>;
+        break;
+    case QuirkProfile::SuperChip:
+        m_interpret = &Emu::runInstructions<NoProfiling, QuirkProfile::SuperChip>;
+        m_interpretProfiled = &Emu::runInstructions<Profiling, QuirkProfile::SuperChip>;
+        m_interpretCoverage = &Emu::runInstructions<Coverage, QuirkProfile::SuperChip>;
+        m_interpretTraced = &Emu::runInstructions<Tracing, QuirkProfile::SuperChip>;
+        m_interpretNative = &Emu::runInstructions<NativeBlocks, QuirkProfile::SuperChip>;
+        break;
+    case QuirkProfile::XoChip:
+        m_interpret = &Emu::runInstructions<NoProfiling, QuirkProfile::XoChip>;
+        m_interpretProfiled = &Emu::runInstructions<Profiling, QuirkProfile::XoChip>;
+        m_interpretCoverage = &Emu::runInstructions<Coverage, QuirkProfile::XoChip>;
+        m_interpretTraced = &Emu::runInstructions<Tracing, QuirkProfile::XoChip>;
+        m_interpretNative = &Emu::runInstructions<NativeBlocks, QuirkProfile::XoChip>;
+        break;
+    case QuirkProfile::Count:
+        fail("Invalid quirk profile");
+    }
+    // the profile decides which opcodes decode at all, and compiled blocks bake the quirks in
+    if (changed) {
+        m_decoded.fill({});
+    }
+    if (m_jit && changed) {
+        m_jit = makeJit();
+    }
+}
+
+const Instruction& Emu::decodedAt(uint16_t address) {
+    auto& instr = m_decoded[address];
+    if (instr.op == Op::Undecoded) {
+        // an instruction at the very last byte takes its low half from the start of memory
+        instr = decode(OpCode((m_state.memory[address] << 8) | m_state.memory[(address + 1) & (m_quirks.memoryBytes() - 1)]), m_quirks);
+        // the jit compiles the block here along with the decode, see NativeBlocks
+        if (m_jit && Jit::compiles(instr.op)) {
+            instr.native = m_jit->lookup(uint16_t(address & (m_quirks.memoryBytes() - 1)), m_state.memory.data()).fn != nullptr;
+        }
+    }
+    return instr;
+}
+
+const Instruction& Emu::fetchInstruction() {
+    // jumps, skips and Bnnn can take pc past the end of a 4 KB machine, it wraps around like data addresses do
+    m_state.cpu.pc &= uint16_t(m_quirks.memoryBytes() - 1);
+    const auto& instr = decodedAt(m_state.cpu.pc);
+    m_state.cpu.pc += 2;
+    return instr;
+}
+
+void Emu::writeMemory(uint16_t address, uint8_t value) {
+    address &= m_quirks.memoryBytes() - 1;
+    if (m_state.memory[address] == value) {
+        return;
+    }
+    m_state.memory[address] = value;
+    m_dirtyPages[address / PAGE_SIZE_BYTES / 64] |= uint64_t(1) << (address / PAGE_SIZE_BYTES % 64);
+    // the byte is the high half of the instruction starting here and the low half of the one before it, for address
+    // 0 that is the one at the last byte, see decodedAt
+    m_decoded[address] = {};
+    m_decoded[(address - 1) & (m_quirks.memoryBytes() - 1)] = {};
+    if (m_jit) {
+        m_jit->invalidate(address, address);
+    }
+}
+
+void Emu::invalidateMemory(uint16_t first, uint16_t last) {
+    for (auto page = first / PAGE_SIZE_BYTES; page <= last / PAGE_SIZE_BYTES; ++page) {
+        m_dirtyPages[page / 64] |= uint64_t(1) << (page % 64);
+    }
+    clearDecoded(m_decoded, first > 0 ? first - 1 : 0, size_t(last) + 1);
+    if (first == 0) {
+        m_decoded[m_quirks.memoryBytes() - 1] = {};
+    }
+    if (m_jit) {
+        m_jit->invalidate(first, last);
+    }
+}
+
+void Emu::loadProgram(const uint8_t* program, size_t size) {
+    assert(size <= maxProgramSize(m_state.quirkProfile));
+    if (size == 0) {
+        return;
+    }
+    memcpy(m_state.memory.data() + PROGRAM_START, program, size);
+    invalidateMemory(PROGRAM_START, uint16_t(PROGRAM_START + size - 1));
+}
+
+void Emu::saveState(std::vector<uint8_t>& out) const {
+    const auto& cpu = m_state.cpu;
+    auto state = SnapshotState{};
+    state.regV = cpu.regV;
+    state.regI = cpu.regI;
+    // a jump can leave pc past the end of memory until the next fetch wraps it, snapshots always hold the wrapped one
+    state.pc = uint16_t(cpu.pc & (m_quirks.memoryBytes() - 1));
+    state.sp = cpu.sp;
+    state.delayTimer = cpu.delayTimer;
+    state.soundTimer = cpu.soundTimer;
+    state.waitingForKey = cpu.waitingForKey;
+    state.keyWaitRegIdx = cpu.keyWaitRegIdx;
+    state.keyWaitKeysDown = cpu.keyWaitKeysDown;
+    state.quirkProfile = m_state.quirkProfile;
+    state.cycleCount = cpu.cycleCount;
+    state.frameCount = cpu.frameCount;
+    state.timerPhase = cpu.timerPhase;
+    state.rngState = m_state.rng.state;
+    state.memory = m_state.memory;
+    state.planes = m_state.display.planes();
+    state.hires = m_state.display.isHires();
+    state.planeMask = m_state.display.planeMask();
+    state.flagRegisters = m_state.flagRegisters;
+    state.audioPattern = m_state.audioPattern;
+    state.pitch = m_state.pitch;
+    state.exited = m_state.exited;
+    state.stack.assign(m_state.stack.begin(), m_state.stack.begin() + cpu.sp);
+    writeSnapshot(state, out);
+}
+
+bool Emu::loadState(const uint8_t* data, size_t size) {
+    // parse everything first so a bad snapshot can't leave the machine half loaded
+    auto state = SnapshotState{};
+    if (!readSnapshot(data, size, state)) {
+        return false;
+    }
+
+    auto& cpu = m_state.cpu;
+    cpu.regV = state.regV;
+    cpu.regI = state.regI;
+    cpu.pc = state.pc;
+    cpu.sp = state.sp;
+    cpu.delayTimer = state.delayTimer;
+    cpu.soundTimer = state.soundTimer;
+    cpu.waitingForKey = state.waitingForKey;
+    cpu.keyWaitRegIdx = state.keyWaitRegIdx;
+    cpu.keyWaitKeysDown = state.keyWaitKeysDown;
+    cpu.cycleCount = state.cycleCount;
+    cpu.frameCount = state.frameCount;
+    cpu.timerPhase = state.timerPhase;
+    m_state.rng.state = state.rngState;
+    m_state.flagRegisters = state.flagRegisters;
+    m_state.audioPattern = state.audioPattern;
+    m_state.pitch = state.pitch;
+    m_state.exited = state.exited;
+    // snapshots don't hold faults, the faulting instruction simply faults again
+    m_state.fault = Fault::None;
+    // readSnapshot checked it fits and matches sp
+    std::copy(state.stack.begin(), state.stack.end(), m_state.stack.begin());
+    m_state.memory = state.memory;
+    m_state.display.restore(state.planes, state.hires, state.planeMask);
+
+    invalidateAll();
+    setQuirkProfile(state.quirkProfile);
+    return true;
+}
+
+void Emu::setState(const State& state) {
+    // the profile is part of the state, but setQuirkProfile has to see it change to switch interpreters
+    const auto profile = state.quirkProfile;
+    const auto previous = m_state.quirkProfile;
+    m_state = state;
+    m_state.quirkProfile = previous;
+    invalidateAll();
+    setQuirkProfile(profile);
+}
+
+void Emu::invalidateAll() {
+    // memory was replaced wholesale, nothing decoded or compiled from it can be trusted
+    m_dirtyPages.fill(~uint64_t(0));
+    clearDecoded(m_decoded, 0, MEM_SIZE_BYTES);
+    if (m_jit) {
+        m_jit->flush();
+    }
+    m_atIdleLoop = false;
+    updateSound();
+}
+
+void Emu::setCheckpoint() {
+    if (!m_checkpoint) {
+        m_checkpoint = std::make_unique<Checkpoint>();
+    }
+    m_checkpoint->state = m_state;
+    m_checkpoint->displayGeneration = m_state.display.generation();
+    m_dirtyPages.fill(0);
+}
+
+void Emu::resetToCheckpoint() {
+    assert(m_checkpoint);
+    const auto& state = m_checkpoint->state;
+    const auto previous = m_state.quirkProfile;
+    memcpy(static_cast<void*>(&m_state), &state, STATE_REGISTERS_BYTES);
+    m_state.quirkProfile = previous;
+    m_atIdleLoop = false;
+
+    for (auto word = 0; word < int(m_dirtyPages.size()); ++word) {
+        for (auto bits = m_dirtyPages[word]; bits != 0; bits &= bits - 1) {
+            const auto page = (word * 64 + std::countr_zero(bits)) * PAGE_SIZE_BYTES;
+            auto current = m_state.memory.data() + page;
+            const auto saved = state.memory.data() + page;
+            // only the bytes that differ are copied back and invalidated. programs keep their variables next to
+            // their code, the instructions decoded and compiled around them stay
+            for (auto i = 0; i < PAGE_SIZE_BYTES; ++i) {
+                if (current[i] == saved[i]) {
+                    continue;
+                }
+                auto end = i + 1;
+                while (end < PAGE_SIZE_BYTES && current[end] != saved[end]) {
+                    ++end;
+                }
+                memcpy(current + i, saved + i, size_t(end - i));
+                const auto first = page + i;
+                // the instruction straddling the first changed byte read it too
+                clearDecoded(m_decoded, first > 0 ? first - 1 : 0, page + end);
+                if (first == 0) {
+                    m_decoded[m_quirks.memoryBytes() - 1] = {};
+                }
+                if (m_jit) {
+                    m_jit->invalidate(uint16_t(first), uint16_t(page + end - 1));
+                }
+                i = end;
             }
         }
+    }
+    m_dirtyPages.fill(0);
+
+    const auto& display = state.display;
+    m_state.display.restoreRows(display.planes(), m_state.display.dirtyRowsSince(m_checkpoint->displayGeneration), display.isHires(), display.planeMask());
+    // every row changed up to now matches the checkpoint again
+    m_checkpoint->displayGeneration = m_state.display.generation();
+
+    setQuirkProfile(state.quirkProfile);
+    updateSound();
+}
+
+void Emu::setBackend(Backend backend) {
+    if (backend != Backend::Interpreter && !Jit::isSupported()) {
+        log_warn("Jit is not supported on this platform, staying on the interpreter");
+        backend = Backend::Interpreter;
+    }
+    const bool changed = backend != m_backend;
+    m_backend = backend;
+    if (m_backend == Backend::Interpreter) {
+        m_jit.reset();
+    } else if (!m_jit || changed) {
+        m_jit = makeJit();
+        // decodedAt marks block starts for the jit it was called with. nothing past the profile's memory is fetched
+        clearDecoded(m_decoded, 0, m_quirks.memoryBytes());
+        if (!m_jit->isReady()) {
+            log_warn("Staying on the interpreter");
+            m_jit.reset();
+            m_backend = Backend::Interpreter;
+        }
+    }
+}
+
+std::unique_ptr<Jit> Emu::makeJit() const {
+    // the checked backend runs every block natively so all of them get compared
+    const auto minLength = m_backend == Backend::JitChecked ? 1 : MIN_NATIVE_BLOCK_LENGTH;
+    return std::make_unique<Jit>(m_quirks.memoryBytes(), m_quirks, minLength);
+}
+
+void Emu::setProfiling(bool enabled) {
+    if (!enabled) {
+        m_profiler.reset();
+    } else if (!m_profiler) {
+        m_profiler = std::make_unique<Profiler>(MEM_SIZE_BYTES, INSTRUCTIONS_PER_SECOND);
+    }
+}
 
+void Emu::tick(KeypadInput keysDown, uint64_t maxCycles) {
+
+    const auto now = chrono::steady_clock::now();
+    if (!m_pause) {
         m_timeElapsedSinceLastInstruction += now - m_lastTickTime;
-        while (m_timeElapsedSinceLastInstruction > instructionDuration) {
-            m_timeElapsedSinceLastInstruction -= instructionDuration;
-            runOneInstruction(keysDown);
+        if (m_timeElapsedSinceLastInstruction > m_maxCatchUp) {
+            m_droppedTime += m_timeElapsedSinceLastInstruction - m_maxCatchUp;
+            m_timeElapsedSinceLastInstruction = m_maxCatchUp;
         }
+        const auto cycles = std::min<uint64_t>(m_timeElapsedSinceLastInstruction / INSTRUCTION_DURATION, maxCycles);
+        m_timeElapsedSinceLastInstruction -= int64_t(cycles) * INSTRUCTION_DURATION;
+        runCycles(cycles, keysDown);
     }
     m_lastTickTime = now;
 }
 
-void Emu::runOneInstruction(KeypadInput keysDown) {
+void Emu::syncWallClock() {
+    m_lastTickTime = chrono::steady_clock::now();
+    m_timeElapsedSinceLastInstruction = 0ns;
+}
 
-    // if we're in keypress mode we don't run any commands until a key is pressed
-    if (m_waitingForKeypressRegIdx) {
-        m_waitingForKeypressRegIdx->m_keysDownLastTick |= keysDown;
-        for (int i = 0; i < 16; ++i) {
-            // only fires on key-up
-            if (m_waitingForKeypressRegIdx->m_keysDownLastTick ^ keysDown) {
-                m_regV[m_waitingForKeypressRegIdx->m_regIdx] = i;
-                m_waitingForKeypressRegIdx = {};
-                return;
+void Emu::runCycles(uint64_t n, KeypadInput keysDown) {
+    while (n > 0 && m_state.fault == Fault::None) {
+        // if we're in keypress mode we don't run any commands until a key is pressed
+        if (m_state.cpu.waitingForKey) {
+            if (m_profiler) {
+                m_profiler->onKeyWait();
             }
+            waitForKeypress(keysDown);
+            advanceClock();
+            --n;
+            // keys don't change within one call, a wait that didn't end on this cycle can't end on a later one
+            if (m_state.cpu.waitingForKey && m_idleSkipping && !m_profiler) {
+                skipCycles(n);
+                m_skippedCycles += n;
+                n = 0;
+            }
+            continue;
         }
-        return;
+        if (m_profiler) {
+            n -= (this->*m_interpretProfiled)(n, keysDown);
+            continue;
+        }
+        if (m_coverage) {
+            n -= (this->*m_interpretCoverage)(n, keysDown);
+            continue;
+        }
+        if (m_trace) {
+            n -= (this->*m_interpretTraced)(n, keysDown);
+            continue;
+        }
+        if (m_atIdleLoop) {
+            m_atIdleLoop = false;
+            n -= skipIdleLoop(n, keysDown);
+            continue;
+        }
+        if (m_jit) {
+            n -= (this->*m_interpretNative)(n, keysDown);
+            // blocks compiled before the jit stopped were dropped with it, their instructions ran in the interpreter
+            if (!m_jit->isReady()) {
+                log_warn("Jit stopped, staying on the interpreter");
+                setBackend(Backend::Interpreter);
+            }
+            continue;
+        }
+        n -= (this->*m_interpret)(n, keysDown);
     }
+}
 
-    const auto opCode = fetchInstruction();
-    const auto lowByte = 0xFF & opCode;
-    const auto nib3 = (0xF000 & opCode) >> 12;
-    const auto nib2 = (0x0F00 & opCode) >> 8;
-    const auto nib1 = (0x00F0 & opCode) >> 4;
-    const auto nib0 = (0x000F & opCode);
-
-    auto& vx = m_regV[nib2];
-    const auto vy = m_regV[nib1];
-    auto& flags = m_regV[0xF];
-
-    // log_info("Opcode {:x}", opCode);
-
-    switch (nib3) {
-    case 0x0: {
-        if (opCode == 0x00E0) {
-            // clear display
-            m_display.clear();
-        } else if (opCode == 0x00EE) {
-            // return
-            assert(!m_stack.empty());
-            m_pc = m_stack.back();
-            m_stack.pop_back();
-        } else {
-            log_info("Ignoring SYS opcode: {}", opCode);
+uint64_t Emu::runJitBlock(uint64_t budget, KeypadInput keysDown) {
+    const auto& block = m_jit->lookup(m_state.cpu.pc, m_state.memory.data());
+    // the block may have been dropped since decodedAt marked it, the caller interprets the instruction instead
+    if (!block.fn) {
+        return 0;
+    }
+    // blocks can stop after any instruction, so only the budget limits how much of one runs. a timer tick inside
+    // the block would change what Fx07 reads, blocks that don't touch the timers can run across one and let
+    // skipCycles catch up afterwards
+    auto count = std::min<uint64_t>(block.length, budget);
+    if (block.touchesTimers) {
+        count = std::min(count, cyclesUntilNextFrame());
+    }
+
+    if (m_backend == Backend::JitChecked) {
+        auto regV = m_state.cpu.regV;
+        auto regI = m_state.cpu.regI;
+        auto delayTimer = m_state.cpu.delayTimer;
+        block.fn(regV.data(), &regI, &delayTimer, uint32_t(count));
+
+        const auto startPc = m_state.cpu.pc;
+        const auto startFrame = m_state.cpu.frameCount;
+        const auto ran = (this->*m_interpret)(count, keysDown);
+        assert(ran == count);
+        // the interpreter may have ticked the timers after the final instruction of the block
+        const bool timersMatch = m_state.cpu.frameCount != startFrame || delayTimer == m_state.cpu.delayTimer;
+        if (regV != m_state.cpu.regV || regI != m_state.cpu.regI || !timersMatch) {
+            fail("Jit block at {:x} ({} of {} instructions) diverged from the interpreter", startPc, count, block.length);
         }
-        break;
+        return ran;
     }
-    case 0x1: // jmp
-        m_pc = opCode & 0x0FFF;
-        break;
-    case 0x2: // call _NNN
-        m_stack.push_back(m_pc);
-        m_pc = opCode & 0x0FFF;
-        break;
-    case 0x3: // skip equal _xkk
-        if (vx == (0x00FF & opCode)) {
-            m_pc += 2;
+
+    block.fn(m_state.cpu.regV.data(), &m_state.cpu.regI, &m_state.cpu.delayTimer, uint32_t(count));
+    m_state.cpu.pc += uint16_t(2 * count);
+    // most blocks end before the next tick, skipCycles' per frame steps are only needed when one falls inside
+    if (m_state.cpu.timerPhase + int(count) * TIMERS_PER_SECOND < INSTRUCTIONS_PER_SECOND) {
+        m_state.cpu.cycleCount += count;
+        m_state.cpu.timerPhase += int(count) * TIMERS_PER_SECOND;
+    } else {
+        // ticks on the cycles the interpreter would have, so the sound callback sees the same edges
+        skipCycles(count);
+    }
+    return count;
+}
+
+void Emu::runFrames(uint64_t n, KeypadInput keysDown) {
+    // one call for all of them, so a busy wait can be skipped across frames
+    runCycles(cyclesUntilFrame(n), keysDown);
+}
+
+uint64_t Emu::cyclesUntilNextFrame() const { return cyclesUntilFrame(1); }
+
+uint64_t Emu::cyclesUntilFrame(uint64_t n) const {
+    // round up, the timer ticks on the cycle that pushes the phase over the limit
+    return (n * INSTRUCTIONS_PER_SECOND - m_state.cpu.timerPhase + TIMERS_PER_SECOND - 1) / TIMERS_PER_SECOND;
+}
+
+void Emu::tickTimers() {
+    ++m_state.cpu.frameCount;
+    if (m_state.cpu.delayTimer > 0) {
+        --m_state.cpu.delayTimer;
+    }
+    if (m_state.cpu.soundTimer > 0) {
+        --m_state.cpu.soundTimer;
+        updateSound();
+    }
+}
+
+void Emu::updateSound() {
+    const bool on = m_state.cpu.soundTimer > 0;
+    if (on != m_soundOn) {
+        m_soundOn = on;
+        if (m_soundCallback) {
+            m_soundCallback(on, m_state.cpu.cycleCount);
         }
-        break;
-    case 0x4: // skip not equal _xkk
-        if (vx != (0x00FF & opCode)) {
-            m_pc += 2;
+    }
+}
+
+void Emu::advanceClock(uint64_t cycles) {
+    m_state.cpu.cycleCount += cycles;
+    m_state.cpu.timerPhase += int(cycles * TIMERS_PER_SECOND % INSTRUCTIONS_PER_SECOND);
+    auto ticks = cycles * TIMERS_PER_SECOND / INSTRUCTIONS_PER_SECOND;
+    if (m_state.cpu.timerPhase >= INSTRUCTIONS_PER_SECOND) {
+        m_state.cpu.timerPhase -= INSTRUCTIONS_PER_SECOND;
+        ++ticks;
+    }
+    for (uint64_t i = 0; i < ticks; ++i) {
+        tickTimers();
+    }
+}
+
+void Emu::skipCycles(uint64_t cycles) {
+    // a tick at the end of each step, so the sound callback sees the same cycle numbers as when interpreting
+    while (cycles > 0) {
+        const auto step = std::min(cycles, cyclesUntilNextFrame());
+        advanceClock(step);
+        cycles -= step;
+    }
+}
+
+// the only instructions a skippable loop may contain. none of them write anything but registers, so an iteration
+// is a function of the registers, the delay timer and the keys
+static bool isIdleLoopOp(Op op) {
+    switch (op) {
+    case Op::Jp:
+    case Op::SeImm:
+    case Op::SneImm:
+    case Op::SeReg:
+    case Op::SneReg:
+    case Op::LdImm:
+    case Op::LdReg:
+    case Op::Skp:
+    case Op::Sknp:
+    case Op::LdVxDt:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Emu::isIdleLoopCandidate(uint16_t start, uint16_t jumpAddress) {
+    if (start > jumpAddress || jumpAddress - start >= 2 * MAX_IDLE_LOOP_LENGTH) {
+        return false;
+    }
+    // instructions that were skipped over so far aren't decoded yet, which rules the loop out until they are
+    for (auto address = start; address < jumpAddress; address += 2) {
+        if (!isIdleLoopOp(m_decoded[address].op)) {
+            return false;
         }
-        break;
-    case 0x5: // skip equal reg v _xy_
-        assert(nib0 == 0);
-        if (vx == vy) {
-            m_pc += 2;
+    }
+    return true;
+}
+
+int Emu::simulateIdleIteration(uint16_t start, std::array<uint8_t, 16>& regs, KeypadInput keysDown) {
+    auto pc = start;
+    const auto skip = [&]() {
+        // XO-CHIP skips step over both words of F000 nnnn, which isn't a loop op anyway
+        if (m_quirks.xoChip && decodedAt(pc).op == Op::LdILong) {
+            return false;
         }
-        break;
-    case 0x6: // set _XNN
-        vx = static_cast<uint8_t>(0x00FF & opCode);
-        break;
-    case 0x7: // add _xNN
-        vx += static_cast<uint8_t>(0x00FF & opCode);
-        break;
-    case 0x8: // math - all opcodes are _xy_
-    {
-        switch (nib0) {
-        case 0x0: // ld vx->vy
-            vx = vy;
+        pc += 2;
+        return true;
+    };
+    for (auto count = 1; count <= MAX_IDLE_LOOP_LENGTH; ++count) {
+        const auto& instr = decodedAt(pc);
+        pc += 2;
+        bool ok = true;
+        switch (instr.op) {
+        case Op::Jp:
+            if (instr.nnn == start) {
+                return count;
+            }
+            pc = instr.nnn;
             break;
-        case 0x1: // or vx vy
-            vx = vy | vx;
-            flags = 0;
+        case Op::SeImm:
+            ok = regs[instr.x] != instr.kk || skip();
             break;
-        case 0x2: // and vx vy
-            vx = vy & vx;
-            flags = 0;
+        case Op::SneImm:
+            ok = regs[instr.x] == instr.kk || skip();
             break;
-        case 0x3: // xor vx vy
-            vx = vy ^ vx;
-            flags = 0;
+        case Op::SeReg:
+            ok = regs[instr.x] != regs[instr.y] || skip();
             break;
-        case 0x4: // add vx vy
-        {
-            const bool carry = (int(vx) + vy) > 0xFF;
-            vx = vy + vx;
-            flags = carry ? 1 : 0;
+        case Op::SneReg:
+            ok = regs[instr.x] == regs[instr.y] || skip();
             break;
-        }
-        case 0x5: // sub vx vy
-        {
-            bool borrow = vy > vx;
-            vx = vx - vy;
-            flags = borrow ? 0 : 1;
+        case Op::LdImm:
+            regs[instr.x] = instr.kk;
+            break;
+        case Op::LdReg:
+            regs[instr.x] = regs[instr.y];
+            break;
+        case Op::Skp:
+            ok = !ops::keyDown(keysDown, regs[instr.x]) || skip();
             break;
+        case Op::Sknp:
+            ok = ops::keyDown(keysDown, regs[instr.x]) || skip();
+            break;
+        case Op::LdVxDt:
+            regs[instr.x] = m_state.cpu.delayTimer;
+            break;
+        default:
+            return 0;
         }
-        case 0x6: // shr vx vy
-        {
-            if(m_legacyShift){
-                vx = vy;
-            }
-            bool vxOdd = 0b1 & vx;
-            vx = vx >> 1;
-            flags = vxOdd ? 1 : 0;
+        if (!ok) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+uint64_t Emu::skipIdleLoop(uint64_t budget, KeypadInput keysDown) {
+    uint64_t skipped = 0;
+    while (skipped < budget) {
+        // the first iteration may still change registers, e.g. load a new timer value. only if the one after it
+        // comes back with the same registers is the loop spinning
+        auto regs = m_state.cpu.regV;
+        const auto first = simulateIdleIteration(m_state.cpu.pc, regs, keysDown);
+        auto again = regs;
+        const auto length = first == 0 ? 0 : simulateIdleIteration(m_state.cpu.pc, again, keysDown);
+        if (length == 0 || again != regs) {
             break;
         }
-        case 0x7: // subn vx vy
-        {
-            bool borrow = vx > vy;
-            vx = vy - vx;
-            flags = borrow ? 0 : 1;
+        // a tick part way through an iteration would change what Fx07 reads, so only whole iterations up to the next
+        // one are skipped. a stopped delay timer can't change, then only the budget limits how far to go
+        const auto remaining = budget - skipped;
+        const auto window = m_state.cpu.delayTimer == 0 ? remaining : std::min(remaining, cyclesUntilNextFrame());
+        if (uint64_t(first) > window) {
             break;
         }
-        case 0xE: { // shl vx vy
-            if(m_legacyShift){
-                vx = vy;
+        const auto cycles = first + (window - first) / length * length;
+        m_state.cpu.regV = regs;
+        skipCycles(cycles);
+        skipped += cycles;
+    }
+    m_skippedCycles += skipped;
+    return skipped;
+}
+
+void Emu::waitForKeypress(KeypadInput keysDown) {
+    auto& cpu = m_state.cpu;
+    cpu.keyWaitKeysDown |= keysDown;
+    // only fires on key-up, the lowest key let go wins if several were at once
+    const auto released = cpu.keyWaitKeysDown & ~keysDown;
+    if (released == 0) {
+        return;
+    }
+    cpu.regV[cpu.keyWaitRegIdx] = uint8_t(std::countr_zero(released));
+    // the whole wait goes, a snapshot of the machine after it can't tell which register it was for
+    cpu.waitingForKey = false;
+    cpu.keyWaitRegIdx = 0;
+    cpu.keyWaitKeysDown = 0;
+}
+
+struct Emu::NoProfiling {
+    // whether a compiled jit block starts at the instruction that was just fetched, see EZ_JIT_ENTRY
+    static bool jitEntry(const Instruction&) { return false; }
+    static void instruction(Emu&, const Instruction&) {}
+    static void retired(Emu&) {}
+    static void call(Emu&, uint16_t) {}
+    static void ret(Emu&) {}
+    static void draw(Emu&, bool) {}
+    static void clear(Emu&) {}
+};
+
+// called after the instruction was fetched, so the pc already points past it
+struct Emu::Profiling {
+    static bool jitEntry(const Instruction&) { return false; }
+    static void instruction(Emu& emu, const Instruction& instr) { emu.m_profiler->onInstruction(emu.m_state.cpu.pc - 2, instr.op); }
+    static void retired(Emu&) {}
+    static void call(Emu& emu, uint16_t target) { emu.m_profiler->onCall(target, emu.m_state.cpu.cycleCount); }
+    static void ret(Emu& emu) { emu.m_profiler->onReturn(emu.m_state.cpu.cycleCount); }
+    static void draw(Emu& emu, bool collision) { emu.m_profiler->onDraw(emu.m_state.cpu.pc - 2, collision, emu.m_state.cpu.cycleCount); }
+    static void clear(Emu& emu) { emu.m_profiler->onClear(); }
+};
+
+struct Emu::Coverage {
+    static bool jitEntry(const Instruction&) { return false; }
+    static void instruction(Emu& emu, const Instruction& instr) {
+        ++emu.m_coverage->pcs[(emu.m_state.cpu.pc - 2) % emu.m_coverage->pcs.size()];
+        ++emu.m_coverage->ops[size_t(instr.op)];
+    }
+    static void retired(Emu&) {}
+    static void call(Emu&, uint16_t) {}
+    static void ret(Emu&) {}
+    static void draw(Emu&, bool) {}
+    static void clear(Emu&) {}
+};
+
+// the record is started on fetch and finished after the instruction ran, so a faulting one still shows up
+struct Emu::Tracing {
+    static bool jitEntry(const Instruction&) { return false; }
+    static void instruction(Emu& emu, const Instruction&) {
+        const auto& state = emu.m_state;
+        const auto pc = uint16_t(state.cpu.pc - 2);
+        const auto opcode = uint16_t(state.memory[pc] << 8 | state.memory[uint16_t(pc + 1)]);
+        emu.m_trace->begin(pc, opcode, state.cpu.cycleCount, state.cpu.regI, state.cpu.regV);
+    }
+    static void retired(Emu& emu) { emu.m_trace->finish(emu.m_state.cpu.regI, emu.m_state.cpu.regV); }
+    static void call(Emu&, uint16_t) {}
+    static void ret(Emu&) {}
+    static void draw(Emu&, bool) {}
+    static void clear(Emu&) {}
+};
+
+// decodedAt marks where compiled blocks start, so spotting one is a test of the instruction that was just fetched and
+// the interpreter never has to return to runCycles to get into native code
+struct Emu::NativeBlocks : NoProfiling {
+    static bool jitEntry(const Instruction& instr) { return instr.native; }
+};
+
+// GCC and Clang get a direct threaded loop through computed gotos, every handler ends in its own copy of the
+// fetch + indirect jump which gives the branch predictor one history per opcode. Others fall back to a switch.
+#if defined(__GNUC__)
+#define EZ_THREADED_DISPATCH 1
+#else
+#define EZ_THREADED_DISPATCH 0
+#endif
+
+// first thing in the handler of every op the jit compiles, where a compiled block starts all of them jump to the one
+// copy of the code that runs it
+#define EZ_JIT_ENTRY()                                                                                                                                         \
+    do {                                                                                                                                                       \
+        if (Profile::jitEntry(*instr)) {                                                                                                                       \
+            goto jitEntry;                                                                                                                                     \
+        }                                                                                                                                                      \
+    } while (0)
+#if EZ_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define EZ_OP(name) op_##name
+#define EZ_DISPATCH() goto* dispatchTable[size_t(instr->op)];
+#define EZ_NEXT()                                                                                                                                              \
+    do {                                                                                                                                                       \
+        Profile::retired(*this);                                                                                                                               \
+        ++executed;                                                                                                                                            \
+        advanceClock();                                                                                                                                        \
+        if (executed == budget || m_state.cpu.waitingForKey) {                                                                                                 \
+            return executed;                                                                                                                                   \
+        }                                                                                                                                                      \
+        instr = &fetchInstruction();                                                                                                                           \
+        Profile::instruction(*this, *instr);                                                                                                                   \
+        goto* dispatchTable[size_t(instr->op)];                                                                                                                \
+    } while (0)
+#else
+#define EZ_OP(name) case Op::name
+#define EZ_DISPATCH() switch (instr->op)
+#define EZ_NEXT() goto next
+#endif
+// leaves the pc on the faulting instruction and doesn't count it as executed
+#define EZ_FAULT(reason)                                                                                                                                       \
+    do {                                                                                                                                                       \
+        m_state.fault = reason;                                                                                                                                \
+        m_state.cpu.pc -= 2;                                                                                                                                   \
+        return executed;                                                                                                                                       \
+    } while (0)
+
+template <typename Profile, QuirkProfile Quirks> uint64_t Emu::runInstructions(uint64_t budget, KeypadInput keysDown) {
+    constexpr auto quirks = QuirkTraits<Quirks>::quirks;
+#if EZ_THREADED_DISPATCH
+    static void* const dispatchTable[] = {
+        &&op_Undecoded, &&op_Cls,  &&op_Ret,    &&op_Sys,      &&op_Jp,     &&op_Call,    &&op_SeImm,  &&op_SneImm,  &&op_SeReg,  &&op_LdImm,
+        &&op_AddImm,    &&op_LdReg, &&op_Or,    &&op_And,      &&op_Xor,    &&op_AddReg,  &&op_Sub,    &&op_Shr,     &&op_Subn,   &&op_Shl,
+        &&op_SneReg,    &&op_LdI,  &&op_JpOffset, &&op_Rnd,    &&op_Drw,    &&op_Skp,     &&op_Sknp,   &&op_LdVxDt,  &&op_LdVxKey, &&op_LdDtVx,
+        &&op_LdStVx,    &&op_AddI, &&op_LdFont, &&op_LdBcd,    &&op_StoreRegs, &&op_LoadRegs, &&op_ScrollDown, &&op_ScrollRight,
+        &&op_ScrollLeft, &&op_Exit, &&op_Lores, &&op_Hires,    &&op_LdBigFont, &&op_StoreFlags, &&op_LoadFlags, &&op_ScrollUp, &&op_StoreRange,
+        &&op_LoadRange, &&op_LdILong, &&op_Plane, &&op_LdAudio, &&op_Pitch, &&op_Invalid,
+    };
+    static_assert(std::size(dispatchTable) == size_t(Op::Count));
+#endif
+
+    uint64_t executed = 0;
+    if (budget == 0) {
+        return 0;
+    }
+    const Instruction* instr = &fetchInstruction();
+    Profile::instruction(*this, *instr);
+    auto& flags = m_state.cpu.regV[0xF];
+    constexpr uint16_t addressMask = quirks.memoryBytes() - 1;
+    // XO-CHIP's F000 nnnn is the one four byte instruction, skips step over all of it
+    const auto skip = [this]() {
+        if constexpr (quirks.xoChip) {
+            if (m_state.memory[m_state.cpu.pc & addressMask] == 0xF0 && m_state.memory[(m_state.cpu.pc + 1) & addressMask] == 0x00) {
+                m_state.cpu.pc += 4;
+                return;
             }
-            bool vxHighBitSet = 0b1000'0000 & vx;
-            vx = vx << 1;
-            flags = vxHighBitSet ? 1 : 0;
-            break;
         }
-        default:
-            fail("Invalid opcode");
-            break;
+        m_state.cpu.pc += 2;
+    };
+
+#if !EZ_THREADED_DISPATCH
+    for (;;) {
+#endif
+    EZ_DISPATCH() {
+    EZ_OP(Undecoded):
+        // fetchInstruction always decodes, an empty slot can't be dispatched
+        assert(false);
+        EZ_NEXT();
+    EZ_OP(Cls):
+        Profile::clear(*this);
+        m_state.display.clear();
+        EZ_NEXT();
+    EZ_OP(Ret):
+        if (m_state.cpu.sp == 0) {
+            EZ_FAULT(Fault::StackUnderflow);
         }
-    } break;
-    case 0x9: // SNE vx vy _xy_
-        assert(nib0 == 0);
-        if (vx != vy) {
-            m_pc += 2;
+        Profile::ret(*this);
+        m_state.cpu.pc = m_state.stack[--m_state.cpu.sp];
+        EZ_NEXT();
+    EZ_OP(Sys):
+        // fuzzed programs run off into zeroed memory all the time, that would be nothing but log traffic
+        if constexpr (!std::is_same_v<Profile, Coverage>) {
+            log_info("Ignoring SYS opcode: {}", instr->nnn);
         }
-        break;
-    case 0xA: // set I _NNN
-        m_regI = 0x0FFF & opCode;
-        break;
-    case 0xB: // jmp v0 + _NNN
-        if(m_legacyJump){
-            m_pc = m_regV[0] + (0x0FFF & opCode);
+        EZ_NEXT();
+    EZ_OP(Jp): { // jmp
+        const auto jumpAddress = uint16_t(m_state.cpu.pc - 2);
+        m_state.cpu.pc = instr->nnn;
+        // a short backwards jump over nothing but reads may be a busy wait, runCycles takes a closer look
+        if constexpr (std::is_same_v<Profile, NoProfiling> || std::is_same_v<Profile, NativeBlocks>) {
+            if (m_idleSkipping && isIdleLoopCandidate(instr->nnn, jumpAddress)) {
+                ++executed;
+                advanceClock();
+                m_atIdleLoop = true;
+                return executed;
+            }
         }
-        else{
-            m_pc = vx + (0x00FF & opCode);
+        EZ_NEXT();
+    }
+    EZ_OP(Call): // call _NNN
+        if (m_state.cpu.sp == STACK_DEPTH) {
+            EZ_FAULT(Fault::StackOverflow);
         }
-        break;
-    case 0xC: // rand vx AND kk _xkk
-        vx = rand() & lowByte;
-        break;
-    case 0xD: // draw _xyn
-    {
-        uint8_t x_start = vx % Display::WIDTH_PX;
-        uint8_t y_start = vy % Display::HEIGHT_PX;
-        bool erasedPixel = false;
-        for (auto y_offset = 0; y_offset < nib0; ++y_offset) {
-            auto sprite_byte = m_memory[m_regI + y_offset];
-            for (auto x_offset = 0; x_offset < 8; ++x_offset) {
-                bool bitVal = (0x1 << (7 - x_offset)) & sprite_byte;
-                erasedPixel |= m_display.write(x_start + x_offset, y_start + y_offset, bitVal);
+        Profile::call(*this, instr->nnn);
+        m_state.stack[m_state.cpu.sp++] = m_state.cpu.pc;
+        m_state.cpu.pc = instr->nnn;
+        EZ_NEXT();
+    EZ_OP(SeImm): // skip equal _xkk
+        if (m_state.cpu.regV[instr->x] == instr->kk) {
+            skip();
+        }
+        EZ_NEXT();
+    EZ_OP(SneImm): // skip not equal _xkk
+        if (m_state.cpu.regV[instr->x] != instr->kk) {
+            skip();
+        }
+        EZ_NEXT();
+    EZ_OP(SeReg): // skip equal reg v _xy_
+        if (m_state.cpu.regV[instr->x] == m_state.cpu.regV[instr->y]) {
+            skip();
+        }
+        EZ_NEXT();
+    EZ_OP(LdImm): // set _XNN
+        EZ_JIT_ENTRY();
+        m_state.cpu.regV[instr->x] = instr->kk;
+        EZ_NEXT();
+    EZ_OP(AddImm): // add _xNN
+        EZ_JIT_ENTRY();
+        m_state.cpu.regV[instr->x] += instr->kk;
+        EZ_NEXT();
+    EZ_OP(LdReg): // ld vx->vy
+        EZ_JIT_ENTRY();
+        m_state.cpu.regV[instr->x] = m_state.cpu.regV[instr->y];
+        EZ_NEXT();
+    EZ_OP(Or): { // or vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::bitOr(m_state.cpu.regV[instr->x], m_state.cpu.regV[instr->y]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        if constexpr (quirks.logicResetsVf) {
+            flags = result.vf;
+        }
+        EZ_NEXT();
+    }
+    EZ_OP(And): { // and vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::bitAnd(m_state.cpu.regV[instr->x], m_state.cpu.regV[instr->y]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        if constexpr (quirks.logicResetsVf) {
+            flags = result.vf;
+        }
+        EZ_NEXT();
+    }
+    EZ_OP(Xor): { // xor vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::bitXor(m_state.cpu.regV[instr->x], m_state.cpu.regV[instr->y]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        if constexpr (quirks.logicResetsVf) {
+            flags = result.vf;
+        }
+        EZ_NEXT();
+    }
+    EZ_OP(AddReg): { // add vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::add(m_state.cpu.regV[instr->x], m_state.cpu.regV[instr->y]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        flags = result.vf;
+        EZ_NEXT();
+    }
+    EZ_OP(Sub): { // sub vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::sub(m_state.cpu.regV[instr->x], m_state.cpu.regV[instr->y]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        flags = result.vf;
+        EZ_NEXT();
+    }
+    EZ_OP(Shr): { // shr vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::shr(m_state.cpu.regV[quirks.shiftVy ? instr->y : instr->x]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        flags = result.vf;
+        EZ_NEXT();
+    }
+    EZ_OP(Subn): { // subn vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::subn(m_state.cpu.regV[instr->x], m_state.cpu.regV[instr->y]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        flags = result.vf;
+        EZ_NEXT();
+    }
+    EZ_OP(Shl): { // shl vx vy
+        EZ_JIT_ENTRY();
+        const auto result = ops::shl(m_state.cpu.regV[quirks.shiftVy ? instr->y : instr->x]);
+        m_state.cpu.regV[instr->x] = result.vx;
+        flags = result.vf;
+        EZ_NEXT();
+    }
+    EZ_OP(SneReg): // SNE vx vy _xy_
+        if (m_state.cpu.regV[instr->x] != m_state.cpu.regV[instr->y]) {
+            skip();
+        }
+        EZ_NEXT();
+    EZ_OP(LdI): // set I _NNN
+        EZ_JIT_ENTRY();
+        m_state.cpu.regI = instr->nnn;
+        EZ_NEXT();
+    EZ_OP(JpOffset): // jmp v0 + _NNN
+        if constexpr (quirks.jumpV0) {
+            m_state.cpu.pc = m_state.cpu.regV[0] + instr->nnn;
+        } else {
+            m_state.cpu.pc = m_state.cpu.regV[instr->x] + instr->nnn;
+        }
+        EZ_NEXT();
+    EZ_OP(Rnd): // rand vx AND kk _xkk
+        m_state.cpu.regV[instr->x] = ops::random(m_state.rng, instr->kk);
+        EZ_NEXT();
+    EZ_OP(Drw): { // draw _xyn
+        const auto xStart = m_state.cpu.regV[instr->x] % m_state.display.width();
+        const auto yStart = m_state.cpu.regV[instr->y] % m_state.display.height();
+        // SUPER-CHIP draws a 16x16 sprite for n = 0
+        const bool wide = quirks.superChip && instr->n == 0;
+        const auto height = wide ? 16 : int(instr->n);
+        const auto bytes = height * (wide ? 2 : 1) * std::popcount(m_state.display.planeMask());
+        const auto address = m_state.cpu.regI & addressMask;
+        auto sprite = m_state.memory.data() + address;
+        // sprite data running off the end of memory wraps around to the start
+        std::array<uint8_t, 16 * 2 * Display::PLANES> wrapped;
+        if (address + bytes > quirks.memoryBytes()) {
+            for (auto i = 0; i < bytes; ++i) {
+                wrapped[i] = m_state.memory[(address + i) & addressMask];
             }
+            sprite = wrapped.data();
         }
+        const bool erasedPixel = m_state.display.drawSprite(xStart, yStart, sprite, height, wide, quirks.wrapSprites);
         flags = erasedPixel ? 1 : 0;
-        break;
+        Profile::draw(*this, erasedPixel);
+        EZ_NEXT();
+    }
+    EZ_OP(Skp): // skip vx _x__
+        if (ops::keyDown(keysDown, m_state.cpu.regV[instr->x])) {
+            skip();
+        }
+        EZ_NEXT();
+    EZ_OP(Sknp): // skipn vx _x__
+        if (!ops::keyDown(keysDown, m_state.cpu.regV[instr->x])) {
+            skip();
+        }
+        EZ_NEXT();
+    EZ_OP(LdVxDt): // ld vx dt
+        EZ_JIT_ENTRY();
+        m_state.cpu.regV[instr->x] = m_state.cpu.delayTimer;
+        EZ_NEXT();
+    EZ_OP(LdVxKey): // wait for any keypress, store in vx
+        m_state.cpu.waitingForKey = true;
+        m_state.cpu.keyWaitRegIdx = instr->x;
+        m_state.cpu.keyWaitKeysDown = 0;
+        EZ_NEXT();
+    EZ_OP(LdDtVx): // ld dt vx
+        EZ_JIT_ENTRY();
+        m_state.cpu.delayTimer = m_state.cpu.regV[instr->x];
+        EZ_NEXT();
+    EZ_OP(LdStVx): // ld st vx
+        m_state.cpu.soundTimer = m_state.cpu.regV[instr->x];
+        updateSound();
+        EZ_NEXT();
+    EZ_OP(AddI): // add I vx
+        EZ_JIT_ENTRY();
+        m_state.cpu.regI += m_state.cpu.regV[instr->x];
+        EZ_NEXT();
+    EZ_OP(LdFont): // ld F vx - set I to address of font glyph stored in vx
+        EZ_JIT_ENTRY();
+        m_state.cpu.regI = ops::fontAddress(m_state.cpu.regV[instr->x]);
+        EZ_NEXT();
+    EZ_OP(LdBcd): { // ld B vx - set I - I + 2 to decimal representation of vx
+        const auto digits = ops::bcd(m_state.cpu.regV[instr->x]);
+        for (auto i = 0; i < int(digits.size()); ++i) {
+            writeMemory(m_state.cpu.regI + i, digits[i]);
+        }
+        EZ_NEXT();
     }
-    case 0xE: // keyboard input
-        if ((lowByte) == 0x9E) {
-            // skip vx _x__
-            if ((keysDown & (0b1 << vx)) != 0) {
-                m_pc += 2;
+    EZ_OP(StoreRegs): // ld [I] vx _n__
+        for (auto i = 0; i <= instr->x; ++i) {
+            writeMemory(m_state.cpu.regI + i, m_state.cpu.regV[i]);
+        }
+        if constexpr (quirks.memoryIncrement) {
+            m_state.cpu.regI += instr->x + 1;
+        }
+        EZ_NEXT();
+    EZ_OP(LoadRegs): // ld vx [I] _n__
+        for (auto i = 0; i <= instr->x; ++i) {
+            m_state.cpu.regV[i] = m_state.memory[(m_state.cpu.regI + i) & addressMask];
+        }
+        if constexpr (quirks.memoryIncrement) {
+            m_state.cpu.regI += instr->x + 1;
+        }
+        EZ_NEXT();
+    EZ_OP(ScrollDown): // scroll down _n
+        m_state.display.scrollDown(instr->n);
+        EZ_NEXT();
+    EZ_OP(ScrollRight): // scroll right 4 px
+        m_state.display.scrollRight(4);
+        EZ_NEXT();
+    EZ_OP(ScrollLeft): // scroll left 4 px
+        m_state.display.scrollLeft(4);
+        EZ_NEXT();
+    EZ_OP(Exit): // halt, stays on this instruction for good
+        m_state.exited = true;
+        m_state.cpu.pc -= 2;
+        EZ_NEXT();
+    EZ_OP(Lores):
+        m_state.display.setHires(false);
+        EZ_NEXT();
+    EZ_OP(Hires):
+        m_state.display.setHires(true);
+        EZ_NEXT();
+    EZ_OP(LdBigFont): // ld HF vx - set I to address of big font glyph stored in vx
+        m_state.cpu.regI = ops::bigFontAddress(m_state.cpu.regV[instr->x]);
+        EZ_NEXT();
+    EZ_OP(StoreFlags): // ld R vx _x__
+        std::copy_n(m_state.cpu.regV.begin(), instr->x + 1, m_state.flagRegisters.begin());
+        EZ_NEXT();
+    EZ_OP(LoadFlags): // ld vx R _x__
+        std::copy_n(m_state.flagRegisters.begin(), instr->x + 1, m_state.cpu.regV.begin());
+        EZ_NEXT();
+    EZ_OP(ScrollUp): // scroll up _n
+        m_state.display.scrollUp(instr->n);
+        EZ_NEXT();
+    EZ_OP(StoreRange): { // save vx - vy _xy_, either direction, I stays put
+        const auto step = instr->x <= instr->y ? 1 : -1;
+        for (auto i = 0; i <= std::abs(instr->y - instr->x); ++i) {
+            writeMemory(m_state.cpu.regI + i, m_state.cpu.regV[instr->x + i * step]);
+        }
+        EZ_NEXT();
+    }
+    EZ_OP(LoadRange): { // load vx - vy _xy_
+        const auto step = instr->x <= instr->y ? 1 : -1;
+        for (auto i = 0; i <= std::abs(instr->y - instr->x); ++i) {
+            m_state.cpu.regV[instr->x + i * step] = m_state.memory[(m_state.cpu.regI + i) & addressMask];
+        }
+        EZ_NEXT();
+    }
+    EZ_OP(LdILong): // set I to the 16-bit word following the instruction
+        m_state.cpu.regI = uint16_t((m_state.memory[m_state.cpu.pc & addressMask] << 8) | m_state.memory[(m_state.cpu.pc + 1) & addressMask]);
+        m_state.cpu.pc += 2;
+        EZ_NEXT();
+    EZ_OP(Plane): // select bit-planes _n__
+        m_state.display.setPlaneMask(instr->x);
+        EZ_NEXT();
+    EZ_OP(LdAudio): // load 16 bytes of audio pattern from I
+        for (auto i = 0; i < int(m_state.audioPattern.size()); ++i) {
+            m_state.audioPattern[i] = m_state.memory[(m_state.cpu.regI + i) & addressMask];
+        }
+        EZ_NEXT();
+    EZ_OP(Pitch): // pitch vx
+        m_state.pitch = m_state.cpu.regV[instr->x];
+        EZ_NEXT();
+#if !EZ_THREADED_DISPATCH
+    default:
+#endif
+    EZ_OP(Invalid):
+        EZ_FAULT(Fault::InvalidOpcode);
+    }
+jitEntry: {
+    m_state.cpu.pc -= 2;
+    const auto ran = runJitBlock(budget - executed, keysDown);
+    // the block was dropped since decodedAt marked it, the instruction is interpreted from now on
+    if (ran == 0) {
+        m_decoded[m_state.cpu.pc].native = false;
+    }
+    executed += ran;
+    if (executed == budget) {
+        return executed;
+    }
+    instr = &fetchInstruction();
+    Profile::instruction(*this, *instr);
+#if EZ_THREADED_DISPATCH
+    goto* dispatchTable[size_t(instr->op)];
+#else
+    continue;
+#endif
+}
+#if !EZ_THREADED_DISPATCH
+    next:
+        Profile::retired(*this);
+        ++executed;
+        advanceClock();
+        if (executed == budget || m_state.cpu.waitingForKey) {
+            return executed;
+        }
+        instr = &fetchInstruction();
+        Profile::instruction(*this, *instr);
+    }
+#endif
+}
+
+#undef EZ_JIT_ENTRY
+#undef EZ_OP
+#undef EZ_DISPATCH
+#undef EZ_NEXT
+#undef EZ_FAULT
+#if EZ_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+void Display::touchRows(int first, int last) {
+    const auto generation = m_generation + 1;
+    for (auto y = first; y <= last; ++y) {
+        m_rowGenerations[y] = generation;
+    }
+    m_generation = generation;
+}
+
+void Display::setHires(bool hires) {
+    m_hires = hires;
+    for (auto& plane : m_planes) {
+        plane.fill(0);
+    }
+    touchRows(0, HIRES_HEIGHT_PX - 1);
+}
+
+void Display::restore(const Planes& planes, bool hires, uint8_t planeMask) {
+    const auto generation = m_generation + 1;
+    if (hires != m_hires) {
+        touchRows(0, HIRES_HEIGHT_PX - 1);
+    }
+    for (auto p = 0; p < PLANES; ++p) {
+        for (auto y = 0; y < HIRES_HEIGHT_PX; ++y) {
+            const auto row = y * WORDS_PER_ROW;
+            if (!std::equal(&planes[p][row], &planes[p][row] + WORDS_PER_ROW, &m_planes[p][row])) {
+                m_rowGenerations[y] = generation;
+                m_generation = generation;
             }
-        } else {
-            // skipn vx _x__
-            assert((lowByte) == 0xA1);
-            if ((keysDown & (0b1 << vx)) == 0) {
-                m_pc += 2;
+        }
+    }
+    m_planes = planes;
+    m_hires = hires;
+    setPlaneMask(planeMask);
+}
+
+void Display::restoreRows(const Planes& planes, RowMask rows, bool hires, uint8_t planeMask) {
+    if (rows != 0) {
+        const auto generation = m_generation + 1;
+        for (; rows != 0; rows &= rows - 1) {
+            const auto y = std::countr_zero(rows);
+            for (auto p = 0; p < PLANES; ++p) {
+                std::copy_n(&planes[p][y * WORDS_PER_ROW], WORDS_PER_ROW, &m_planes[p][y * WORDS_PER_ROW]);
             }
+            m_rowGenerations[y] = generation;
         }
-        break;
-    case 0xF: // timers
-        switch (lowByte) {
-        case 0x07: // ld vx dt
-            vx = m_delayTimer;
-            break;
-        case 0x0A: // wait for any keypress, store in vx
-            m_waitingForKeypressRegIdx = KeyWaitInfo{uint8_t(nib2), 0};
-            break;
-        case 0x15: // ld dt vx
-            m_delayTimer = vx;
-            break;
-        case 0x18: // ld st vx
-            m_soundTimer = vx;
-            break;
-        case 0x1E: // add I vx
-            m_regI += vx;
-            break;
-        case 0x29: // ld F vx - set I to address of font glyph stored in vx
-            m_regI = vx * BYTES_PER_FONT_GLYPH;
-            break;
-        case 0x33: // ld B vx - set I - I + 2 to decimal representation of vx
-            m_memory[m_regI] = vx / 100;
-            m_memory[m_regI + 1] = (vx / 10) % 10;
-            m_memory[m_regI + 2] = vx % 10;
-            break;
-        case 0x55: // ld [I] vx _n__
-            for (auto i = 0; i <= nib2; ++i) {
-                m_memory[m_regI + i] = m_regV[i];
+        m_generation = generation;
+    }
+    m_hires = hires;
+    setPlaneMask(planeMask);
+}
+
+void Display::clear() {
+    // one generation per draw or clear no matter how many rows it touches
+    const auto generation = m_generation + 1;
+    for (auto p = 0; p < PLANES; ++p) {
+        if (!(m_planeMask & (1 << p))) {
+            continue;
+        }
+        // outside the current mode's rows the plane is always blank
+        auto& plane = m_planes[p];
+        bool lit = false;
+        for (auto y = 0; y < height(); ++y) {
+            if ((plane[y * WORDS_PER_ROW] | plane[y * WORDS_PER_ROW + 1]) != 0) {
+                m_rowGenerations[y] = generation;
+                lit = true;
+            }
+        }
+        if (lit) {
+            std::fill_n(plane.begin(), height() * WORDS_PER_ROW, 0);
+            m_generation = generation;
+        }
+    }
+}
+
+bool Display::drawSprite(int x, int y, const uint8_t* sprite, int height, bool wide, bool wrap) {
+    assert(0 <= x && x < width() && 0 <= y && y < this->height());
+    // one generation per draw or clear no matter how many rows it touches
+    const auto generation = m_generation + 1;
+    const auto bytesPerPlane = height * (wide ? 2 : 1);
+    // clipping is ok, rows past the bottom are dropped and bits past the right edge shift out. wrapped rows past the
+    // bottom start over at the top, a sprite is never taller than the screen so one subtraction brings them back
+    const auto visibleRows = wrap ? height : std::min(height, this->height() - y);
+    const auto rowAt = [screenHeight = this->height(), y](int i) { return y + i < screenHeight ? y + i : y + i - screenHeight; };
+    Row collisions = 0;
+    for (auto p = 0; p < PLANES; ++p, sprite += bytesPerPlane) {
+        if (!(m_planeMask & (1 << p))) {
+            continue;
+        }
+        // indexing the member array rather than going through a pointer lets the compiler see that the row stores
+        // can't touch the generations, so those stay in registers
+        if (!m_hires && !wide) {
+            // the common chip8 case, one byte into one word per row
+            for (auto i = 0; i < visibleRows; ++i) {
+                const auto spriteRow = wrap ? std::rotr(Row(sprite[i]) << (WIDTH_PX - 8), x) : ops::spriteRow(sprite[i], uint8_t(x));
+                const auto rowY = rowAt(i);
+                auto& row = m_planes[p][rowY * WORDS_PER_ROW];
+                collisions |= row & spriteRow;
+                row ^= spriteRow;
+                if (spriteRow != 0) {
+                    m_rowGenerations[rowY] = generation;
+                    m_generation = generation;
+                }
             }
-            if(m_legacyMemoryIncrement){
-                m_regI += nib2 + 1;
+            continue;
+        }
+        const auto spriteWidth = wide ? 16 : 8;
+        // a lores row is only the first word, whatever would spill into the second one is clipped
+        const auto spills = m_hires && x > 64 - spriteWidth;
+        // whatever runs past the right edge of the row comes back in at the start of the first word
+        const auto wraps = wrap && x > width() - spriteWidth;
+        for (auto i = 0; i < visibleRows; ++i) {
+            const auto bits = wide ? (sprite[2 * i] << 8) | sprite[2 * i + 1] : sprite[i];
+            // leftmost sprite pixel in the most significant bit, then shifted into place in the words it overlaps
+            const auto aligned = Row(bits) << (64 - spriteWidth);
+            const auto first = (x < 64 ? aligned >> x : 0) | (wraps ? aligned << (width() - x) : 0);
+            const auto second = !spills ? 0 : x < 64 ? aligned << (64 - x) : aligned >> (x - 64);
+            const auto rowY = rowAt(i);
+            auto& row0 = m_planes[p][rowY * WORDS_PER_ROW];
+            auto& row1 = m_planes[p][rowY * WORDS_PER_ROW + 1];
+            collisions |= (row0 & first) | (row1 & second);
+            row0 ^= first;
+            row1 ^= second;
+            if ((first | second) != 0) {
+                m_rowGenerations[rowY] = generation;
+                m_generation = generation;
             }
-            break;
-        case 0x65: // ld vx [I] _n__
-            for (auto i = 0; i <= nib2; ++i) {
-                m_regV[i] = m_memory[m_regI + i];
+        }
+    }
+    return collisions != 0;
+}
+
+void Display::scrollDown(int n) {
+    n = std::min(n, height());
+    for (auto p = 0; p < PLANES; ++p) {
+        if (m_planeMask & (1 << p)) {
+            // whole rows move, in lores the unused second word of each row is zero and stays that way
+            auto& plane = m_planes[p];
+            memmove(&plane[n * WORDS_PER_ROW], &plane[0], (height() - n) * WORDS_PER_ROW * sizeof(Row));
+            std::fill_n(&plane[0], n * WORDS_PER_ROW, 0);
+        }
+    }
+    touchRows(0, height() - 1);
+}
+
+void Display::scrollUp(int n) {
+    n = std::min(n, height());
+    for (auto p = 0; p < PLANES; ++p) {
+        if (m_planeMask & (1 << p)) {
+            auto& plane = m_planes[p];
+            memmove(&plane[0], &plane[n * WORDS_PER_ROW], (height() - n) * WORDS_PER_ROW * sizeof(Row));
+            std::fill_n(&plane[(height() - n) * WORDS_PER_ROW], n * WORDS_PER_ROW, 0);
+        }
+    }
+    touchRows(0, height() - 1);
+}
+
+void Display::scrollRight(int n) {
+    assert(0 < n && n < 64);
+    for (auto p = 0; p < PLANES; ++p) {
+        if (!(m_planeMask & (1 << p))) {
+            continue;
+        }
+        auto& plane = m_planes[p];
+        if (m_hires) {
+            for (auto y = 0; y < HIRES_HEIGHT_PX; ++y) {
+                plane[y * WORDS_PER_ROW + 1] = (plane[y * WORDS_PER_ROW + 1] >> n) | (plane[y * WORDS_PER_ROW] << (64 - n));
+                plane[y * WORDS_PER_ROW] >>= n;
             }
-            if(m_legacyMemoryIncrement){
-                m_regI += nib2 + 1;
+        } else {
+            for (auto y = 0; y < HEIGHT_PX; ++y) {
+                plane[y * WORDS_PER_ROW] >>= n;
             }
-            break;
-        default:
-            fail("Invalid opcode");
         }
-        break;
-    default:
-        fail("Invalid opcode: {:x}", opCode);
     }
+    touchRows(0, height() - 1);
 }
 
-bool Display::write(uint8_t x, uint8_t y, bool newVal) {
-    if (!(x < WIDTH_PX && y < HEIGHT_PX)) {
-        // clipping is ok
-        log_info("Clipped px {} {}", x, y);
-        return false;
+void Display::scrollLeft(int n) {
+    assert(0 < n && n < 64);
+    for (auto p = 0; p < PLANES; ++p) {
+        if (!(m_planeMask & (1 << p))) {
+            continue;
+        }
+        auto& plane = m_planes[p];
+        if (m_hires) {
+            for (auto y = 0; y < HIRES_HEIGHT_PX; ++y) {
+                plane[y * WORDS_PER_ROW] = (plane[y * WORDS_PER_ROW] << n) | (plane[y * WORDS_PER_ROW + 1] >> (64 - n));
+                plane[y * WORDS_PER_ROW + 1] <<= n;
+            }
+        } else {
+            for (auto y = 0; y < HEIGHT_PX; ++y) {
+                plane[y * WORDS_PER_ROW] <<= n;
+            }
+        }
+    }
+    touchRows(0, height() - 1);
+}
+
+int Display::pixel(int x, int y) const {
+    const auto bit = 63 - x % 64;
+    return int((word(0, y, x / 64) >> bit) & 0b1) | int(((word(1, y, x / 64) >> bit) & 0b1) << 1);
+}
+
+Display::RowMask Display::dirtyRowsSince(uint64_t generation) const {
+    if (generation >= m_generation) {
+        return 0;
     }
+    RowMask mask = 0;
+    for (auto y = 0; y < HIRES_HEIGHT_PX; ++y) {
+        if (m_rowGenerations[y] > generation) {
+            mask |= RowMask(1) << y;
+        }
+    }
+    return mask;
+}
 
-    auto& val = m_frameBuffer[x + y * WIDTH_PX];
-    const bool isSet = val;
-    val = isSet ^ newVal ? 0xFF : 0x00;
-    return isSet;
+uint64_t Display::hash() const {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const auto hashPlane = [&](const Plane& plane) {
+        for (auto y = 0; y < height(); ++y) {
+            for (auto w = 0; w < (m_hires ? WORDS_PER_ROW : 1); ++w) {
+                // fixed byte order, most significant first
+                for (auto shift = int(sizeof(Row) * 8) - 8; shift >= 0; shift -= 8) {
+                    hash ^= (plane[y * WORDS_PER_ROW + w] >> shift) & 0xFF;
+                    hash *= 0x100000001b3ull;
+                }
+            }
+        }
+    };
+    hashPlane(m_planes[0]);
+    if (std::any_of(m_planes[1].begin(), m_planes[1].end(), [](Row word) { return word != 0; })) {
+        hashPlane(m_planes[1]);
+    }
+    return hash;
+}
+
+const char* to_string(Emu::Fault fault) {
+    switch (fault) {
+    case Emu::Fault::None:
+        return "none";
+    case Emu::Fault::InvalidOpcode:
+        return "invalid opcode";
+    case Emu::Fault::StackUnderflow:
+        return "stack underflow";
+    case Emu::Fault::StackOverflow:
+        return "stack overflow";
+    }
+    abort();
 }
 
-} // namespace ez
\ No newline at end of file
+} // namespace ez
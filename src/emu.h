@@ -1,5 +1,11 @@
 #pragma once
 #include "base.h"
+#include "decode.h"
+#include "jit.h"
+#include "profiler.h"
+#include "quirks.h"
+#include "rng.h"
+#include "trace.h"
 
 namespace ez {
 
@@ -8,71 +14,381 @@ using KeypadInput = uint32_t;
 
 class Display {
   public:
+    // what chip8 programs see
     static constexpr int WIDTH_PX = 64;
     static constexpr int HEIGHT_PX = 32;
-    void clear() { memset(m_frameBuffer.data(), 0, m_frameBuffer.size()); }
+    // SUPER-CHIP and XO-CHIP can switch to hires
+    static constexpr int HIRES_WIDTH_PX = 128;
+    static constexpr int HIRES_HEIGHT_PX = 64;
+    // XO-CHIP draws into two independent bit-planes, a pixel's colour index is its bit from each
+    static constexpr int PLANES = 2;
 
-    // returns true if value is erased, clips if out of bounds
-    bool write(uint8_t x, uint8_t y,
-               bool val); 
+    // one bit per pixel, 64 pixels per word, the most significant bit is the leftmost pixel
+    using Row = uint64_t;
+    static constexpr int WORDS_PER_ROW = HIRES_WIDTH_PX / 64;
+    static_assert(sizeof(Row) * 8 == WIDTH_PX);
+    // each plane is stored row by row at hires size whatever the mode, WORDS_PER_ROW words per row. lores only uses the
+    // first word of the first HEIGHT_PX rows, so clears are memsets and scrolls are word shifts and row moves in
+    // either mode
+    using Plane = std::array<Row, HIRES_HEIGHT_PX * WORDS_PER_ROW>;
+    using Planes = std::array<Plane, PLANES>;
+    // one bit per row
+    using RowMask = uint64_t;
+    static_assert(sizeof(RowMask) * 8 == HIRES_HEIGHT_PX);
 
-    const uint8_t* data() const { return m_frameBuffer.data(); }
+    bool isHires() const { return m_hires; }
+    // switching mode clears every plane
+    void setHires(bool hires);
+    int width() const { return m_hires ? HIRES_WIDTH_PX : WIDTH_PX; }
+    int height() const { return m_hires ? HIRES_HEIGHT_PX : HEIGHT_PX; }
+
+    // bit n selects plane n for clears, scrolls and draws
+    uint8_t planeMask() const { return m_planeMask; }
+    void setPlaneMask(uint8_t mask) { m_planeMask = mask & ((1 << PLANES) - 1); }
+
+    // clears the selected planes
+    void clear();
+
+    // xors a sprite onto every selected plane starting at x, y, which must be on screen. a sprite is 8 pixels and
+    // one byte wide, or 16 pixels and two bytes wide when wide is set, and the data for each selected plane follows
+    // the previous one. clips anything past the right or bottom edge, or wraps it around to the left or top when wrap
+    // is set. returns true if any lit pixel was erased
+    bool drawSprite(int x, int y, const uint8_t* sprite, int height, bool wide = false, bool wrap = false);
+
+    // moves the selected planes by n pixels of the current mode, pixels moved in are unlit
+    void scrollDown(int n);
+    void scrollUp(int n);
+    void scrollRight(int n);
+    void scrollLeft(int n);
+
+    // replaces the whole framebuffer, e.g. when loading a snapshot
+    void restore(const Planes& planes, bool hires, uint8_t planeMask);
+    // copies only the given rows back from planes, which have to include every row that differs. a mode change
+    // touches every row, so dirtyRowsSince the generation planes were taken at always covers it
+    void restoreRows(const Planes& planes, RowMask rows, bool hires, uint8_t planeMask);
+
+    // plane 0 only
+    bool isSet(int x, int y) const { return (word(0, y, x / 64) >> (63 - x % 64)) & 0b1; }
+    // colour index 0 - 3 of a pixel
+    int pixel(int x, int y) const;
+    Row word(int plane, int y, int idx) const { return m_planes[plane][y * WORDS_PER_ROW + idx]; }
+    // plane 0 of a lores row
+    Row row(int y) const { return word(0, y, 0); }
+    const Planes& planes() const { return m_planes; }
+
+    // bumped by every change to the framebuffer or mode, lets consumers skip unchanged frames
+    uint64_t generation() const { return m_generation; }
+    // rows changed by any change after the given generation
+    RowMask dirtyRowsSince(uint64_t generation) const;
+
+    // 64-bit FNV-1a over the visible rows, stable across builds and platforms so it can be compared between runs.
+    // plane 1 only counts once something was drawn to it, so plain chip8 frames hash the same as they always have
+    uint64_t hash() const;
 
   private:
-    std::array<uint8_t, WIDTH_PX * HEIGHT_PX> m_frameBuffer{};
+    // marks the rows as changed in a new generation
+    void touchRows(int first, int last);
+
+    Planes m_planes{};
+    bool m_hires = false;
+    uint8_t m_planeMask = 0b01;
+    uint64_t m_generation = 0;
+    std::array<uint64_t, HIRES_HEIGHT_PX> m_rowGenerations{};
 };
 
+struct SnapshotState;
+
 class Emu {
   public:
-    Emu(const uint8_t* program, size_t size);
+    enum class Backend {
+        Interpreter,
+        // compiles straight-line blocks to native code, falls back to the interpreter where unsupported
+        Jit,
+        // runs every jit block alongside the interpreter and fails on any difference
+        JitChecked,
+    };
+
+    // emulated clock rates, all stepping is driven by instruction count rather than wall time
+    static constexpr int INSTRUCTIONS_PER_SECOND = 500;
+    static constexpr int TIMERS_PER_SECOND = 60;
+    static constexpr auto INSTRUCTION_DURATION = chrono::duration_cast<chrono::nanoseconds>(1s) / INSTRUCTIONS_PER_SECOND;
+    // default for setMaxCatchUp, six frames
+    static constexpr auto DEFAULT_MAX_CATCH_UP = chrono::nanoseconds(100ms);
+
+    // backing storage for the largest profile, chip8 and SUPER-CHIP programs only see the first 4 KB of it, see
+    // Quirks::memoryBytes
+    static constexpr int MEM_SIZE_BYTES = 64 * 1024;
+    static constexpr int PROGRAM_START = 0x200;
+    static constexpr int BYTES_PER_FONT_GLYPH = 5;
+    // the 8x10 SUPER-CHIP font sits right after the small one
+    static constexpr int BIG_FONT_START = 0x50;
+    static constexpr int BYTES_PER_BIG_FONT_GLYPH = 10;
+    // shorter jit blocks are interpreted. on real roms the call into native code, an indirect one the branch
+    // predictor rarely gets right, costs about as much as a shorter block saves
+    static constexpr int MIN_NATIVE_BLOCK_LENGTH = 8;
+    // longest busy wait loop, in instructions, that gets fast-forwarded
+    static constexpr int MAX_IDLE_LOOP_LENGTH = 8;
+    // return addresses a program can have outstanding, one more call is a fault
+    static constexpr int STACK_DEPTH = 16;
+    // granularity of the dirty tracking behind resetToCheckpoint
+    static constexpr int PAGE_SIZE_BYTES = 256;
+    static constexpr int PAGES = MEM_SIZE_BYTES / PAGE_SIZE_BYTES;
+
+    // something the program did that the machine can't carry on from
+    enum class Fault : uint8_t {
+        None,
+        InvalidOpcode,
+        // 00EE with nothing on the stack
+        StackUnderflow,
+        // 2nnn with STACK_DEPTH return addresses already on the stack
+        StackOverflow,
+    };
+
+    // the emulated machine and nothing else. trivially copyable, so a machine copies with memcpy, never allocates and
+    // can live in an arena or a file mapping. what the interpreter touches on every instruction shares one cache line,
+    // the call stack and the other cold registers follow, memory and the framebuffer come last
+    struct State {
+        struct alignas(64) Cpu {
+            std::array<uint8_t, 16> regV{};
+            uint16_t regI = 0;
+            uint16_t pc = 0;
+            // return addresses on the stack
+            uint8_t sp = 0;
+            uint8_t delayTimer = 0;
+            uint8_t soundTimer = 0;
+            // Fx0A is waiting for a key to be released, which then goes into v[keyWaitRegIdx]
+            bool waitingForKey = false;
+            uint8_t keyWaitRegIdx = 0;
+            KeypadInput keyWaitKeysDown = 0;
+            // virtual clock, the timer phase accumulates TIMERS_PER_SECOND per instruction and the timers tick
+            // every time it passes INSTRUCTIONS_PER_SECOND so both rates stay exact without floating point
+            uint64_t cycleCount = 0;
+            uint64_t frameCount = 0;
+            int32_t timerPhase = 0;
+        };
+        static_assert(sizeof(Cpu) == 64);
+
+        Cpu cpu;
+        std::array<uint16_t, STACK_DEPTH> stack{};
+        Rng rng{};
+        QuirkProfile quirkProfile = QuirkProfile::Chip8;
+        bool exited = false;
+        Fault fault = Fault::None;
+        // SUPER-CHIP's RPL user flags, Fx75/Fx85
+        std::array<uint8_t, 16> flagRegisters{};
+        // XO-CHIP sample pattern and playback rate, F002/Fx3A. kept for snapshots, the synth only plays a plain tone
+        std::array<uint8_t, 16> audioPattern{};
+        uint8_t pitch = 64;
+
+        alignas(64) std::array<uint8_t, MEM_SIZE_BYTES> memory{};
+        Display display{};
+    };
+
+    // hit counters for fuzzing, see setCoverage. nothing but bytes so libFuzzer can take it as extra counters
+    struct CoverageMap {
+        // executed instructions by address, addresses past the first 4 KB share counters with the ones below
+        std::array<uint8_t, 4 * 1024> pcs;
+        // executed instructions by op
+        std::array<uint8_t, size_t(Op::Count)> ops;
+    };
 
-    bool shouldExit() const { return false; }
+    Emu(const uint8_t* program, size_t size, QuirkProfile quirks = QuirkProfile::Chip8);
+    // runs the rom with the profile the quirk database has for it, or Chip8 if it isn't known. a forced profile wins
+    static Emu fromRom(const uint8_t* program, size_t size, std::optional<QuirkProfile> forced = std::nullopt);
+    // powers the machine back on with another program, the same as assigning a new Emu but built in place, so nothing
+    // the size of the state goes on the stack and pointers into the display stay valid. the backend, callbacks and
+    // other host settings stay, a checkpoint is dropped
+    void load(const uint8_t* program, size_t size, QuirkProfile quirks = QuirkProfile::Chip8);
+    // the profile fromRom runs the rom with
+    static QuirkProfile profileFor(const uint8_t* program, size_t size, std::optional<QuirkProfile> forced = std::nullopt);
+    // the largest program that fits from PROGRAM_START to the end of the profile's memory
+    static size_t maxProgramSize(QuirkProfile profile) { return size_t(quirksOf(profile).memoryBytes() - PROGRAM_START); }
+    // out of line, the checkpoint is only complete in emu.cpp
+    ~Emu();
+    Emu(Emu&&) noexcept;
+    Emu& operator=(Emu&&) noexcept;
 
-    void tick(KeypadInput keysDown);
-    const Display& getDisplay() { return m_display; }
+    // set once the program ran 00FD, the machine then stays on that instruction
+    bool shouldExit() const { return m_state.exited; }
+    // set instead of running a faulting instruction, the machine then stays on it and runCycles does nothing until
+    // a snapshot or checkpoint is loaded
+    Fault getFault() const { return m_state.fault; }
+    uint16_t getPc() const { return m_state.cpu.pc; }
+
+    // runs however many instructions fit into the wall-clock time since the last call, at most maxCycles. time that
+    // didn't fit carries over to the next call, so capping at cyclesUntilNextFrame keeps keys to frame boundaries
+    void tick(KeypadInput keysDown, uint64_t maxCycles = UINT64_MAX);
+    // forget any wall-clock time accumulated since the last tick, e.g. after running unthrottled
+    void syncWallClock();
+    // the wall-clock time at which tick has n more cycles to run, so a caller can sleep until then
+    chrono::steady_clock::time_point deadlineFor(uint64_t cycles) const {
+        return m_lastTickTime - m_timeElapsedSinceLastInstruction + int64_t(cycles) * INSTRUCTION_DURATION;
+    }
+    // how far tick lets emulated time fall behind after a stall. anything beyond is dropped rather than run in one
+    // burst, which would only make the next tick later still
+    void setMaxCatchUp(chrono::nanoseconds limit) { m_maxCatchUp = limit; }
+    // wall-clock time tick dropped so far
+    chrono::nanoseconds getDroppedTime() const { return m_droppedTime; }
+
+    // advances emulated time by exactly n instructions, ignores pause and wall-clock time
+    void runCycles(uint64_t n, KeypadInput keysDown);
+    // runs until n timer ticks (60 hz frames of emulated time) have elapsed
+    void runFrames(uint64_t n, KeypadInput keysDown);
+    uint64_t cyclesUntilNextFrame() const;
+    // cycles until n more timer ticks have happened
+    uint64_t cyclesUntilFrame(uint64_t n) const;
+    uint64_t getCycleCount() const { return m_state.cpu.cycleCount; }
+    uint64_t getFrameCount() const { return m_state.cpu.frameCount; }
+
+    // serializes the complete machine state into a versioned binary snapshot, see savestate.h
+    void saveState(std::vector<uint8_t>& out) const;
+    // returns false and leaves the machine untouched if the snapshot is malformed or from another version
+    bool loadState(const uint8_t* data, size_t size);
+
+    // the raw machine, e.g. to park it in an arena. unlike a snapshot it is only meaningful to the same build
+    const State& getState() const { return m_state; }
+    // takes over a machine from getState. the decode cache and jit start over, so this costs about as much as
+    // loading a snapshot, resetToCheckpoint is the cheap way back to a known state
+    void setState(const State& state);
+
+    // remembers the machine as it is now for resetToCheckpoint. from here on every memory page and framebuffer row
+    // that gets written is tracked, so a reset only copies back what the run since actually changed rather than
+    // rebuilding the whole machine, cheap enough to run millions of short programs a second from one booted machine
+    void setCheckpoint();
+    // puts the machine back to the last setCheckpoint. backend, profiling, coverage, tracing, callbacks and settings stay
+    void resetToCheckpoint();
+    // overwrites memory from PROGRAM_START with another program, what lies past its end stays as it was. meant for
+    // running a different rom from a checkpoint taken right after boot
+    void loadProgram(const uint8_t* program, size_t size);
+
+    // switches to the interpreter specialized for the profile, takes effect from the next instruction
+    void setQuirkProfile(QuirkProfile profile);
+    QuirkProfile getQuirkProfile() const { return m_state.quirkProfile; }
+
+    void setBackend(Backend backend);
+    Backend getBackend() const { return m_backend; }
+
+    const Display& getDisplay() { return m_state.display; }
 
     void setPause(bool p) { m_pause = p; }
     bool isPaused() const { return m_pause; }
 
-    bool shouldPlaySound() { return m_soundTimer > 0; }
+    bool shouldPlaySound() { return m_state.cpu.soundTimer > 0; }
+    // called whenever the tone starts or stops, with the emulated cycle it happened on
+    using SoundCallback = std::function<void(bool on, uint64_t cycle)>;
+    void setSoundCallback(SoundCallback callback) { m_soundCallback = std::move(callback); }
+
+    // Cxkk draws from a per instance generator, the same seed always replays the same numbers
+    void setRandomSeed(uint64_t seed) { m_state.rng = Rng{seed}; }
+
+    // busy waits on the delay timer or the keypad are recognized and emulated time jumps straight past the
+    // iterations that can't change anything, the machine state after any number of cycles is exactly the same as
+    // without. on by default, profiling turns it off so every instruction is still seen
+    void setIdleSkipping(bool enabled) { m_idleSkipping = enabled; }
+    // cycles that were fast-forwarded rather than executed
+    uint64_t getSkippedCycles() const { return m_skippedCycles; }
+
+    // collects opcode, address, call and draw statistics about the running program. enabling starts a fresh profile
+    // and bypasses the jit so every instruction is seen, disabling drops it
+    void setProfiling(bool enabled);
+    // null while profiling is off
+    const Profiler* getProfiler() const { return m_profiler.get(); }
+
+    // counts every executed instruction into coverage until set back to null. like profiling it bypasses the jit and
+    // idle skipping. the counters wrap and are never cleared here, that's up to the owner
+    void setCoverage(CoverageMap* coverage) { m_coverage = coverage; }
+
+    // records every executed instruction into trace until set back to null, see trace.h. like coverage it bypasses
+    // the jit and idle skipping, profiling and coverage win over it when they are on too
+    void setTrace(TraceWriter* trace) { m_trace = trace; }
 
   private:
 
-    using OpCode = uint16_t;
-    void runOneInstruction(KeypadInput keysDown);
-    OpCode fetchInstruction();
+    // hook policies for the interpreter loop, the disabled one compiles to nothing
+    struct NoProfiling;
+    struct Profiling;
+    struct Coverage;
+    struct Tracing;
+    // runs compiled jit blocks wherever one starts
+    struct NativeBlocks;
+    struct Checkpoint;
 
-    bool m_pause = false;
+    // decodes on first use, the cache entry stays valid until the memory under it is written
+    const Instruction& decodedAt(uint16_t address);
+    const Instruction& fetchInstruction();
+    // runs up to budget instructions, stops early when a key wait starts, returns how many ran
+    template <typename Profile, QuirkProfile Quirks> uint64_t runInstructions(uint64_t budget, KeypadInput keysDown);
+    // the runInstructions instantiations for the current quirk profile
+    using InterpreterFn = uint64_t (Emu::*)(uint64_t budget, KeypadInput keysDown);
+    InterpreterFn m_interpret = nullptr;
+    InterpreterFn m_interpretProfiled = nullptr;
+    InterpreterFn m_interpretCoverage = nullptr;
+    InterpreterFn m_interpretTraced = nullptr;
+    InterpreterFn m_interpretNative = nullptr;
+    void waitForKeypress(KeypadInput keysDown);
+    // whether the loop from start back to the jump at jumpAddress only reads registers, the delay timer and keys.
+    // the interpreter checks this on every short backwards jump and hands over to skipIdleLoop when it holds
+    bool isIdleLoopCandidate(uint16_t start, uint16_t jumpAddress);
+    // runs one iteration of the loop at start on regs, returns how many instructions it took to come back to start
+    // or 0 if it left the loop or ran something that isn't a pure read
+    int simulateIdleIteration(uint16_t start, std::array<uint8_t, 16>& regs, KeypadInput keysDown);
+    // fast-forwards whole iterations of the loop at pc for as long as they can't change anything, returns how many
+    // cycles that skipped
+    uint64_t skipIdleLoop(uint64_t budget, KeypadInput keysDown);
+    // like advanceClock, but ticks the timers on the exact cycle the interpreter would have
+    void skipCycles(uint64_t cycles);
+    void advanceClock(uint64_t cycles = 1);
+    // runs as much of the compiled jit block at pc as the budget allows, returns how many instructions ran, 0 if
+    // nothing is compiled there
+    uint64_t runJitBlock(uint64_t budget, KeypadInput keysDown);
+    // a jit for the current backend and profile
+    std::unique_ptr<Jit> makeJit() const;
+    void tickTimers();
+    // reports a change of shouldPlaySound to the sound callback
+    void updateSound();
+    // all writes to memory go through here so the decode cache stays coherent with self modifying code
+    void writeMemory(uint16_t address, uint8_t value);
+    // marks memory as changed outside writeMemory, drops what was decoded or compiled from it
+    void invalidateMemory(uint16_t first, uint16_t last);
+    // drops everything derived from memory after the state was replaced wholesale
+    void invalidateAll();
 
-    struct KeyWaitInfo {
-        uint8_t m_regIdx = 0;
-        KeypadInput m_keysDownLastTick = 0;
-    };
-    // if this exists we're waiting for a keypress, to be stored in vx
-    std::optional<KeyWaitInfo> m_waitingForKeypressRegIdx;
+    State m_state{};
 
-    std::array<uint8_t, 16> m_regV{};
-    uint16_t m_regI = 0;
-    uint16_t m_pc = 0;
-    uint8_t m_sp = 0;
-    uint8_t m_delayTimer = 0;
-    uint8_t m_soundTimer = 0;
+    // everything below is derived from the state or belongs to the host side, none of it is part of the machine
+    bool m_pause = false;
 
-    static constexpr int MEM_SIZE_BYTES = 4096;
-    std::array<uint8_t, MEM_SIZE_BYTES> m_memory{};
-    std::vector<uint16_t> m_stack{};
+    // one bit per page written since the last checkpoint
+    std::array<uint64_t, PAGES / 64> m_dirtyPages{};
+    // decoded instruction starting at each byte address, filled lazily on first execution
+    std::array<Instruction, MEM_SIZE_BYTES> m_decoded{};
 
     chrono::steady_clock::time_point m_lastTickTime = chrono::steady_clock::now();
-    chrono::nanoseconds m_timeElapsedSinceLastTimerTick = 0ns;
     chrono::nanoseconds m_timeElapsedSinceLastInstruction = 0ns;
+    chrono::nanoseconds m_maxCatchUp = DEFAULT_MAX_CATCH_UP;
+    chrono::nanoseconds m_droppedTime = 0ns;
 
-    // should saving/loading registers to memory increment regI
-    bool m_legacyMemoryIncrement = true;
-    // should shift load vy into vx first
-    bool m_legacyShift = true;
-    // should jump use v0 + _nnn offset (or newer vx + _xnn) if false
-    bool m_legacyJump = true;
+    // runtime copy of the profile's quirks for the code outside the specialized interpreter
+    Quirks m_quirks = QuirkTraits<QuirkProfile::Chip8>::quirks;
 
-    Display m_display{};
+    // last state reported to the sound callback
+    bool m_soundOn = false;
+    SoundCallback m_soundCallback;
+
+    Backend m_backend = Backend::Interpreter;
+    std::unique_ptr<Jit> m_jit;
+
+    std::unique_ptr<Profiler> m_profiler;
+    CoverageMap* m_coverage = nullptr;
+    TraceWriter* m_trace = nullptr;
+    std::unique_ptr<Checkpoint> m_checkpoint;
+
+    bool m_idleSkipping = true;
+    // set by the interpreter when it stopped at the top of a loop worth checking
+    bool m_atIdleLoop = false;
+    uint64_t m_skippedCycles = 0;
 };
+
+const char* to_string(Emu::Fault fault);
+
 } // namespace ez
\ No newline at end of file
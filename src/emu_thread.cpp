@@ -0,0 +1,365 @@
+#include "emu_thread.h"
+#include <fstream>
+
+namespace ez {
+
+// rewind history, at roughly 100 bytes per delta frame this holds several minutes
+static constexpr size_t REWIND_BUDGET_BYTES = 8 * 1024 * 1024;
+static constexpr int REWIND_KEYFRAME_INTERVAL = 60;
+// holding rewind steps back one recorded frame per 60 hz tick
+static constexpr auto REWIND_STEP_INTERVAL = chrono::duration_cast<chrono::nanoseconds>(1s) / Emu::TIMERS_PER_SECOND;
+// how often commands are picked up while nothing is running
+static constexpr auto IDLE_POLL_INTERVAL = chrono::duration_cast<chrono::nanoseconds>(1s) / Emu::TIMERS_PER_SECOND;
+
+// writes <rom>.profile.json and <rom>.trace.json into the working directory
+static void writeProfile(const Emu& emu, const std::filesystem::path& romPath) {
+    const auto profiler = emu.getProfiler();
+    if (!profiler) {
+        return;
+    }
+    const auto stem = romPath.stem().string();
+    auto json = std::ofstream(stem + ".profile.json");
+    profiler->writeJson(json);
+    auto trace = std::ofstream(stem + ".trace.json");
+    profiler->writeChromeTrace(trace, emu.getCycleCount());
+    log_info("Wrote {}.profile.json and {}.trace.json", stem, stem);
+}
+
+// what m_emu holds until the first rom is booted into it
+static constexpr std::array<uint8_t, 1> NO_PROGRAM{};
+
+static std::vector<uint8_t> readRom(const std::filesystem::path& romPath) {
+    const auto romSize = std::filesystem::file_size(romPath);
+    auto is = std::ifstream(romPath, std::ios::binary);
+    auto rom = std::vector<uint8_t>(romSize);
+    is.read(reinterpret_cast<char*>(rom.data()), romSize);
+    return rom;
+}
+
+EmuThread::EmuThread(std::vector<std::filesystem::path> roms, Audio& audio, Settings settings, std::function<void()> onFrame)
+    : m_roms(std::move(roms)), m_audio(audio), m_onFrame(std::move(onFrame)), m_settings(settings),
+      m_emu(NO_PROGRAM.data(), 0), m_rewind(REWIND_BUDGET_BYTES, REWIND_KEYFRAME_INTERVAL) {
+    boot(0, settings.quirks, settings.seed);
+    loadRom(0);
+    if (!m_settings.replay.empty()) {
+        startReplay(m_settings.replay);
+    }
+    m_thread = std::thread([this]() { run(); });
+}
+
+EmuThread::~EmuThread() {
+    m_running.store(false, std::memory_order_relaxed);
+    m_thread.join();
+    writeProfile(m_emu, m_roms[m_romIdx]);
+    stopMovie();
+    m_capture.reset();
+    reportStats();
+}
+
+void EmuThread::run() {
+    m_lastStatsReport = chrono::steady_clock::now();
+    while (m_running.load(std::memory_order_relaxed)) {
+        while (const auto command = m_commands.front()) {
+            handle(*command);
+            m_commands.pop();
+            // a pause, a step or another rom isn't a slow frame
+            m_lastFrameTime.reset();
+        }
+
+        const auto keysDown = frameKeys();
+        if (m_rewinding.load(std::memory_order_relaxed)) {
+            const auto now = chrono::steady_clock::now();
+            if (now - m_lastRewindStep >= REWIND_STEP_INTERVAL && m_rewind.pop(m_snapshot)) {
+                m_emu.loadState(m_snapshot.data(), m_snapshot.size());
+                m_lastRewindStep = now;
+                // the recording carries on from the frame rewound to
+                if (m_recording) {
+                    m_movie->truncate(m_emu.getFrameCount());
+                }
+            }
+            // don't let the time spent rewinding turn into a burst of instructions afterwards
+            m_emu.syncWallClock();
+            m_lastSnapshotFrame = m_emu.getFrameCount();
+            m_lastFrameTime.reset();
+        } else if (m_settings.turbo && !m_emu.isPaused()) {
+            // unthrottled, one emulated frame per pass so commands and keys are still picked up promptly
+            m_emu.runFrames(1, keysDown);
+            recordFrame();
+            m_lastFrameTime.reset();
+        } else {
+            // a movie's keys hold for whole frames, so a tick never runs past the end of one
+            const auto frame = m_emu.getFrameCount();
+            m_emu.tick(keysDown, m_movie ? m_emu.cyclesUntilNextFrame() : UINT64_MAX);
+            if (m_emu.getFrameCount() != frame) {
+                const auto now = chrono::steady_clock::now();
+                if (m_lastFrameTime) {
+                    m_frameTimes.add(now - *m_lastFrameTime);
+                }
+                m_lastFrameTime = now;
+            }
+            recordFrame();
+        }
+        captureFrame();
+        publishFrame();
+        reportFault();
+
+        if (m_settings.statsInterval > 0s && chrono::steady_clock::now() - m_lastStatsReport >= m_settings.statsInterval) {
+            reportStats();
+        }
+
+        const auto wakeup = nextWakeup();
+        if (wakeup > chrono::steady_clock::now()) {
+            std::this_thread::sleep_until(wakeup);
+            m_wakeupLateness.add(chrono::steady_clock::now() - wakeup);
+        }
+    }
+}
+
+chrono::steady_clock::time_point EmuThread::nextWakeup() const {
+    const auto now = chrono::steady_clock::now();
+    if (m_rewinding.load(std::memory_order_relaxed)) {
+        // from now if there was nothing left to rewind to
+        return std::max(m_lastRewindStep, now) + REWIND_STEP_INTERVAL;
+    }
+    if (m_emu.isPaused() || m_emu.shouldExit() || m_emu.getFault() != Emu::Fault::None) {
+        return now + IDLE_POLL_INTERVAL;
+    }
+    if (m_settings.turbo) {
+        return now;
+    }
+    // the display and the timers only change once per frame, running the frame's instructions together at its end
+    // wakes the thread 60 times a second rather than for every instruction. tone changes carry their cycle, so
+    // the audio thread still plays them on the right sample
+    return m_emu.deadlineFor(m_emu.cyclesUntilNextFrame());
+}
+
+void EmuThread::reportStats() {
+    log_info("Emulated frames: {}", m_frameTimes.summary());
+    log_info("Wakeups late by: {}", m_wakeupLateness.summary());
+    if (m_emu.getDroppedTime() > 0ns) {
+        log_info("Dropped {} ms of catch up after stalls", chrono::duration_cast<chrono::milliseconds>(m_emu.getDroppedTime()).count());
+    }
+    m_frameTimes.clear();
+    m_wakeupLateness.clear();
+    m_lastStatsReport = chrono::steady_clock::now();
+}
+
+void EmuThread::handle(Command command) {
+    switch (command) {
+    case Command::TogglePause:
+        m_paused = !m_paused;
+        m_emu.setPause(m_paused);
+        m_emu.syncWallClock();
+        break;
+    case Command::Step:
+        m_paused = true;
+        m_emu.setPause(true);
+        m_emu.runCycles(1, frameKeys());
+        break;
+    case Command::NextRom:
+        writeProfile(m_emu, m_roms[m_romIdx]);
+        stopMovie();
+        m_capture.reset();
+        boot((m_romIdx + 1) % m_roms.size(), m_settings.quirks, m_settings.seed);
+        loadRom((m_romIdx + 1) % m_roms.size());
+        break;
+    case Command::ToggleTurbo:
+        m_settings.turbo = !m_settings.turbo;
+        log_info("Turbo {}", m_settings.turbo ? "on" : "off");
+        m_emu.syncWallClock();
+        break;
+    case Command::ToggleJit:
+        m_settings.backend = m_settings.backend == Emu::Backend::Interpreter ? Emu::Backend::Jit : Emu::Backend::Interpreter;
+        m_emu.setBackend(m_settings.backend);
+        m_settings.backend = m_emu.getBackend();
+        log_info("Jit {}", m_settings.backend == Emu::Backend::Interpreter ? "off" : "on");
+        break;
+    case Command::ToggleProfiling:
+        // stopping writes out what was collected since profiling started
+        writeProfile(m_emu, m_roms[m_romIdx]);
+        m_settings.profiling = !m_settings.profiling;
+        m_emu.setProfiling(m_settings.profiling);
+        log_info("Profiling {}", m_settings.profiling ? "on" : "off");
+        break;
+    case Command::ToggleRecording:
+        if (m_recording) {
+            stopMovie();
+        } else {
+            startRecording();
+        }
+        break;
+    case Command::ToggleCapture:
+        if (m_capture) {
+            m_capture.reset();
+        } else {
+            startCapture();
+        }
+        break;
+    }
+}
+
+void EmuThread::boot(size_t romIdx, std::optional<QuirkProfile> quirks, uint64_t seed) {
+    const auto& romPath = m_roms[romIdx];
+    log_info("Loading rom {}", romPath.c_str());
+    auto rom = readRom(romPath);
+    m_romHash = romHash(rom.data(), rom.size());
+    const auto profile = Emu::profileFor(rom.data(), rom.size(), quirks);
+    if (!quirks && lookupQuirkProfile(rom.data(), rom.size())) {
+        log_info("Rom {:016x} is in the quirk database, using the {} profile", m_romHash, to_string(profile));
+    }
+    const auto maxSize = Emu::maxProgramSize(profile);
+    if (rom.size() > maxSize) {
+        log_warn("Rom {} is {} bytes, only the first {} fit into memory", romPath.string(), rom.size(), maxSize);
+        rom.resize(maxSize);
+    }
+    // in place, an Emu is too big to build on this thread's stack and move in
+    m_emu.load(rom.data(), rom.size(), profile);
+    m_emu.setRandomSeed(seed);
+    // load keeps the host side. a fresh machine has no time left over to catch up on, and loadRom starts a new
+    // profile, the previous rom's was written out before it was booted away
+    m_emu.syncWallClock();
+    m_emu.setProfiling(false);
+}
+
+// sets up a freshly read rom in m_emu
+void EmuThread::loadRom(size_t romIdx) {
+    m_romIdx = romIdx;
+    m_emu.setPause(m_paused);
+    m_emu.setMaxCatchUp(m_settings.maxCatchUp);
+    m_emu.setBackend(m_settings.backend);
+    m_emu.setProfiling(m_settings.profiling);
+    if (m_settings.tracing) {
+        // the old file is unmapped before the new one truncates it, it may be the same one
+        m_trace.reset();
+        m_trace = TraceWriter::create(m_roms[romIdx].stem().string() + ".c8t", m_emu.getQuirkProfile());
+        m_emu.setTrace(m_trace.get());
+    }
+    // tone changes reach the audio thread stamped with the emulated cycle they happened on
+    m_audio.setSoundOn(m_emu.shouldPlaySound(), m_emu.getCycleCount());
+    m_emu.setSoundCallback([this](bool on, uint64_t cycle) { m_audio.setSoundOn(on, cycle); });
+    m_rewind.clear();
+    m_lastSnapshotFrame = m_emu.getFrameCount();
+    m_lastCaptureFrame = m_emu.getFrameCount();
+    m_forcePublish = true;
+    m_faultReported = false;
+}
+
+KeypadInput EmuThread::frameKeys() {
+    const auto keysDown = m_keysDown.load(std::memory_order_relaxed);
+    if (!m_movie) {
+        return keysDown;
+    }
+    const auto frame = m_emu.getFrameCount();
+    if (m_recording) {
+        // a frame's keys are whatever was held when it started
+        while (m_movie->frames() <= frame) {
+            m_movie->push(keysDown);
+        }
+    } else if (frame >= m_movie->frames()) {
+        log_info("Replay finished after {} frames, the keyboard is back in control", m_movie->frames());
+        m_movie.reset();
+        return keysDown;
+    }
+    return m_movie->keysAt(frame);
+}
+
+void EmuThread::startRecording() {
+    stopMovie();
+    // a movie replays from power on, so the rom starts over with the profile it is running with
+    const auto quirks = m_emu.getQuirkProfile();
+    writeProfile(m_emu, m_roms[m_romIdx]);
+    boot(m_romIdx, quirks, m_settings.seed);
+    loadRom(m_romIdx);
+    m_movie = Movie(m_romHash, quirks, m_settings.seed);
+    m_recording = true;
+    log_info("Recording {} from power on", m_roms[m_romIdx].filename().string());
+}
+
+void EmuThread::startReplay(const std::filesystem::path& path) {
+    auto movie = Movie::load(path);
+    if (!movie) {
+        return;
+    }
+    for (size_t romIdx = 0; romIdx < m_roms.size(); ++romIdx) {
+        const auto rom = readRom(m_roms[romIdx]);
+        if (romHash(rom.data(), rom.size()) == movie->romHash()) {
+            stopMovie();
+            boot(romIdx, movie->quirkProfile(), movie->seed());
+            loadRom(romIdx);
+            log_info("Replaying {} frames of {} from {}", movie->frames(), m_roms[romIdx].filename().string(), path.string());
+            m_movie = std::move(movie);
+            m_recording = false;
+            return;
+        }
+    }
+    log_error("None of the roms matches {}, it was recorded on a rom with hash {:016x}", path.string(), movie->romHash());
+}
+
+void EmuThread::stopMovie() {
+    if (m_recording) {
+        const auto path = m_roms[m_romIdx].stem().string() + ".c8m";
+        if (m_movie->save(path)) {
+            log_info("Wrote {} frames to {}", m_movie->frames(), path);
+        }
+    }
+    m_movie.reset();
+    m_recording = false;
+}
+
+void EmuThread::startCapture() {
+    const auto path = m_roms[m_romIdx].stem().string() + FrameCapture::extension(m_settings.captureFormat);
+    m_capture = FrameCapture::open(path, m_settings.captureFormat);
+    if (!m_capture) {
+        return;
+    }
+    m_captureTime = 0;
+    m_lastCaptureFrame = m_emu.getFrameCount();
+    m_capture->push(m_emu.getDisplay(), m_captureTime);
+    log_info("Capturing to {}", path);
+}
+
+void EmuThread::captureFrame() {
+    const auto frame = m_emu.getFrameCount();
+    if (!m_capture || frame == m_lastCaptureFrame) {
+        return;
+    }
+    // the capture follows the screen, a rewind step shows for one frame like it does there
+    m_captureTime += frame > m_lastCaptureFrame ? frame - m_lastCaptureFrame : 1;
+    m_lastCaptureFrame = frame;
+    m_capture->push(m_emu.getDisplay(), m_captureTime);
+}
+
+void EmuThread::reportFault() {
+    if (m_emu.getFault() != Emu::Fault::None && !m_faultReported) {
+        log_error("{} stopped at {:x}: {}", m_roms[m_romIdx].filename().string(), m_emu.getPc(), to_string(m_emu.getFault()));
+        m_faultReported = true;
+    }
+}
+
+void EmuThread::recordFrame() {
+    if (m_emu.getFrameCount() != m_lastSnapshotFrame) {
+        m_emu.saveState(m_snapshot);
+        m_rewind.push(m_snapshot);
+        m_lastSnapshotFrame = m_emu.getFrameCount();
+    }
+}
+
+void EmuThread::publishFrame() {
+    const auto& display = m_emu.getDisplay();
+    if (!m_forcePublish && display.generation() == m_publishedGeneration) {
+        return;
+    }
+    auto& frame = m_frames.back();
+    frame.planes = display.planes();
+    frame.hires = display.isHires();
+    frame.frameCount = m_emu.getFrameCount();
+    m_frames.publish();
+    // one wakeup per frame the render thread hasn't picked up yet is enough
+    if (m_onFrame && !m_framePending.exchange(true, std::memory_order_acq_rel)) {
+        m_onFrame();
+    }
+    m_publishedGeneration = display.generation();
+    m_forcePublish = false;
+}
+
+} // namespace ez
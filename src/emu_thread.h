@@ -0,0 +1,153 @@
+#pragma once
+#include "base.h"
+#include "audio.h"
+#include "capture.h"
+#include "emu.h"
+#include "frame_stats.h"
+#include "movie.h"
+#include "rewind.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
+#include <atomic>
+#include <thread>
+
+namespace ez {
+
+// runs the emulator on its own thread so a slow present or a vsync wait on the render thread never holds up
+// emulation. held keys go over atomics, discrete commands over a queue and finished frames come back through a
+// triple buffer, the emulator itself is only ever touched by its own thread
+class EmuThread {
+  public:
+    struct Frame {
+        Display::Planes planes{};
+        bool hires = false;
+        uint64_t frameCount = 0;
+    };
+
+    enum class Command : uint8_t {
+        TogglePause,
+        // runs a single instruction and pauses
+        Step,
+        NextRom,
+        ToggleTurbo,
+        ToggleJit,
+        ToggleProfiling,
+        // restarts the rom and records a movie from power on, stopping writes <rom>.c8m into the working directory
+        ToggleRecording,
+        // records what is on screen to <rom> plus the capture format's extension in the working directory
+        ToggleCapture,
+    };
+
+    struct Settings {
+        bool turbo = false;
+        Emu::Backend backend = Emu::Backend::Interpreter;
+        bool profiling = false;
+        // overrides the quirk database for every rom
+        std::optional<QuirkProfile> quirks;
+        // for Cxkk, every rom is powered on with it
+        uint64_t seed = 0;
+        // a movie to play back instead of the first rom, on whichever rom it was recorded on
+        std::filesystem::path replay;
+        // see Emu::setMaxCatchUp
+        chrono::nanoseconds maxCatchUp = Emu::DEFAULT_MAX_CATCH_UP;
+        // how often frame time statistics are logged, 0 for only when the thread stops
+        chrono::seconds statsInterval = 0s;
+        FrameCapture::Format captureFormat = FrameCapture::Format::Apng;
+        // records every instruction into <rom>.c8t in the working directory, from each time a rom is loaded
+        bool tracing = false;
+    };
+
+    // starts on the first rom, audio receives the tone changes from the emulation thread. onFrame is called on the
+    // emulation thread when a new frame is ready, so the render thread can sleep until then
+    EmuThread(std::vector<std::filesystem::path> roms, Audio& audio, Settings settings, std::function<void()> onFrame = {});
+    // stops the thread and writes out the profile, movie and capture if they are running
+    ~EmuThread();
+
+    EmuThread(EmuThread&) = delete;
+    EmuThread(EmuThread&&) = delete;
+
+    // render thread only
+    void setKeys(KeypadInput keysDown) { m_keysDown.store(keysDown, std::memory_order_relaxed); }
+    // render thread only, steps back through the history while held
+    void setRewinding(bool held) { m_rewinding.store(held, std::memory_order_relaxed); }
+    // render thread only, false if the queue is full and the command was dropped
+    bool send(Command command) { return m_commands.push(command); }
+
+    // render thread only, picks up the newest finished frame, false if there wasn't a new one
+    bool updateFrame() {
+        // cleared first, a frame published from here on calls onFrame again
+        m_framePending.store(false, std::memory_order_release);
+        return m_frames.update();
+    }
+    const Frame& frame() const { return m_frames.front(); }
+
+  private:
+    void run();
+    // the thread sleeps until then, the end of the current frame while running in real time
+    chrono::steady_clock::time_point nextWakeup() const;
+    void reportStats();
+    void handle(Command command);
+    // reads a rom and powers m_emu back on with it, the quirk database picks the profile unless one is forced
+    void boot(size_t romIdx, std::optional<QuirkProfile> quirks, uint64_t seed);
+    void loadRom(size_t romIdx);
+    // the keys for the emulator, while a movie records or plays they only change on frame boundaries
+    KeypadInput frameKeys();
+    void startRecording();
+    void startReplay(const std::filesystem::path& path);
+    // saves the recording or drops the replay
+    void stopMovie();
+    void startCapture();
+    // queues the display whenever the frame count moved
+    void captureFrame();
+    // takes a rewind snapshot once per emulated frame
+    void recordFrame();
+    void publishFrame();
+    // logs the first fault of each rom, the machine sits on the faulting instruction from then on
+    void reportFault();
+
+    // read only after construction
+    const std::vector<std::filesystem::path> m_roms;
+    Audio& m_audio;
+    const std::function<void()> m_onFrame;
+
+    std::atomic<KeypadInput> m_keysDown = 0;
+    std::atomic<bool> m_rewinding = false;
+    std::atomic<bool> m_running = true;
+    SpscQueue<Command, 64> m_commands;
+    TripleBuffer<Frame> m_frames;
+    // set once onFrame was called, until the render thread picks the frame up
+    std::atomic<bool> m_framePending = false;
+
+    // emulation thread
+    Settings m_settings;
+    size_t m_romIdx = 0;
+    // romHash of the running rom, set by boot
+    uint64_t m_romHash = 0;
+    bool m_paused = false;
+    Emu m_emu;
+    RewindBuffer m_rewind;
+    std::vector<uint8_t> m_snapshot;
+    uint64_t m_lastSnapshotFrame = 0;
+    chrono::steady_clock::time_point m_lastRewindStep;
+    uint64_t m_publishedGeneration = 0;
+    bool m_forcePublish = true;
+    bool m_faultReported = false;
+    // recording when m_recording is set, playing back otherwise
+    std::optional<Movie> m_movie;
+    bool m_recording = false;
+    std::unique_ptr<FrameCapture> m_capture;
+    // frames since the capture started, each rewind step counts as one
+    uint64_t m_captureTime = 0;
+    uint64_t m_lastCaptureFrame = 0;
+    std::unique_ptr<TraceWriter> m_trace;
+    // wall time between emulated frames and how far past its deadline each wakeup came
+    FrameStats m_frameTimes;
+    FrameStats m_wakeupLateness;
+    // unset after anything that interrupts real time pacing
+    std::optional<chrono::steady_clock::time_point> m_lastFrameTime;
+    chrono::steady_clock::time_point m_lastStatsReport;
+
+    std::thread m_thread;
+};
+
+} // namespace ez
@@ -0,0 +1,31 @@
+#include "frame_stats.h"
+#include <cmath>
+
+namespace ez {
+
+void FrameStats::add(chrono::nanoseconds duration) {
+    duration = std::max(duration, 0ns);
+    ++m_buckets[std::min(size_t(duration / BUCKET_WIDTH), BUCKETS - 1)];
+    ++m_count;
+    m_total += duration;
+    m_max = std::max(m_max, duration);
+}
+
+chrono::nanoseconds FrameStats::percentile(double fraction) const {
+    const auto target = uint64_t(std::ceil(fraction * double(m_count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS - 1; ++i) {
+        seen += m_buckets[i];
+        if (seen >= target) {
+            return std::min(int64_t(i + 1) * BUCKET_WIDTH, m_max);
+        }
+    }
+    return m_max;
+}
+
+std::string FrameStats::summary() const {
+    const auto ms = [](chrono::nanoseconds duration) { return chrono::duration<double, std::milli>(duration).count(); };
+    return std::format("{} samples, mean {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms", m_count, ms(mean()), ms(percentile(0.99)), ms(max()));
+}
+
+} // namespace ez
@@ -0,0 +1,32 @@
+#pragma once
+#include "base.h"
+
+namespace ez {
+
+// distribution of frame times in a fixed histogram, cheap enough to feed every frame and summarize at any point
+class FrameStats {
+  public:
+    // resolution of the histogram, anything past the last bucket counts towards it
+    static constexpr auto BUCKET_WIDTH = chrono::nanoseconds(250us);
+    static constexpr size_t BUCKETS = 400;
+
+    void add(chrono::nanoseconds duration);
+    void clear() { *this = FrameStats{}; }
+
+    uint64_t count() const { return m_count; }
+    chrono::nanoseconds mean() const { return m_count == 0 ? 0ns : m_total / int64_t(m_count); }
+    chrono::nanoseconds max() const { return m_max; }
+    // upper edge of the bucket the given fraction of samples falls into, e.g. 0.99 for the 99th percentile
+    chrono::nanoseconds percentile(double fraction) const;
+
+    // sample count, mean, 99th percentile and max in milliseconds, for the log
+    std::string summary() const;
+
+  private:
+    std::array<uint64_t, BUCKETS> m_buckets{};
+    uint64_t m_count = 0;
+    chrono::nanoseconds m_total = 0ns;
+    chrono::nanoseconds m_max = 0ns;
+};
+
+} // namespace ez
@@ -0,0 +1,268 @@
+#include "jit.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define EZ_JIT_SUPPORTED 1
+#include <cerrno>
+#include <sys/mman.h>
+#else
+#define EZ_JIT_SUPPORTED 0
+#endif
+
+namespace ez {
+
+static constexpr size_t CODE_ARENA_SIZE = 256 * 1024;
+static constexpr uint8_t FLAGS_REG = 0xF;
+
+// the generated code follows the SysV calling convention: rdi = V registers, rsi = I, rdx = delay timer,
+// ecx = instruction count. al/eax is the only scratch register so nothing needs saving.
+class Emitter {
+  public:
+    explicit Emitter(std::vector<uint8_t>& out) : m_out(out) {}
+
+    void bytes(std::initializer_list<uint8_t> b) { m_out.insert(m_out.end(), b); }
+
+    void movRegImm(uint8_t reg, uint8_t imm) { bytes({0xC6, 0x47, reg, imm}); }  // mov byte [rdi+reg], imm8
+    void addRegImm(uint8_t reg, uint8_t imm) { bytes({0x80, 0x47, reg, imm}); }  // add byte [rdi+reg], imm8
+    void loadAl(uint8_t reg) { bytes({0x8A, 0x47, reg}); }                       // mov al, [rdi+reg]
+    void storeAl(uint8_t reg) { bytes({0x88, 0x47, reg}); }                      // mov [rdi+reg], al
+    void orRegAl(uint8_t reg) { bytes({0x08, 0x47, reg}); }                      // or [rdi+reg], al
+    void andRegAl(uint8_t reg) { bytes({0x20, 0x47, reg}); }                     // and [rdi+reg], al
+    void xorRegAl(uint8_t reg) { bytes({0x30, 0x47, reg}); }                     // xor [rdi+reg], al
+    void addAlReg(uint8_t reg) { bytes({0x02, 0x47, reg}); }                     // add al, [rdi+reg]
+    void subAlReg(uint8_t reg) { bytes({0x2A, 0x47, reg}); }                     // sub al, [rdi+reg]
+    void shrAl() { bytes({0xD0, 0xE8}); }                                        // shr al, 1
+    void shlAl() { bytes({0xD0, 0xE0}); }                                        // shl al, 1
+    void setFlagsCarry() { bytes({0x0F, 0x92, 0x47, FLAGS_REG}); }               // setc [rdi+15]
+    void setFlagsNoCarry() { bytes({0x0F, 0x93, 0x47, FLAGS_REG}); }             // setnc [rdi+15]
+    void zeroExtendEax(uint8_t reg) { bytes({0x0F, 0xB6, 0x47, reg}); }          // movzx eax, byte [rdi+reg]
+    void mulEax5() { bytes({0x6B, 0xC0, 0x05}); }                                // imul eax, eax, 5
+    void movIImm(uint16_t imm) { bytes({0x66, 0xC7, 0x06, uint8_t(imm), uint8_t(imm >> 8)}); } // mov word [rsi], imm16
+    void addIAx() { bytes({0x66, 0x01, 0x06}); }                                 // add [rsi], ax
+    void storeIAx() { bytes({0x66, 0x89, 0x06}); }                               // mov [rsi], ax
+    void loadAlDelay() { bytes({0x8A, 0x02}); }                                  // mov al, [rdx]
+    void storeAlDelay() { bytes({0x88, 0x02}); }                                 // mov [rdx], al
+    void ret() { bytes({0xC3}); }
+    // dec ecx, jnz +1, ret. lets the caller stop after any instruction without splitting the block
+    void exitWhenCountDone() { bytes({0xFF, 0xC9, 0x75, 0x01, 0xC3}); }
+
+  private:
+    std::vector<uint8_t>& m_out;
+};
+
+// only called for ops Jit::compiles
+static void emitInstruction(Emitter& e, const Instruction& instr, const Quirks& quirks) {
+    switch (instr.op) {
+    case Op::LdImm:
+        e.movRegImm(instr.x, instr.kk);
+        return;
+    case Op::AddImm:
+        e.addRegImm(instr.x, instr.kk);
+        return;
+    case Op::LdReg:
+        e.loadAl(instr.y);
+        e.storeAl(instr.x);
+        return;
+    case Op::Or:
+        e.loadAl(instr.y);
+        e.orRegAl(instr.x);
+        if (quirks.logicResetsVf) {
+            e.movRegImm(FLAGS_REG, 0);
+        }
+        return;
+    case Op::And:
+        e.loadAl(instr.y);
+        e.andRegAl(instr.x);
+        if (quirks.logicResetsVf) {
+            e.movRegImm(FLAGS_REG, 0);
+        }
+        return;
+    case Op::Xor:
+        e.loadAl(instr.y);
+        e.xorRegAl(instr.x);
+        if (quirks.logicResetsVf) {
+            e.movRegImm(FLAGS_REG, 0);
+        }
+        return;
+    case Op::AddReg:
+        e.loadAl(instr.x);
+        e.addAlReg(instr.y);
+        e.storeAl(instr.x);
+        e.setFlagsCarry();
+        return;
+    case Op::Sub:
+        e.loadAl(instr.x);
+        e.subAlReg(instr.y);
+        e.storeAl(instr.x);
+        e.setFlagsNoCarry();
+        return;
+    case Op::Subn:
+        e.loadAl(instr.y);
+        e.subAlReg(instr.x);
+        e.storeAl(instr.x);
+        e.setFlagsNoCarry();
+        return;
+    case Op::Shr:
+        e.loadAl(quirks.shiftVy ? instr.y : instr.x);
+        e.shrAl();
+        e.storeAl(instr.x);
+        e.setFlagsCarry();
+        return;
+    case Op::Shl:
+        e.loadAl(quirks.shiftVy ? instr.y : instr.x);
+        e.shlAl();
+        e.storeAl(instr.x);
+        e.setFlagsCarry();
+        return;
+    case Op::LdI:
+        e.movIImm(instr.nnn);
+        return;
+    case Op::AddI:
+        e.zeroExtendEax(instr.x);
+        e.addIAx();
+        return;
+    case Op::LdFont:
+        e.zeroExtendEax(instr.x);
+        e.mulEax5();
+        e.storeIAx();
+        return;
+    case Op::LdVxDt:
+        e.loadAlDelay();
+        e.storeAl(instr.x);
+        return;
+    case Op::LdDtVx:
+        e.loadAl(instr.x);
+        e.storeAlDelay();
+        return;
+    default:
+        assert(false);
+    }
+}
+
+bool Jit::isSupported() { return EZ_JIT_SUPPORTED; }
+
+Jit::Jit(size_t memorySize, const Quirks& quirks, int minLength)
+    : m_quirks(quirks), m_minLength(minLength), m_blocks(memorySize), m_codeBytes(memorySize) {
+#if EZ_JIT_SUPPORTED
+    void* mem = mmap(nullptr, CODE_ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        log_error("Failed to map jit code arena");
+        return;
+    }
+    m_code = static_cast<uint8_t*>(mem);
+    m_codeSize = CODE_ARENA_SIZE;
+#endif
+}
+
+Jit::~Jit() {
+#if EZ_JIT_SUPPORTED
+    if (m_code) {
+        munmap(m_code, m_codeSize);
+    }
+#endif
+}
+
+void Jit::invalidate(uint16_t first, uint16_t last) {
+    if (first >= m_codeBytes.size()) {
+        return;
+    }
+    const auto end = std::min(size_t(last) + 1, m_codeBytes.size());
+    bool compiledFrom = false;
+    for (auto address = size_t(first); address < end; ++address) {
+        compiledFrom |= m_codeBytes[address];
+        m_codeBytes[address] = false;
+    }
+    if (!compiledFrom) {
+        return;
+    }
+    // blocks are capped in length so only a bounded window of start addresses can cover these bytes
+    const auto firstStart = std::max(0, int(first) - 2 * MAX_BLOCK_LENGTH - 1);
+    for (auto start = size_t(firstStart); start < end; ++start) {
+        auto& block = m_blocks[start];
+        // a block read its instructions plus the terminator that ended it
+        if (block.compiled && start + 2 * block.length + 1 >= size_t(first)) {
+            block = {};
+        }
+    }
+}
+
+void Jit::flush() {
+    std::fill(m_blocks.begin(), m_blocks.end(), Block{});
+    std::fill(m_codeBytes.begin(), m_codeBytes.end(), false);
+    m_codeUsed = 0;
+}
+
+void Jit::disable([[maybe_unused]] const char* protection) {
+#if EZ_JIT_SUPPORTED
+    log_error("Failed to make the jit code arena {}: {}", protection, strerror(errno));
+    flush();
+    munmap(m_code, m_codeSize);
+    m_code = nullptr;
+    m_codeSize = 0;
+#endif
+}
+
+Jit::Block Jit::compile(uint16_t pc, const uint8_t* memory) {
+    const auto decodeAt = [&](size_t addr) { return decode(OpCode((memory[addr] << 8) | memory[addr + 1]), m_quirks); };
+
+    // most blocks are too short to be worth emitting, so they're measured first
+    uint16_t length = 0;
+    bool touchesTimers = false;
+    auto addr = size_t(pc);
+    while (length < MAX_BLOCK_LENGTH && addr + 1 < m_blocks.size()) {
+        const auto op = decodeAt(addr).op;
+        if (!compiles(op)) {
+            break;
+        }
+        touchesTimers |= op == Op::LdVxDt || op == Op::LdDtVx;
+        ++length;
+        addr += 2;
+    }
+    // the terminating instruction was decoded as well, if it changes this block needs recompiling
+    const auto lastByteRead = std::min(addr + 1, m_codeBytes.size() - 1);
+    for (auto i = size_t(pc); i <= lastByteRead; ++i) {
+        m_codeBytes[i] = true;
+    }
+    if (length == 0 || !EZ_JIT_SUPPORTED) {
+        return Block{nullptr, 0, false, true};
+    }
+    // the length still tells the caller what it would have been
+    if (length < m_minLength || !isReady()) {
+        return Block{nullptr, length, touchesTimers, true};
+    }
+
+    auto code = std::vector<uint8_t>{};
+    auto emitter = Emitter(code);
+    for (auto i = 0; i < length; ++i) {
+        emitInstruction(emitter, decodeAt(pc + 2 * i), m_quirks);
+        emitter.exitWhenCountDone();
+    }
+    emitter.ret();
+
+#if EZ_JIT_SUPPORTED
+    if (m_codeUsed + code.size() > m_codeSize) {
+        log_info("Jit code arena full, flushing");
+        flush();
+        for (auto i = size_t(pc); i <= lastByteRead; ++i) {
+            m_codeBytes[i] = true;
+        }
+    }
+    // W^X, the arena is only writable while a block is being copied in. a kernel that refuses either flip, e.g.
+    // SELinux denying execmem, leaves no code that can run, every block is dropped and nothing is compiled again
+    const auto dst = m_code + m_codeUsed;
+    if (mprotect(m_code, m_codeSize, PROT_READ | PROT_WRITE) != 0) {
+        disable("writable");
+        return Block{nullptr, length, touchesTimers, true};
+    }
+    memcpy(dst, code.data(), code.size());
+    if (mprotect(m_code, m_codeSize, PROT_READ | PROT_EXEC) != 0) {
+        disable("executable");
+        return Block{nullptr, length, touchesTimers, true};
+    }
+    m_codeUsed += code.size();
+    return Block{reinterpret_cast<BlockFn>(dst), length, touchesTimers, true};
+#else
+    return Block{nullptr, 0, false, true};
+#endif
+}
+
+} // namespace ez
\ No newline at end of file
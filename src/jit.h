@@ -0,0 +1,95 @@
+#pragma once
+#include "base.h"
+#include "decode.h"
+#include "quirks.h"
+
+namespace ez {
+
+// translates straight-line runs of register/timer opcodes into native x86-64, anything that touches the pc, memory,
+// the display, the keypad or the sound timer ends the block and is left for the interpreter to run
+class Jit {
+  public:
+    // runs the first count instructions of the block, count must be between 1 and the block length
+    using BlockFn = void (*)(uint8_t* regV, uint16_t* regI, uint8_t* delayTimer, uint32_t count);
+
+    struct Block {
+        // null if the block is shorter than the minimum the jit was created with, those aren't worth calling
+        BlockFn fn = nullptr;
+        // number of instructions, 0 if the instruction at this address can't start a block
+        uint16_t length = 0;
+        // reads or writes the delay timer, such a block must not run across a timer tick
+        bool touchesTimers = false;
+        bool compiled = false;
+    };
+
+    static constexpr int MAX_BLOCK_LENGTH = 64;
+
+    // true if this build can emit and run native code
+    static bool isSupported();
+    // whether op can be part of a block, anything else ends one
+    static constexpr bool compiles(Op op) {
+        switch (op) {
+        case Op::LdImm:
+        case Op::AddImm:
+        case Op::LdReg:
+        case Op::Or:
+        case Op::And:
+        case Op::Xor:
+        case Op::AddReg:
+        case Op::Sub:
+        case Op::Subn:
+        case Op::Shr:
+        case Op::Shl:
+        case Op::LdI:
+        case Op::AddI:
+        case Op::LdFont:
+        case Op::LdVxDt:
+        case Op::LdDtVx:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // blocks shorter than minLength are only measured, no code is emitted for them
+    Jit(size_t memorySize, const Quirks& quirks, int minLength = 1);
+    ~Jit();
+    // false if the code arena couldn't be mapped, or the kernel later refused to make it writable or executable.
+    // nothing is compiled then and every block comes back without code
+    bool isReady() const { return m_code != nullptr; }
+
+    Jit(Jit&) = delete;
+    Jit(Jit&&) = delete;
+
+    // returns the block starting at pc, compiling it from memory on first use. pc has to be inside memorySize.
+    // inline, Emu looks up a block for every compilable instruction it decodes
+    const Block& lookup(uint16_t pc, const uint8_t* memory) {
+        assert(pc < m_blocks.size());
+        auto& block = m_blocks[pc];
+        if (!block.compiled) {
+            block = compile(pc, memory);
+        }
+        return block;
+    }
+    // drops every block that was compiled from any byte in [first, last]
+    void invalidate(uint16_t first, uint16_t last);
+    void flush();
+
+  private:
+    Block compile(uint16_t pc, const uint8_t* memory);
+    // logs why, drops every block and unmaps the arena
+    void disable(const char* protection);
+
+    Quirks m_quirks;
+    int m_minLength = 1;
+
+    std::vector<Block> m_blocks;
+    // set for every byte some compiled block was translated from, lets invalidate skip plain data writes
+    std::vector<bool> m_codeBytes;
+
+    uint8_t* m_code = nullptr;
+    size_t m_codeSize = 0;
+    size_t m_codeUsed = 0;
+};
+
+} // namespace ez
\ No newline at end of file
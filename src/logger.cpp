@@ -0,0 +1,568 @@
+#include "logger.h"
+#include "base.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <variant>
+
+namespace ez::logging {
+
+namespace {
+
+constexpr size_t RING_BYTES = 64 * 1024;
+// how often the background thread looks for new messages when nobody asks it to flush. the interval doubles up to
+// the maximum while nothing is logged, so an idle process isn't woken 200 times a second for it
+constexpr auto POLL_INTERVAL = 5ms;
+constexpr auto MAX_POLL_INTERVAL = 40ms;
+
+// messages a single call site may log per window before the rest are counted and dropped
+constexpr uint32_t RATE_LIMIT_MESSAGES = 20;
+constexpr int64_t RATE_LIMIT_WINDOW_NS = 1'000'000'000;
+constexpr size_t RATE_LIMIT_SLOTS = 64;
+
+// what setSink installed. silent is read on every log call, the sink only when lines are written out
+std::atomic<bool> g_silent = false;
+std::mutex g_sinkMutex;
+Sink g_sink;
+
+constexpr char BINARY_MAGIC[4] = {'C', '8', 'L', 'G'};
+constexpr uint32_t BINARY_VERSION = 1;
+enum class BinaryKind : uint8_t { Site = 1, Message = 2, Dropped = 3 };
+
+// wait free ring of variable sized records for one producer and one consumer. every record starts with its uint16
+// size so the consumer can pull it back out in one piece
+class ByteRing {
+  public:
+    bool push(const uint8_t* data, size_t size) {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (RING_BYTES - (tail - m_headCache) < size) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (RING_BYTES - (tail - m_headCache) < size) {
+                return false;
+            }
+        }
+        copyIn(tail, data, size);
+        m_tail.store(tail + size, std::memory_order_release);
+        return true;
+    }
+
+    // copies the oldest record into out, returns its size or 0 if the ring is empty
+    size_t pop(uint8_t* out) {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return 0;
+        }
+        uint16_t size = 0;
+        copyOut(head, reinterpret_cast<uint8_t*>(&size), sizeof(size));
+        copyOut(head, out, size);
+        m_head.store(head + size, std::memory_order_release);
+        return size;
+    }
+
+  private:
+    void copyIn(size_t pos, const uint8_t* data, size_t size) {
+        const auto offset = pos % RING_BYTES;
+        const auto first = std::min(size, RING_BYTES - offset);
+        memcpy(m_bytes.data() + offset, data, first);
+        memcpy(m_bytes.data(), data + first, size - first);
+    }
+    void copyOut(size_t pos, uint8_t* out, size_t size) const {
+        const auto offset = pos % RING_BYTES;
+        const auto first = std::min(size, RING_BYTES - offset);
+        memcpy(out, m_bytes.data() + offset, first);
+        memcpy(out + first, m_bytes.data(), size - first);
+    }
+
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+    size_t m_headCache = 0;
+    alignas(64) std::array<uint8_t, RING_BYTES> m_bytes;
+};
+
+struct RateSlot {
+    const char* format = nullptr;
+    uint32_t line = 0;
+    uint32_t count = 0;
+    uint32_t suppressed = 0;
+    int64_t windowStart = 0;
+};
+
+// everything one logging thread owns. the rate limit slots are only touched by that thread
+struct ThreadLog {
+    ByteRing ring;
+    std::atomic<uint64_t> dropped = 0;
+    std::array<RateSlot, RATE_LIMIT_SLOTS> rates;
+    // set when the thread exits, nothing is pushed after that and the log is freed once it's drained
+    std::atomic<bool> retired = false;
+};
+
+using ArgValue = std::variant<int64_t, uint64_t, double, bool, char, std::string_view>;
+
+// reads the encoded arguments back, stops early on anything truncated
+std::vector<ArgValue> decodeArgs(const uint8_t* data, size_t size, size_t count) {
+    auto args = std::vector<ArgValue>{};
+    size_t pos = 0;
+    const auto read = [&](auto& value) {
+        if (pos + sizeof(value) > size) {
+            return false;
+        }
+        memcpy(&value, data + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    };
+    for (size_t i = 0; i < count && pos < size; ++i) {
+        const auto type = ArgType(data[pos++]);
+        switch (type) {
+        case ArgType::Int: {
+            int64_t v = 0;
+            if (!read(v)) {
+                return args;
+            }
+            args.emplace_back(v);
+            break;
+        }
+        case ArgType::UInt: {
+            uint64_t v = 0;
+            if (!read(v)) {
+                return args;
+            }
+            args.emplace_back(v);
+            break;
+        }
+        case ArgType::Float: {
+            double v = 0;
+            if (!read(v)) {
+                return args;
+            }
+            args.emplace_back(v);
+            break;
+        }
+        case ArgType::Bool: {
+            uint8_t v = 0;
+            if (!read(v)) {
+                return args;
+            }
+            args.emplace_back(v != 0);
+            break;
+        }
+        case ArgType::Char: {
+            char v = 0;
+            if (!read(v)) {
+                return args;
+            }
+            args.emplace_back(v);
+            break;
+        }
+        case ArgType::String: {
+            uint16_t length = 0;
+            if (!read(length) || pos + length > size) {
+                return args;
+            }
+            args.emplace_back(std::string_view(reinterpret_cast<const char*>(data + pos), length));
+            pos += length;
+            break;
+        }
+        default:
+            return args;
+        }
+    }
+    return args;
+}
+
+// std::format needs its argument types at compile time, so replacement fields are formatted one at a time with the
+// type each argument was recorded as. handles {} {:spec} {n:spec} and escaped braces, which is all the code uses
+std::string formatMessage(std::string_view format, const std::vector<ArgValue>& args) {
+    auto out = std::string{};
+    size_t nextArg = 0;
+    for (size_t i = 0; i < format.size(); ++i) {
+        const auto c = format[i];
+        if ((c == '{' || c == '}') && i + 1 < format.size() && format[i + 1] == c) {
+            out += c;
+            ++i;
+            continue;
+        }
+        if (c != '{') {
+            out += c;
+            continue;
+        }
+        const auto end = format.find('}', i);
+        if (end == std::string_view::npos) {
+            out += format.substr(i);
+            break;
+        }
+        auto field = format.substr(i + 1, end - i - 1);
+        i = end;
+
+        auto index = nextArg++;
+        const auto colon = field.find(':');
+        const auto indexText = field.substr(0, colon);
+        if (!indexText.empty()) {
+            index = 0;
+            for (const auto digit : indexText) {
+                index = index * 10 + size_t(digit - '0');
+            }
+        }
+        if (index >= args.size()) {
+            out += "{?}";
+            continue;
+        }
+        const auto spec = std::string("{") + std::string(colon == std::string_view::npos ? "" : field.substr(colon)) + "}";
+        try {
+            std::visit([&](const auto& value) { out += std::vformat(spec, std::make_format_args(value)); }, args[index]);
+        } catch (const std::format_error&) {
+            out += "{?}";
+        }
+    }
+    return out;
+}
+
+std::string formatLine(LogLevel level, int64_t timestampNs, std::string_view file, uint32_t line, std::string_view function,
+                       std::string_view message, uint32_t suppressed) {
+    const auto time = chrono::system_clock::time_point(chrono::duration_cast<chrono::system_clock::duration>(chrono::nanoseconds(timestampNs)));
+    auto text = std::format("[{}] {} {}:{} {} | {}", to_string(level), to_string(time),
+                            std::filesystem::path(file).filename().string(), line, function, message);
+    if (suppressed > 0) {
+        text += std::format(" ({} similar messages suppressed)", suppressed);
+    }
+    text += '\n';
+    return text;
+}
+
+template <typename T> void writeBinary(std::ostream& os, const T& value) { os.write(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+void writeBinaryString(std::ostream& os, std::string_view s) {
+    const auto length = uint32_t(s.size());
+    writeBinary(os, length);
+    os.write(s.data(), std::streamsize(s.size()));
+}
+
+template <typename T> bool readBinary(std::istream& is, T& value) {
+    return bool(is.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+bool readBinaryString(std::istream& is, std::string& s) {
+    uint32_t length = 0;
+    if (!readBinary(is, length) || length > (1u << 20)) {
+        return false;
+    }
+    s.resize(length);
+    return bool(is.read(s.data(), length));
+}
+
+class Logger {
+  public:
+    static Logger& instance() {
+        static auto logger = Logger{};
+        return logger;
+    }
+
+    ~Logger() {
+        {
+            auto lock = std::lock_guard(m_wakeMutex);
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+    }
+
+    ThreadLog& threadLog() {
+        struct Owner {
+            ThreadLog* log = nullptr;
+            ~Owner() {
+                if (log) {
+                    log->retired.store(true, std::memory_order_release);
+                    log = nullptr;
+                }
+            }
+        };
+        thread_local Owner owner;
+        if (!owner.log) {
+            // owned by the logger rather than the thread, so messages a thread logs just before it exits still
+            // get written. drain frees it after that
+            auto lock = std::lock_guard(m_threadsMutex);
+            owner.log = m_threads.emplace_back(std::make_unique<ThreadLog>()).get();
+        }
+        return *owner.log;
+    }
+
+    // writes out everything currently queued, safe to call from any thread
+    // returns whether there was anything to write
+    bool drain() {
+        auto lock = std::lock_guard(m_drainMutex);
+        auto threads = std::vector<ThreadLog*>{};
+        {
+            auto threadsLock = std::lock_guard(m_threadsMutex);
+            for (const auto& thread : m_threads) {
+                threads.push_back(thread.get());
+            }
+        }
+
+        struct Entry {
+            int64_t timestampNs;
+            LogLevel level;
+            std::string text;
+        };
+        auto entries = std::vector<Entry>{};
+        auto record = std::array<uint8_t, MAX_RECORD_BYTES>{};
+        uint64_t dropped = 0;
+        auto finished = std::vector<ThreadLog*>{};
+        for (const auto thread : threads) {
+            // checked before popping, whatever the thread pushed before it exited is then certain to be drained below
+            if (thread->retired.load(std::memory_order_acquire)) {
+                finished.push_back(thread);
+            }
+            while (const auto size = thread->ring.pop(record.data())) {
+                auto header = RecordHeader{};
+                memcpy(&header, record.data(), sizeof(header));
+                const auto argData = record.data() + sizeof(header);
+                const auto argSize = size - sizeof(header);
+                const auto format = std::string_view(header.format, header.formatSize);
+                const auto message = formatMessage(format, decodeArgs(argData, argSize, header.argCount));
+                entries.push_back({header.timestampNs, header.level, formatLine(header.level, header.timestampNs, header.file, header.line,
+                                                                  header.function, message, header.suppressed)});
+                if (m_binary) {
+                    writeBinaryMessage(header, argData, argSize);
+                }
+            }
+            dropped += thread->dropped.exchange(0, std::memory_order_relaxed);
+        }
+        if (!finished.empty()) {
+            auto threadsLock = std::lock_guard(m_threadsMutex);
+            std::erase_if(m_threads, [&](const auto& thread) { return std::ranges::find(finished, thread.get()) != finished.end(); });
+        }
+        if (dropped > 0) {
+            const auto now = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+            entries.push_back({now, LogLevel::WARN, formatLine(LogLevel::WARN, now, __FILE__, __LINE__, __func__,
+                                               std::format("dropped {} log messages, the log ring was full", dropped), 0)});
+            if (m_binary) {
+                writeBinary(m_binary, BinaryKind::Dropped);
+                writeBinary(m_binary, dropped);
+            }
+        }
+        if (entries.empty()) {
+            return false;
+        }
+
+        // each ring is in order already, this interleaves messages from different threads
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.timestampNs < b.timestampNs; });
+        {
+            auto sinkLock = std::lock_guard(g_sinkMutex);
+            for (const auto& entry : entries) {
+                if (g_sink) {
+                    g_sink(entry.level, std::string_view(entry.text).substr(0, entry.text.size() - 1));
+                } else if (!g_silent.load(std::memory_order_relaxed)) {
+                    std::cout << entry.text;
+                } else if (entry.level == LogLevel::CRITICAL) {
+                    std::cerr << entry.text;
+                }
+            }
+        }
+        std::cout.flush();
+        if (m_binary) {
+            m_binary.flush();
+        }
+        return true;
+    }
+
+    bool openBinary(const std::filesystem::path& path) {
+        auto lock = std::lock_guard(m_drainMutex);
+        m_binary = std::ofstream(path, std::ios::binary);
+        if (!m_binary) {
+            return false;
+        }
+        m_sites.clear();
+        m_binary.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        writeBinary(m_binary, BINARY_VERSION);
+        return true;
+    }
+
+  private:
+    Logger() { m_thread = std::thread([this]() { run(); }); }
+
+    void run() {
+        auto lock = std::unique_lock(m_wakeMutex);
+        auto interval = chrono::nanoseconds(POLL_INTERVAL);
+        while (!m_stopping) {
+            lock.unlock();
+            const bool wrote = drain();
+            lock.lock();
+            interval = wrote ? POLL_INTERVAL : std::min<chrono::nanoseconds>(interval * 2, MAX_POLL_INTERVAL);
+            m_wake.wait_for(lock, interval, [this]() { return m_stopping; });
+        }
+        lock.unlock();
+        drain();
+    }
+
+    // call sites are written once with their strings, messages refer to them by index
+    void writeBinaryMessage(const RecordHeader& header, const uint8_t* args, size_t argSize) {
+        const auto key = std::tuple(header.format, header.file, header.line);
+        auto site = m_sites.find(key);
+        if (site == m_sites.end()) {
+            site = m_sites.emplace(key, uint32_t(m_sites.size())).first;
+            writeBinary(m_binary, BinaryKind::Site);
+            writeBinary(m_binary, site->second);
+            writeBinaryString(m_binary, std::string_view(header.format, header.formatSize));
+            writeBinaryString(m_binary, header.file);
+            writeBinary(m_binary, header.line);
+            writeBinaryString(m_binary, header.function);
+        }
+        writeBinary(m_binary, BinaryKind::Message);
+        writeBinary(m_binary, site->second);
+        writeBinary(m_binary, header.level);
+        writeBinary(m_binary, header.timestampNs);
+        writeBinary(m_binary, header.suppressed);
+        writeBinary(m_binary, header.argCount);
+        writeBinary(m_binary, uint16_t(argSize));
+        m_binary.write(reinterpret_cast<const char*>(args), std::streamsize(argSize));
+    }
+
+    std::mutex m_threadsMutex;
+    std::vector<std::unique_ptr<ThreadLog>> m_threads;
+
+    // only one thread at a time may consume from the rings
+    std::mutex m_drainMutex;
+    std::ofstream m_binary;
+    std::map<std::tuple<const char*, const char*, uint32_t>, uint32_t> m_sites;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+} // namespace
+
+const uint8_t* RecordWriter::finish(size_t& size) {
+    m_header.size = uint16_t(m_size);
+    memcpy(m_bytes.data(), &m_header, sizeof(m_header));
+    size = m_size;
+    return m_bytes.data();
+}
+
+void RecordWriter::putString(std::string_view s) {
+    constexpr auto overhead = 1 + sizeof(uint16_t);
+    if (m_size + overhead > m_bytes.size()) {
+        return;
+    }
+    const auto length = uint16_t(std::min(s.size(), m_bytes.size() - m_size - overhead));
+    m_bytes[m_size++] = uint8_t(ArgType::String);
+    memcpy(m_bytes.data() + m_size, &length, sizeof(length));
+    m_size += sizeof(length);
+    memcpy(m_bytes.data() + m_size, s.data(), length);
+    m_size += length;
+    ++m_header.argCount;
+}
+
+bool admit(const char* format, uint32_t line, int64_t timestampNs, uint32_t& suppressed) {
+    auto& rates = Logger::instance().threadLog().rates;
+    // direct mapped on the call site, a collision just restarts the window for the newcomer
+    const auto hash = (reinterpret_cast<uintptr_t>(format) >> 3) ^ (uintptr_t(line) * 0x9e3779b9u);
+    auto& slot = rates[hash % RATE_LIMIT_SLOTS];
+    if (slot.format != format || slot.line != line) {
+        slot = RateSlot{format, line, 0, 0, timestampNs};
+    }
+    if (timestampNs - slot.windowStart >= RATE_LIMIT_WINDOW_NS) {
+        slot.windowStart = timestampNs;
+        slot.count = 0;
+    }
+    if (slot.count >= RATE_LIMIT_MESSAGES) {
+        ++slot.suppressed;
+        return false;
+    }
+    ++slot.count;
+    suppressed = std::exchange(slot.suppressed, 0);
+    return true;
+}
+
+void submit(RecordWriter& record) {
+    auto& log = Logger::instance().threadLog();
+    size_t size = 0;
+    const auto data = record.finish(size);
+    if (!log.ring.push(data, size)) {
+        log.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void flush() { Logger::instance().drain(); }
+
+bool setBinaryFile(const std::filesystem::path& path) { return Logger::instance().openBinary(path); }
+
+void setSink(Sink sink) {
+    auto lock = std::lock_guard(g_sinkMutex);
+    g_silent.store(!sink, std::memory_order_relaxed);
+    g_sink = std::move(sink);
+}
+
+bool silenced() { return g_silent.load(std::memory_order_relaxed); }
+
+bool decodeBinaryLog(std::istream& in, std::ostream& out) {
+    char magic[sizeof(BINARY_MAGIC)] = {};
+    uint32_t version = 0;
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), BINARY_MAGIC) || !readBinary(in, version) ||
+        version != BINARY_VERSION) {
+        return false;
+    }
+
+    struct Site {
+        std::string format;
+        std::string file;
+        uint32_t line = 0;
+        std::string function;
+    };
+    auto sites = std::vector<Site>{};
+    auto args = std::vector<uint8_t>{};
+    BinaryKind kind{};
+    while (readBinary(in, kind)) {
+        switch (kind) {
+        case BinaryKind::Site: {
+            uint32_t id = 0;
+            auto site = Site{};
+            if (!readBinary(in, id) || id != sites.size() || !readBinaryString(in, site.format) || !readBinaryString(in, site.file) ||
+                !readBinary(in, site.line) || !readBinaryString(in, site.function)) {
+                return false;
+            }
+            sites.push_back(std::move(site));
+            break;
+        }
+        case BinaryKind::Message: {
+            uint32_t id = 0;
+            auto level = LogLevel::INFO;
+            int64_t timestampNs = 0;
+            uint32_t suppressed = 0;
+            uint8_t argCount = 0;
+            uint16_t argSize = 0;
+            if (!readBinary(in, id) || id >= sites.size() || !readBinary(in, level) || !readBinary(in, timestampNs) ||
+                !readBinary(in, suppressed) || !readBinary(in, argCount) || !readBinary(in, argSize)) {
+                return false;
+            }
+            args.resize(argSize);
+            if (!in.read(reinterpret_cast<char*>(args.data()), argSize)) {
+                return false;
+            }
+            const auto& site = sites[id];
+            out << formatLine(level, timestampNs, site.file, site.line, site.function,
+                              formatMessage(site.format, decodeArgs(args.data(), args.size(), argCount)), suppressed);
+            break;
+        }
+        case BinaryKind::Dropped: {
+            uint64_t dropped = 0;
+            if (!readBinary(in, dropped)) {
+                return false;
+            }
+            out << std::format("[WARN] {} log messages were dropped here\n", dropped);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return in.eof();
+}
+
+} // namespace ez::logging
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// messages below this level are compiled out entirely, 0 = INFO, 1 = WARN, 2 = ERROR. CRITICAL always gets through
+#ifndef EZ_LOG_MIN_LEVEL
+#define EZ_LOG_MIN_LEVEL 0
+#endif
+
+namespace ez {
+
+enum class LogLevel : uint8_t { INFO, WARN, ERROR, CRITICAL };
+
+// the machinery behind log_info and friends. a call encodes its arguments into a per thread lock free ring, formatting
+// and output happen on a background thread. nothing on the calling side allocates, locks or touches the console
+namespace logging {
+
+enum class ArgType : uint8_t { Int, UInt, Float, Bool, Char, String };
+
+// biggest encoded message, longer string arguments are truncated to fit
+inline constexpr size_t MAX_RECORD_BYTES = 512;
+
+// a log format string. the logger thread reads it after the call has returned and the rate limit keys on its address,
+// so only string literals convert to it, anything built at runtime fails to compile
+class Format {
+  public:
+    template <size_t N> consteval Format(const char (&literal)[N]) : m_text(literal), m_size(uint32_t(N - 1)) {}
+
+    const char* data() const { return m_text; }
+    uint32_t size() const { return m_size; }
+
+  private:
+    const char* m_text;
+    uint32_t m_size;
+};
+
+// fixed fields at the start of every record in a thread's ring
+struct RecordHeader {
+    uint16_t size = 0;
+    LogLevel level = LogLevel::INFO;
+    uint8_t argCount = 0;
+    // messages from the same call site dropped by the rate limit since the last one that got through
+    uint32_t suppressed = 0;
+    int64_t timestampNs = 0;
+    // all of these point at string literals, they stay valid for the life of the program
+    const char* format = nullptr;
+    const char* file = nullptr;
+    const char* function = nullptr;
+    uint32_t formatSize = 0;
+    uint32_t line = 0;
+};
+
+// encodes one message into a stack buffer
+class RecordWriter {
+  public:
+    RecordWriter() { m_size = sizeof(RecordHeader); }
+
+    RecordHeader& header() { return m_header; }
+
+    template <typename T> void arg(const T& value) {
+        using D = std::decay_t<T>;
+        if constexpr (std::is_same_v<D, bool>) {
+            put(ArgType::Bool, uint8_t(value));
+        } else if constexpr (std::is_same_v<D, char>) {
+            put(ArgType::Char, value);
+        } else if constexpr (std::is_enum_v<D>) {
+            arg(std::underlying_type_t<D>(value));
+        } else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>) {
+            put(ArgType::Int, int64_t(value));
+        } else if constexpr (std::is_integral_v<D>) {
+            put(ArgType::UInt, uint64_t(value));
+        } else if constexpr (std::is_floating_point_v<D>) {
+            put(ArgType::Float, double(value));
+        } else if constexpr (std::is_convertible_v<const D&, std::string_view>) {
+            putString(std::string_view(value));
+        } else {
+            static_assert(sizeof(D) == 0, "log arguments must be numbers, bools, chars or strings");
+        }
+    }
+
+    // finishes the header, returns the encoded record
+    const uint8_t* finish(size_t& size);
+
+  private:
+    template <typename T> void put(ArgType type, const T& value) {
+        if (m_size + 1 + sizeof(T) > m_bytes.size()) {
+            return;
+        }
+        m_bytes[m_size++] = uint8_t(type);
+        memcpy(m_bytes.data() + m_size, &value, sizeof(T));
+        m_size += sizeof(T);
+        ++m_header.argCount;
+    }
+    void putString(std::string_view s);
+
+    RecordHeader m_header{};
+    std::array<uint8_t, MAX_RECORD_BYTES> m_bytes;
+    size_t m_size = 0;
+};
+
+// per call site rate limit, false if the message should be dropped. suppressed returns how many were dropped since
+// the last message that got through
+bool admit(const char* format, uint32_t line, int64_t timestampNs, uint32_t& suppressed);
+// hands a record to the background thread, drops it if this thread's ring is full
+void submit(RecordWriter& record);
+
+// blocks until everything logged so far has been written out
+void flush();
+// additionally writes every message to a compact binary file, decode it with chip8-logdecode
+bool setBinaryFile(const std::filesystem::path& path);
+// turns a binary log back into text, returns false if the file is malformed
+bool decodeBinaryLog(std::istream& in, std::ostream& out);
+
+// receives every finished line, without its newline, in place of stdout
+using Sink = std::function<void(LogLevel level, std::string_view line)>;
+// routes output to sink. it's called on the logger thread, or on whichever thread flushes, never on two at once. an
+// empty sink turns logging off, messages are then dropped before they are encoded and don't start the logger thread.
+// CRITICAL still goes to stderr, the process is about to abort
+void setSink(Sink sink);
+// whether setSink turned logging off
+bool silenced();
+
+template <LogLevel level, typename... TArgs>
+void write(Format format, const std::source_location& location, const TArgs&... args) {
+    const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    uint32_t suppressed = 0;
+    if (level != LogLevel::CRITICAL && (silenced() || !admit(format.data(), location.line(), now, suppressed))) {
+        return;
+    }
+    auto record = RecordWriter{};
+    auto& header = record.header();
+    header.level = level;
+    header.suppressed = suppressed;
+    header.timestampNs = now;
+    header.format = format.data();
+    header.formatSize = format.size();
+    header.file = location.file_name();
+    header.function = location.function_name();
+    header.line = location.line();
+    (record.arg(args), ...);
+    submit(record);
+}
+
+} // namespace logging
+} // namespace ez
@@ -4,6 +4,10 @@
 #include <fstream>
 #include <iostream>
 #include "audio.h"
+#include "render.h"
+#include "emu_thread.h"
+#include "frame_stats.h"
+#include <bit>
 
 namespace ez {
 
@@ -13,6 +17,8 @@ static void sdl_assert(int rc) {
     }
 }
 
+static bool is_key_held(SDL_KeyCode keycode) { return SDL_GetKeyboardState(nullptr)[SDL_GetScancodeFromKey(keycode)]; }
+
 static KeypadInput get_keys() {
     KeypadInput keysDown = 0;
     auto keystateSize = 0;
@@ -37,8 +43,7 @@ static KeypadInput get_keys() {
     return keysDown;
 }
 
-static void runApplication() {
-    size_t romIdx = 0;
+static void runApplication(EmuThread::Settings settings, int audioBufferSamples) {
     std::vector<std::filesystem::path> roms;
     for (const auto& file : std::filesystem::directory_iterator("./roms")) {
         const auto& path = file.path();
@@ -50,58 +55,75 @@ static void runApplication() {
     std::sort(roms.begin(), roms.end());
     assert(roms.size() > 0);
 
-    bool paused = false;
-    const auto loadRom = [&](const std::filesystem::path& romPath) {
-        log_info("Loading rom {}", romPath.c_str());
-        const auto romSize = std::filesystem::file_size(romPath);
-        auto is = std::ifstream(romPath, std::ios::binary);
-        auto rom = std::vector<uint8_t>(romSize);
-        is.read(reinterpret_cast<char*>(rom.data()), romSize);
-
-        auto emu = Emu(rom.data(), rom.size());
-        emu.setPause(paused);
-        return emu;
-    };
-
-    auto emu = loadRom(roms.front());
-
     sdl_assert(SDL_Init(SDL_INIT_EVERYTHING));
     // todo, raii
     auto window = SDL_CreateWindow("Chip8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1000, 500, SDL_WINDOW_RESIZABLE );
-    auto renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // waiting on vsync here only holds up this thread, the emulator keeps its own pace
+    auto renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     // SDL_PIXELFORMAT_RGB888 is 4 bytes per pixel - alpha is always 255
-    const auto bytesPerPx = 4;
-    auto texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, Display::WIDTH_PX, Display::HEIGHT_PX);
-    auto synth = Audio();
+    // sized for hires, a lores frame only fills the top left corner
+    auto texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, Display::HIRES_WIDTH_PX, Display::HIRES_HEIGHT_PX);
+    auto audio = Audio(Emu::INSTRUCTIONS_PER_SECOND, audioBufferSamples);
 
     if (!texture) {
         log_error("{}", SDL_GetError());
     }
 
+    // the emulation thread posts this whenever it has a new frame, so the loop below can block on events alone
+    const auto frameEvent = SDL_RegisterEvents(1);
+    auto emuThread = EmuThread(std::move(roms), audio, settings, [frameEvent]() {
+        auto event = SDL_Event{};
+        event.type = frameEvent;
+        SDL_PushEvent(&event);
+    });
+    auto presentTimes = FrameStats{};
+    auto lastPresent = std::optional<chrono::steady_clock::time_point>{};
+    auto lastStatsReport = chrono::steady_clock::now();
+
+    // the frame currently in the texture, each new frame only uploads the rows that differ
+    auto uploaded = EmuThread::Frame{};
+    bool needsFullUpload = true;
+    bool windowChanged = false;
+
     auto event = SDL_Event{};
     bool shouldExit = false;
     while (!shouldExit) {
 
-        bool singleStep = false;
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
             case SDL_QUIT:
                 shouldExit = true;
                 break;
+            case SDL_WINDOWEVENT:
+                // exposed or resized, the last frame has to be presented again
+                windowChanged = true;
+                break;
             case SDL_KEYDOWN:
                 // keypad for emulator is polled lower
                 switch (event.key.keysym.sym) {
                 case SDLK_TAB:
-                    romIdx = (romIdx + 1) % roms.size();
-                    emu = loadRom(roms[romIdx]);
+                    emuThread.send(EmuThread::Command::NextRom);
                     break;
                 case SDLK_SPACE:
-                    paused = !paused;
-                    emu.setPause(paused);
+                    emuThread.send(EmuThread::Command::TogglePause);
                     break;
                 case SDLK_RIGHT:
-                    emu.setPause(false);
-                    singleStep = true;
+                    emuThread.send(EmuThread::Command::Step);
+                    break;
+                case SDLK_t:
+                    emuThread.send(EmuThread::Command::ToggleTurbo);
+                    break;
+                case SDLK_j:
+                    emuThread.send(EmuThread::Command::ToggleJit);
+                    break;
+                case SDLK_p:
+                    emuThread.send(EmuThread::Command::ToggleProfiling);
+                    break;
+                case SDLK_m:
+                    emuThread.send(EmuThread::Command::ToggleRecording);
+                    break;
+                case SDLK_g:
+                    emuThread.send(EmuThread::Command::ToggleCapture);
                     break;
                 }
                 break;
@@ -110,36 +132,66 @@ static void runApplication() {
             }
         }
 
-        const auto keysDown = get_keys();
-        emu.tick(keysDown);
-        synth.setPause(!emu.shouldPlaySound());
-        if (singleStep) {
-            emu.setPause(true);
-            paused = true;
-            singleStep = false;
-        }
-
-        sdl_assert(SDL_RenderClear(renderer));
-        uint8_t* pixels = nullptr;
-        int pitch = 0;
-        sdl_assert(SDL_LockTexture(texture, nullptr, reinterpret_cast<void**>(&pixels), &pitch));
-        memset(pixels, 0, pitch * Display::HEIGHT_PX);
-        const auto srcPixels = emu.getDisplay().data();
-        for (auto y = 0; y < Display::HEIGHT_PX; ++y) {
-            const auto dstRowPtr = pixels + (y * pitch);
-            const auto srcRowPtr = srcPixels + (y * Display::WIDTH_PX);
-            for (auto x = 0; x < Display::WIDTH_PX; ++x) {
-                const auto dstPtr = dstRowPtr + (bytesPerPx * x);
-                for (auto px = 0; px < bytesPerPx; ++px) {
-                    dstPtr[px] = srcRowPtr[x];
+        emuThread.setKeys(get_keys());
+        emuThread.setRewinding(is_key_held(SDLK_BACKSPACE));
+
+        // only upload the rows that changed since the last present and skip presenting entirely if nothing did
+        Display::RowMask dirtyRows = 0;
+        if (emuThread.updateFrame()) {
+            const auto& frame = emuThread.frame();
+            // a mode switch changes what every row of the texture means
+            needsFullUpload |= frame.hires != uploaded.hires;
+            const auto height = frame.hires ? Display::HIRES_HEIGHT_PX : Display::HEIGHT_PX;
+            for (auto y = 0; y < height; ++y) {
+                const auto row = y * Display::WORDS_PER_ROW;
+                bool changed = needsFullUpload;
+                for (auto p = 0; p < Display::PLANES && !changed; ++p) {
+                    changed = !std::equal(&frame.planes[p][row], &frame.planes[p][row] + Display::WORDS_PER_ROW, &uploaded.planes[p][row]);
                 }
+                if (changed) {
+                    dirtyRows |= Display::RowMask(1) << y;
+                }
+            }
+            uploaded = frame;
+            needsFullUpload = false;
+        }
+        const auto width = uploaded.hires ? Display::HIRES_WIDTH_PX : Display::WIDTH_PX;
+        const auto height = uploaded.hires ? Display::HIRES_HEIGHT_PX : Display::HEIGHT_PX;
+        if (dirtyRows != 0) {
+            const auto firstRow = std::countr_zero(dirtyRows);
+            const auto lastRow = Display::HIRES_HEIGHT_PX - 1 - std::countl_zero(dirtyRows);
+            const auto dirtyRect = SDL_Rect{0, firstRow, width, lastRow - firstRow + 1};
+            uint8_t* pixels = nullptr;
+            int pitch = 0;
+            sdl_assert(SDL_LockTexture(texture, &dirtyRect, reinterpret_cast<void**>(&pixels), &pitch));
+            for (auto y = firstRow; y <= lastRow; ++y) {
+                expandRowRgb888(uploaded.planes, uploaded.hires, y, reinterpret_cast<uint32_t*>(pixels + (y - firstRow) * pitch));
             }
+            SDL_UnlockTexture(texture);
         }
+        if (dirtyRows != 0 || windowChanged) {
+            const auto visible = SDL_Rect{0, 0, width, height};
+            sdl_assert(SDL_RenderClear(renderer));
+            sdl_assert(SDL_RenderCopy(renderer, texture, &visible, nullptr));
+            SDL_RenderPresent(renderer);
+            const auto now = chrono::steady_clock::now();
+            if (lastPresent) {
+                presentTimes.add(now - *lastPresent);
+            }
+            lastPresent = now;
+        } else {
+            // nothing to show, sleep until input arrives or the emulator posts a new frame
+            SDL_WaitEvent(nullptr);
+        }
+        windowChanged = false;
 
-        SDL_UnlockTexture(texture);
-        sdl_assert(SDL_RenderCopy(renderer, texture, nullptr, nullptr));
-        SDL_RenderPresent(renderer);
+        if (settings.statsInterval > 0s && chrono::steady_clock::now() - lastStatsReport >= settings.statsInterval) {
+            log_info("Presented frames: {}", presentTimes.summary());
+            presentTimes.clear();
+            lastStatsReport = chrono::steady_clock::now();
+        }
     }
+    log_info("Presented frames: {}", presentTimes.summary());
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -148,8 +200,51 @@ static void runApplication() {
 
 } // namespace ez
 
-int main(int, char**) {
-
-    ez::runApplication();
+int main(int argc, char** argv) {
+
+    auto settings = ez::EmuThread::Settings{};
+    auto audioBufferSamples = ez::Audio::DEFAULT_BUFFER_SAMPLES;
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        if (arg == "--turbo") {
+            settings.turbo = true;
+        } else if (arg == "--jit") {
+            settings.backend = ez::Emu::Backend::Jit;
+        } else if (arg == "--jit-check") {
+            settings.backend = ez::Emu::Backend::JitChecked;
+        } else if (arg == "--profile") {
+            settings.profiling = true;
+        } else if (arg == "--trace") {
+            settings.tracing = true;
+        } else if (arg == "--audio-buffer" && i + 1 < argc) {
+            audioBufferSamples = std::stoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            settings.seed = std::stoull(argv[++i]);
+        } else if (arg == "--replay" && i + 1 < argc) {
+            settings.replay = argv[++i];
+        } else if (arg == "--max-catch-up" && i + 1 < argc) {
+            settings.maxCatchUp = std::chrono::milliseconds(std::stoll(argv[++i]));
+        } else if (arg == "--frame-stats" && i + 1 < argc) {
+            settings.statsInterval = std::chrono::seconds(std::stoll(argv[++i]));
+        } else if (arg == "--capture-format" && i + 1 < argc) {
+            const auto format = ez::FrameCapture::parseFormat(argv[++i]);
+            if (!format) {
+                ez::log_error("Unknown capture format {}, expected y4m, apng or raw", argv[i]);
+                return 1;
+            }
+            settings.captureFormat = *format;
+        } else if (arg == "--quirks" && i + 1 < argc) {
+            settings.quirks = ez::parseQuirkProfile(argv[++i]);
+            if (!settings.quirks) {
+                ez::log_error("Unknown quirk profile {}, expected chip8, schip or xochip", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--log-file" && i + 1 < argc) {
+            if (!ez::logging::setBinaryFile(argv[++i])) {
+                ez::log_error("Failed to open log file {}", argv[i]);
+            }
+        }
+    }
+    ez::runApplication(settings, audioBufferSamples);
     return 0;
 }
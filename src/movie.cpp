@@ -0,0 +1,98 @@
+#include "movie.h"
+#include "savestate.h"
+#include <fstream>
+
+namespace ez {
+
+static constexpr std::array<uint8_t, 4> MOVIE_MAGIC = {'C', '8', 'M', 'V'};
+static constexpr uint16_t MOVIE_VERSION = 1;
+// a day of emulated time, bounds what a malformed header can make read allocate
+static constexpr uint64_t MAX_FRAMES = uint64_t(24) * 60 * 60 * Emu::TIMERS_PER_SECOND;
+
+Movie::Movie(uint64_t romHash, QuirkProfile quirkProfile, uint64_t seed) : m_romHash(romHash), m_quirkProfile(quirkProfile), m_seed(seed) {}
+
+void Movie::truncate(uint64_t frame) {
+    if (frame < m_keys.size()) {
+        m_keys.resize(frame);
+    }
+}
+
+void Movie::write(std::vector<uint8_t>& out) const {
+    auto writer = SnapshotWriter(out);
+    writer.write(MOVIE_MAGIC);
+    writer.write(MOVIE_VERSION);
+    writer.write(m_romHash);
+    writer.write(uint8_t(m_quirkProfile));
+    writer.write(m_seed);
+    writer.write(uint64_t(m_keys.size()));
+
+    // a key is usually held for many frames, one run per change keeps an hour of play down to a few kilobytes
+    for (size_t start = 0; start < m_keys.size();) {
+        auto end = start + 1;
+        while (end < m_keys.size() && m_keys[end] == m_keys[start] && end - start < UINT32_MAX) {
+            ++end;
+        }
+        writer.write(uint16_t(m_keys[start]));
+        writer.write(uint32_t(end - start));
+        start = end;
+    }
+}
+
+std::optional<Movie> Movie::read(const uint8_t* data, size_t size) {
+    auto reader = SnapshotReader(data, size);
+    auto magic = decltype(MOVIE_MAGIC){};
+    uint16_t version = 0;
+    if (!reader.read(magic) || magic != MOVIE_MAGIC || !reader.read(version) || version != MOVIE_VERSION) {
+        log_warn("Not a version {} movie", MOVIE_VERSION);
+        return std::nullopt;
+    }
+
+    auto movie = Movie{};
+    uint8_t quirkProfile = 0;
+    uint64_t frames = 0;
+    bool ok = reader.read(movie.m_romHash) && reader.read(quirkProfile) && quirkProfile < uint8_t(QuirkProfile::Count) &&
+              reader.read(movie.m_seed) && reader.read(frames) && frames <= MAX_FRAMES;
+    if (ok) {
+        movie.m_keys.reserve(frames);
+    }
+    while (ok && movie.m_keys.size() < frames) {
+        uint16_t keys = 0;
+        uint32_t length = 0;
+        ok = reader.read(keys) && reader.read(length) && length > 0 && length <= frames - movie.m_keys.size();
+        if (ok) {
+            movie.m_keys.insert(movie.m_keys.end(), length, keys);
+        }
+    }
+    if (!ok || !reader.atEnd()) {
+        log_warn("Malformed movie");
+        return std::nullopt;
+    }
+    movie.m_quirkProfile = QuirkProfile(quirkProfile);
+    return movie;
+}
+
+bool Movie::isMovie(const uint8_t* data, size_t size) { return size >= MOVIE_MAGIC.size() && std::equal(MOVIE_MAGIC.begin(), MOVIE_MAGIC.end(), data); }
+
+bool Movie::save(const std::filesystem::path& path) const {
+    auto data = std::vector<uint8_t>{};
+    write(data);
+    auto os = std::ofstream(path, std::ios::binary);
+    os.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+    if (!os) {
+        log_error("Failed to write movie {}", path.string());
+        return false;
+    }
+    return true;
+}
+
+std::optional<Movie> Movie::load(const std::filesystem::path& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    if (!is) {
+        log_error("Failed to open movie {}", path.string());
+        return std::nullopt;
+    }
+    const auto data = std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+    return read(data.data(), data.size());
+}
+
+} // namespace ez
@@ -0,0 +1,44 @@
+#pragma once
+#include "emu.h"
+
+namespace ez {
+
+// a session recorded from power on: the rom it ran, the quirk profile and random seed it ran with and the keys held
+// during every emulated frame. the machine is fully deterministic in emulated time, so a fresh Emu with the same
+// profile and seed that runs frame n with runFrames(1, keysAt(n)) replays the session bit for bit
+class Movie {
+  public:
+    Movie() = default;
+    Movie(uint64_t romHash, QuirkProfile quirkProfile, uint64_t seed);
+
+    // romHash of the rom it was recorded on
+    uint64_t romHash() const { return m_romHash; }
+    QuirkProfile quirkProfile() const { return m_quirkProfile; }
+    uint64_t seed() const { return m_seed; }
+
+    uint64_t frames() const { return m_keys.size(); }
+    // keys held during the frame, nothing is held past the end
+    KeypadInput keysAt(uint64_t frame) const { return frame < m_keys.size() ? m_keys[frame] : 0; }
+    // appends the keys of the next frame
+    void push(KeypadInput keys) { m_keys.push_back(keys); }
+    // forgets every frame from frame on, e.g. after rewinding while recording
+    void truncate(uint64_t frame);
+
+    // a magic + version header followed by little endian fields, the keys stored as runs of identical frames
+    void write(std::vector<uint8_t>& out) const;
+    // nullopt if the data is malformed or from another version
+    static std::optional<Movie> read(const uint8_t* data, size_t size);
+    // whether the data starts like a movie, to tell one apart from other input formats
+    static bool isMovie(const uint8_t* data, size_t size);
+
+    bool save(const std::filesystem::path& path) const;
+    static std::optional<Movie> load(const std::filesystem::path& path);
+
+  private:
+    uint64_t m_romHash = 0;
+    QuirkProfile m_quirkProfile = QuirkProfile::Chip8;
+    uint64_t m_seed = 0;
+    std::vector<KeypadInput> m_keys;
+};
+
+} // namespace ez
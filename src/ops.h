@@ -0,0 +1,41 @@
+#pragma once
+#include "emu.h"
+#include "rng.h"
+
+// semantics of the opcodes that compute something, shared by the interpreter and the batch engine so the two can't
+// drift apart. everything here is branch free so loops over batch lanes vectorize
+namespace ez::ops {
+
+struct MathResult {
+    uint8_t vx = 0;
+    uint8_t vf = 0;
+};
+
+// vf is only written with the logicResetsVf quirk
+constexpr MathResult bitOr(uint8_t vx, uint8_t vy) { return {uint8_t(vx | vy), 0}; }
+constexpr MathResult bitAnd(uint8_t vx, uint8_t vy) { return {uint8_t(vx & vy), 0}; }
+constexpr MathResult bitXor(uint8_t vx, uint8_t vy) { return {uint8_t(vx ^ vy), 0}; }
+// carry
+constexpr MathResult add(uint8_t vx, uint8_t vy) { return {uint8_t(vx + vy), uint8_t((int(vx) + vy) > 0xFF)}; }
+// vf is not borrow
+constexpr MathResult sub(uint8_t vx, uint8_t vy) { return {uint8_t(vx - vy), uint8_t(vy <= vx)}; }
+constexpr MathResult subn(uint8_t vx, uint8_t vy) { return {uint8_t(vy - vx), uint8_t(vx <= vy)}; }
+// src is vy with the shiftVy quirk, vx otherwise. vf is the bit shifted out
+constexpr MathResult shr(uint8_t src) { return {uint8_t(src >> 1), uint8_t(src & 0b1)}; }
+constexpr MathResult shl(uint8_t src) { return {uint8_t(src << 1), uint8_t(src >> 7)}; }
+
+// Ex9E and ExA1, vx past F is no key at all rather than a shift by more than the width of the mask
+constexpr bool keyDown(KeypadInput keysDown, uint8_t vx) { return vx < 16 && ((keysDown >> vx) & 1) != 0; }
+
+constexpr uint8_t random(Rng& rng, uint8_t mask) { return rng.nextByte() & mask; }
+
+constexpr uint16_t fontAddress(uint8_t glyph) { return uint16_t(glyph * Emu::BYTES_PER_FONT_GLYPH); }
+constexpr uint16_t bigFontAddress(uint8_t glyph) { return uint16_t(Emu::BIG_FONT_START + (glyph & 0xF) * Emu::BYTES_PER_BIG_FONT_GLYPH); }
+
+// decimal digits of vx as stored by Fx33, hundreds first
+constexpr std::array<uint8_t, 3> bcd(uint8_t vx) { return {uint8_t(vx / 100), uint8_t((vx / 10) % 10), uint8_t(vx % 10)}; }
+
+// one byte of sprite positioned at column x of a lores row, bits past the right edge are clipped
+constexpr Display::Row spriteRow(uint8_t spriteByte, uint8_t x) { return (Display::Row(spriteByte) << (Display::WIDTH_PX - 8)) >> x; }
+
+} // namespace ez::ops
@@ -0,0 +1,140 @@
+#include "profiler.h"
+#include <algorithm>
+#include <numeric>
+
+namespace ez {
+
+// how many of the hottest addresses the json report lists up front
+static constexpr size_t HOT_PC_COUNT = 32;
+
+Profiler::Profiler(size_t memorySize, int cyclesPerSecond)
+    : m_cyclesPerSecond(cyclesPerSecond), m_pcHits(memorySize), m_pcOps(memorySize, Op::Undecoded) {}
+
+void Profiler::record(EventKind kind, uint16_t address, uint64_t cycle) {
+    // once full nothing more is kept, so every kept return still has its call
+    if (m_events.size() == MAX_TRACE_EVENTS) {
+        ++m_droppedEvents;
+        return;
+    }
+    m_events.push_back({cycle, address, kind});
+}
+
+void Profiler::onCall(uint16_t target, uint64_t cycle) {
+    ++m_calls;
+    ++m_depth;
+    m_maxDepth = std::max(m_maxDepth, m_depth);
+    ++m_depthHistogram[std::min(m_depth, MAX_TRACKED_DEPTH)];
+    record(EventKind::Call, target, cycle);
+}
+
+void Profiler::onReturn(uint64_t cycle) {
+    if (m_depth == 0) {
+        ++m_unbalancedReturns;
+        return;
+    }
+    --m_depth;
+    record(EventKind::Return, 0, cycle);
+}
+
+void Profiler::onDraw(uint16_t pc, bool collision, uint64_t cycle) {
+    ++m_draws;
+    m_collisions += collision;
+    record(collision ? EventKind::Collision : EventKind::Draw, pc, cycle);
+}
+
+uint64_t Profiler::instructionCount() const { return std::accumulate(m_opCounts.begin(), m_opCounts.end(), uint64_t(0)); }
+
+void Profiler::writeJson(std::ostream& out) const {
+    out << "{\n";
+    out << std::format("  \"instructions\": {},\n", instructionCount());
+    out << std::format("  \"key_wait_cycles\": {},\n", m_keyWaitCycles);
+
+    out << "  \"opcodes\": {";
+    auto first = true;
+    for (size_t op = 0; op < m_opCounts.size(); ++op) {
+        if (m_opCounts[op] == 0) {
+            continue;
+        }
+        out << std::format("{}\n    \"{}\": {}", first ? "" : ",", to_string(Op(op)), m_opCounts[op]);
+        first = false;
+    }
+    out << "\n  },\n";
+
+    auto hot = std::vector<uint16_t>{};
+    for (size_t pc = 0; pc < m_pcHits.size(); ++pc) {
+        if (m_pcHits[pc] > 0) {
+            hot.push_back(uint16_t(pc));
+        }
+    }
+    const auto byAddress = hot;
+    std::stable_sort(hot.begin(), hot.end(), [&](uint16_t a, uint16_t b) { return m_pcHits[a] > m_pcHits[b]; });
+    hot.resize(std::min(hot.size(), HOT_PC_COUNT));
+
+    out << "  \"hot_pcs\": [";
+    for (size_t i = 0; i < hot.size(); ++i) {
+        out << std::format("{}\n    {{\"pc\": \"0x{:03x}\", \"hits\": {}, \"op\": \"{}\"}}", i ? "," : "", hot[i],
+                           m_pcHits[hot[i]], to_string(m_pcOps[hot[i]]));
+    }
+    out << "\n  ],\n";
+
+    // every executed address, for heat maps over the whole of memory
+    out << "  \"pc_hits\": {";
+    for (size_t i = 0; i < byAddress.size(); ++i) {
+        out << std::format("{}\"0x{:03x}\": {}", i ? ", " : "", byAddress[i], m_pcHits[byAddress[i]]);
+    }
+    out << "},\n";
+
+    out << "  \"calls\": {\n";
+    out << std::format("    \"count\": {},\n", m_calls);
+    out << std::format("    \"max_depth\": {},\n", m_maxDepth);
+    out << std::format("    \"unbalanced_returns\": {},\n", m_unbalancedReturns);
+    out << "    \"depth_histogram\": [";
+    const auto deepest = std::min(m_maxDepth, MAX_TRACKED_DEPTH);
+    for (size_t depth = 1; depth <= deepest; ++depth) {
+        out << std::format("{}{}", depth > 1 ? ", " : "", m_depthHistogram[depth]);
+    }
+    out << "]\n  },\n";
+
+    out << "  \"display\": {\n";
+    out << std::format("    \"draws\": {},\n", m_draws);
+    out << std::format("    \"collisions\": {},\n", m_collisions);
+    out << std::format("    \"clears\": {}\n", m_clears);
+    out << "  },\n";
+
+    out << std::format("  \"trace_events\": {},\n", m_events.size());
+    out << std::format("  \"dropped_trace_events\": {}\n", m_droppedEvents);
+    out << "}\n";
+}
+
+void Profiler::writeChromeTrace(std::ostream& out, uint64_t endCycle) const {
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"chip8\"}}";
+    size_t openCalls = 0;
+    for (const auto& event : m_events) {
+        const auto ts = toMicroseconds(event.cycle);
+        switch (event.kind) {
+        case EventKind::Call:
+            ++openCalls;
+            out << std::format(",\n{{\"name\": \"sub_{:03x}\", \"cat\": \"call\", \"ph\": \"B\", \"ts\": {:.1f}, \"pid\": 1, \"tid\": 1}}",
+                               event.address, ts);
+            break;
+        case EventKind::Return:
+            --openCalls;
+            out << std::format(",\n{{\"ph\": \"E\", \"ts\": {:.1f}, \"pid\": 1, \"tid\": 1}}", ts);
+            break;
+        case EventKind::Draw:
+        case EventKind::Collision:
+            out << std::format(",\n{{\"name\": \"{}\", \"cat\": \"display\", \"ph\": \"i\", \"s\": \"t\", \"ts\": {:.1f}, "
+                               "\"pid\": 1, \"tid\": 1, \"args\": {{\"pc\": \"0x{:03x}\"}}}}",
+                               event.kind == EventKind::Collision ? "draw (collision)" : "draw", ts, event.address);
+            break;
+        }
+    }
+    const auto endTs = toMicroseconds(endCycle);
+    for (; openCalls > 0; --openCalls) {
+        out << std::format(",\n{{\"ph\": \"E\", \"ts\": {:.1f}, \"pid\": 1, \"tid\": 1}}", endTs);
+    }
+    out << "\n]}\n";
+}
+
+} // namespace ez
@@ -0,0 +1,70 @@
+#pragma once
+#include "base.h"
+#include "decode.h"
+
+namespace ez {
+
+// statistics about the emulated program, not the emulator. Emu feeds it through a compile time policy so the
+// interpreter loop carries no trace of it while profiling is off, see Emu::setProfiling
+class Profiler {
+  public:
+    // calls and draws recorded for the trace, anything past this is counted but not kept
+    static constexpr size_t MAX_TRACE_EVENTS = 1 << 20;
+    // depths past this share the last histogram bucket
+    static constexpr size_t MAX_TRACKED_DEPTH = 32;
+
+    Profiler(size_t memorySize, int cyclesPerSecond);
+
+    void onInstruction(uint16_t pc, Op op) {
+        ++m_opCounts[size_t(op)];
+        ++m_pcHits[pc];
+        m_pcOps[pc] = op;
+    }
+    void onCall(uint16_t target, uint64_t cycle);
+    void onReturn(uint64_t cycle);
+    void onDraw(uint16_t pc, bool collision, uint64_t cycle);
+    void onClear() { ++m_clears; }
+    void onKeyWait() { ++m_keyWaitCycles; }
+
+    uint64_t instructionCount() const;
+
+    // counters, hot addresses and call statistics
+    void writeJson(std::ostream& out) const;
+    // chrome://tracing / perfetto trace events, every subroutine call is a slice and every draw an instant, the
+    // timeline is emulated time. calls still open at endCycle are closed there
+    void writeChromeTrace(std::ostream& out, uint64_t endCycle) const;
+
+  private:
+    enum class EventKind : uint8_t { Call, Return, Draw, Collision };
+    struct TraceEvent {
+        uint64_t cycle = 0;
+        uint16_t address = 0;
+        EventKind kind = EventKind::Call;
+    };
+    void record(EventKind kind, uint16_t address, uint64_t cycle);
+    double toMicroseconds(uint64_t cycle) const { return double(cycle) * 1e6 / m_cyclesPerSecond; }
+
+    int m_cyclesPerSecond = 0;
+
+    std::array<uint64_t, size_t(Op::Count)> m_opCounts{};
+    std::vector<uint64_t> m_pcHits;
+    // the last op seen at each address, enough to label hot spots in the report
+    std::vector<Op> m_pcOps;
+
+    uint64_t m_calls = 0;
+    uint64_t m_unbalancedReturns = 0;
+    size_t m_depth = 0;
+    size_t m_maxDepth = 0;
+    // calls by the depth they reached
+    std::array<uint64_t, MAX_TRACKED_DEPTH + 1> m_depthHistogram{};
+
+    uint64_t m_draws = 0;
+    uint64_t m_collisions = 0;
+    uint64_t m_clears = 0;
+    uint64_t m_keyWaitCycles = 0;
+
+    std::vector<TraceEvent> m_events;
+    uint64_t m_droppedEvents = 0;
+};
+
+} // namespace ez
@@ -0,0 +1,80 @@
+#include "quirks.h"
+
+namespace ez {
+
+namespace {
+
+struct KnownRom {
+    uint64_t hash;
+    QuirkProfile profile;
+    // for whoever updates the table, not used at runtime
+    const char* name;
+};
+
+// roms that only run correctly with something other than the default Chip8 profile. most classic roms don't use any
+// quirky opcode in a way that matters, so they don't need an entry
+constexpr KnownRom KNOWN_ROMS[] = {
+    // written for CHIP-48, shifts vx in place and expects I to stay put across Fx55/Fx65
+    {0x0fd332d0bc68c9f2, QuirkProfile::SuperChip, "Blinky [Hans Christian Egeberg, 1991]"},
+    // shifts vx in place
+    {0x618a84f06fe32861, QuirkProfile::SuperChip, "Space Invaders [David Winter]"},
+};
+
+} // namespace
+
+Quirks quirksOf(QuirkProfile profile) {
+    switch (profile) {
+    case QuirkProfile::Chip8:
+        return QuirkTraits<QuirkProfile::Chip8>::quirks;
+    case QuirkProfile::SuperChip:
+        return QuirkTraits<QuirkProfile::SuperChip>::quirks;
+    case QuirkProfile::XoChip:
+        return QuirkTraits<QuirkProfile::XoChip>::quirks;
+    case QuirkProfile::Count:
+        break;
+    }
+    abort();
+}
+
+const char* to_string(QuirkProfile profile) {
+    switch (profile) {
+    case QuirkProfile::Chip8:
+        return "chip8";
+    case QuirkProfile::SuperChip:
+        return "schip";
+    case QuirkProfile::XoChip:
+        return "xochip";
+    case QuirkProfile::Count:
+        break;
+    }
+    abort();
+}
+
+std::optional<QuirkProfile> parseQuirkProfile(std::string_view name) {
+    for (auto i = 0; i < int(QuirkProfile::Count); ++i) {
+        if (name == to_string(QuirkProfile(i))) {
+            return QuirkProfile(i);
+        }
+    }
+    return std::nullopt;
+}
+
+uint64_t romHash(const uint8_t* rom, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ rom[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::optional<QuirkProfile> lookupQuirkProfile(const uint8_t* rom, size_t size) {
+    const auto hash = romHash(rom, size);
+    for (const auto& known : KNOWN_ROMS) {
+        if (known.hash == hash) {
+            return known.profile;
+        }
+    }
+    return std::nullopt;
+}
+
+} // namespace ez
@@ -0,0 +1,68 @@
+#pragma once
+#include "base.h"
+
+namespace ez {
+
+// the interpreters chip8 programs were written for disagree on a handful of opcodes, a profile picks one behaviour
+// for each of them
+enum class QuirkProfile : uint8_t {
+    // the original COSMAC VIP interpreter
+    Chip8,
+    // SUPER-CHIP 1.1 on the HP48
+    SuperChip,
+    // Octo's XO-CHIP
+    XoChip,
+    Count,
+};
+
+struct Quirks {
+    // Fx55/Fx65 leave I pointing past the last register transferred
+    bool memoryIncrement = true;
+    // 8xy6/8xyE shift vy into vx, rather than shifting vx in place
+    bool shiftVy = true;
+    // Bnnn jumps to nnn + v0, rather than xnn + vx
+    bool jumpV0 = true;
+    // 8xy1/8xy2/8xy3 clear vf
+    bool logicResetsVf = true;
+    // 00Cn/00FB/00FC scrolling, 00FE/00FF lores and hires, Dxy0 16x16 sprites, Fx30 big font, Fx75/Fx85 flag
+    // registers and 00FD exit
+    bool superChip = false;
+    // 00Dn, 5xy2/5xy3 register ranges, F000 nnnn long I, Fn01 bit-planes, F002/Fx3A audio and 64 KB of memory
+    bool xoChip = false;
+    // sprites running off the right or bottom edge come back in at the left or top instead of being clipped
+    bool wrapSprites = false;
+
+    constexpr int memoryBytes() const { return xoChip ? 64 * 1024 : 4 * 1024; }
+};
+
+// compile time form of a profile. the interpreter is instantiated once per profile so a quirk costs nothing at runtime,
+// code that only looks at quirks once per block or batch step uses the Quirks value instead
+template <QuirkProfile P> struct QuirkTraits;
+template <> struct QuirkTraits<QuirkProfile::Chip8> {
+    static constexpr Quirks quirks{
+        .memoryIncrement = true, .shiftVy = true, .jumpV0 = true, .logicResetsVf = true, .superChip = false, .xoChip = false,
+        .wrapSprites = false};
+};
+template <> struct QuirkTraits<QuirkProfile::SuperChip> {
+    static constexpr Quirks quirks{
+        .memoryIncrement = false, .shiftVy = false, .jumpV0 = false, .logicResetsVf = false, .superChip = true, .xoChip = false,
+        .wrapSprites = false};
+};
+template <> struct QuirkTraits<QuirkProfile::XoChip> {
+    static constexpr Quirks quirks{
+        .memoryIncrement = true, .shiftVy = true, .jumpV0 = true, .logicResetsVf = false, .superChip = true, .xoChip = true,
+        .wrapSprites = true};
+};
+
+Quirks quirksOf(QuirkProfile profile);
+
+const char* to_string(QuirkProfile profile);
+// accepts the names to_string returns
+std::optional<QuirkProfile> parseQuirkProfile(std::string_view name);
+
+// 64-bit FNV-1a over the rom image, the key of the quirk database
+uint64_t romHash(const uint8_t* rom, size_t size);
+// the profile a known rom needs, nullopt for anything not in the database
+std::optional<QuirkProfile> lookupQuirkProfile(const uint8_t* rom, size_t size);
+
+} // namespace ez
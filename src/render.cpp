@@ -0,0 +1,81 @@
+#include "render.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EZ_RGB_KERNEL_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define EZ_RGB_KERNEL_SSE2 1
+#endif
+
+namespace ez {
+
+static constexpr uint32_t LIT_PX = 0xFFFFFFFF;
+// colour index 0 - 3 to pixel, index 1 is the plain lit pixel so single plane frames look the same either way
+static constexpr std::array<uint32_t, 4> PALETTE = {0, LIT_PX, 0xFFAAAAAA, 0xFF555555};
+static constexpr int PX_PER_BYTE = 8;
+
+const char* rgbKernelName() {
+#if defined(EZ_RGB_KERNEL_AVX2)
+    return "avx2";
+#elif defined(EZ_RGB_KERNEL_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+void expandRowRgb888(Display::Row row, uint32_t* dst) {
+    // walk the row a byte (8 pixels) at a time from the leftmost pixel, every lane tests one bit of the byte
+    // and the compare turns a set bit straight into an all ones pixel
+#if defined(EZ_RGB_KERNEL_AVX2)
+    const auto bitMasks = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    for (auto byteIdx = 0; byteIdx < Display::WIDTH_PX / PX_PER_BYTE; ++byteIdx) {
+        const auto bits = int(row >> (Display::WIDTH_PX - PX_PER_BYTE * (byteIdx + 1))) & 0xFF;
+        const auto lanes = _mm256_and_si256(_mm256_set1_epi32(bits), bitMasks);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + byteIdx * PX_PER_BYTE), _mm256_cmpeq_epi32(lanes, bitMasks));
+    }
+#elif defined(EZ_RGB_KERNEL_SSE2)
+    const auto highMasks = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const auto lowMasks = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    for (auto byteIdx = 0; byteIdx < Display::WIDTH_PX / PX_PER_BYTE; ++byteIdx) {
+        const auto bits = _mm_set1_epi32(int(row >> (Display::WIDTH_PX - PX_PER_BYTE * (byteIdx + 1))) & 0xFF);
+        const auto out = reinterpret_cast<__m128i*>(dst + byteIdx * PX_PER_BYTE);
+        _mm_storeu_si128(out, _mm_cmpeq_epi32(_mm_and_si128(bits, highMasks), highMasks));
+        _mm_storeu_si128(out + 1, _mm_cmpeq_epi32(_mm_and_si128(bits, lowMasks), lowMasks));
+    }
+#else
+    for (auto x = 0; x < Display::WIDTH_PX; ++x) {
+        const bool lit = (row >> (Display::WIDTH_PX - 1 - x)) & 0b1;
+        dst[x] = lit ? LIT_PX : 0;
+    }
+#endif
+}
+
+uint32_t paletteRgb888(int index) { return PALETTE[size_t(index)]; }
+
+void expandRowRgb888(const Display::Planes& planes, bool hires, int y, uint32_t* dst) {
+    const auto words = hires ? Display::WORDS_PER_ROW : 1;
+    const auto row = y * Display::WORDS_PER_ROW;
+    for (auto w = 0; w < words; ++w) {
+        const auto plane0 = planes[0][row + w];
+        const auto plane1 = planes[1][row + w];
+        if (plane1 == 0) {
+            expandRowRgb888(plane0, dst + w * Display::WIDTH_PX);
+            continue;
+        }
+        for (auto x = 0; x < Display::WIDTH_PX; ++x) {
+            const auto bit = Display::WIDTH_PX - 1 - x;
+            dst[w * Display::WIDTH_PX + x] = PALETTE[((plane0 >> bit) & 0b1) | (((plane1 >> bit) & 0b1) << 1)];
+        }
+    }
+}
+
+void expandRowsRgb888(const Display& display, int firstRow, int lastRow, uint8_t* pixels, int pitch) {
+    assert(0 <= firstRow && firstRow <= lastRow && lastRow < display.height());
+    for (auto y = firstRow; y <= lastRow; ++y) {
+        expandRowRgb888(display.planes(), display.isHires(), y, reinterpret_cast<uint32_t*>(pixels + (y - firstRow) * pitch));
+    }
+}
+
+} // namespace ez
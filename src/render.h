@@ -0,0 +1,22 @@
+#pragma once
+#include "emu.h"
+
+namespace ez {
+
+// name of the expansion kernel picked at compile time, for logging and benchmarks
+const char* rgbKernelName();
+
+// expands one 1 bit per pixel display row into WIDTH_PX 32 bit RGB888 pixels, lit is white and unlit black
+void expandRowRgb888(Display::Row row, uint32_t* dst);
+
+// colour of a pixel whose plane bits make the given index 0 - 3
+uint32_t paletteRgb888(int index);
+
+// expands row y of a frame into its 64 or 128 pixels. while plane 1 is blank the row is black and white through
+// expandRowRgb888, otherwise each pixel's two plane bits pick one of four shades
+void expandRowRgb888(const Display::Planes& planes, bool hires, int y, uint32_t* dst);
+
+// expands rows [firstRow, lastRow] into a locked texture with the given pitch, pixels points at firstRow
+void expandRowsRgb888(const Display& display, int firstRow, int lastRow, uint8_t* pixels, int pitch);
+
+} // namespace ez
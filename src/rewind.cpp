@@ -0,0 +1,152 @@
+#include "rewind.h"
+
+namespace ez {
+
+static void writeVarint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(uint8_t(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(uint8_t(value));
+}
+
+static size_t readVarint(const uint8_t*& in) {
+    size_t value = 0;
+    for (auto shift = 0;; shift += 7) {
+        const auto byte = *in++;
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+// xors data against ref (zero past its end) and stores the result as alternating runs of zeros and literal bytes
+static void encodeDelta(const std::vector<uint8_t>& data, const std::vector<uint8_t>& ref, std::vector<uint8_t>& out) {
+    out.clear();
+    writeVarint(out, data.size());
+    const auto xorAt = [&](size_t i) { return uint8_t(data[i] ^ (i < ref.size() ? ref[i] : 0)); };
+    size_t i = 0;
+    while (i < data.size()) {
+        const auto zeroStart = i;
+        while (i < data.size() && xorAt(i) == 0) {
+            ++i;
+        }
+        const auto literalStart = i;
+        while (i < data.size() && xorAt(i) != 0) {
+            ++i;
+        }
+        writeVarint(out, literalStart - zeroStart);
+        writeVarint(out, i - literalStart);
+        for (auto j = literalStart; j < i; ++j) {
+            out.push_back(xorAt(j));
+        }
+    }
+}
+
+static void decodeDelta(const std::vector<uint8_t>& delta, const std::vector<uint8_t>& ref, std::vector<uint8_t>& out) {
+    auto in = delta.data();
+    const auto end = delta.data() + delta.size();
+    out.resize(readVarint(in));
+    for (size_t i = 0; i < out.size(); ++i) {
+        out[i] = i < ref.size() ? ref[i] : 0;
+    }
+    size_t i = 0;
+    while (in < end) {
+        i += readVarint(in);
+        const auto literalSize = readVarint(in);
+        for (size_t j = 0; j < literalSize; ++j) {
+            out[i++] ^= *in++;
+        }
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t budgetBytes, int keyframeInterval) : m_budgetBytes(budgetBytes), m_keyframeInterval(keyframeInterval) {
+    assert(keyframeInterval > 0);
+}
+
+void RewindBuffer::push(const std::vector<uint8_t>& snapshot) {
+    auto entry = Entry{};
+    entry.id = m_nextId++;
+    if (!m_hasKeyframe || m_deltasSinceKeyframe + 1 >= m_keyframeInterval) {
+        // keyframes go through the same encoder against nothing, which still squeezes out the zeroed memory
+        entry.keyframe = true;
+        encodeDelta(snapshot, {}, entry.data);
+        m_keyframe = snapshot;
+        m_keyframeId = entry.id;
+        m_hasKeyframe = true;
+        m_deltasSinceKeyframe = 0;
+    } else {
+        encodeDelta(snapshot, m_keyframe, entry.data);
+        ++m_deltasSinceKeyframe;
+    }
+    m_bytesUsed += entry.data.size();
+    m_entries.push_back(std::move(entry));
+    evictToBudget();
+}
+
+bool RewindBuffer::pop(std::vector<uint8_t>& out) {
+    if (m_entries.empty()) {
+        return false;
+    }
+    refreshKeyframe();
+    auto entry = std::move(m_entries.back());
+    m_entries.pop_back();
+    m_bytesUsed -= entry.data.size();
+
+    if (entry.keyframe) {
+        out = m_keyframe;
+    } else {
+        decodeDelta(entry.data, m_keyframe, out);
+    }
+
+    // later pushes continue the group that is now newest
+    m_hasKeyframe = false;
+    m_deltasSinceKeyframe = 0;
+    for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it) {
+        if (it->keyframe) {
+            m_hasKeyframe = true;
+            break;
+        }
+        ++m_deltasSinceKeyframe;
+    }
+    if (m_hasKeyframe) {
+        refreshKeyframe();
+    }
+    return true;
+}
+
+void RewindBuffer::clear() {
+    m_entries.clear();
+    m_bytesUsed = 0;
+    m_hasKeyframe = false;
+    m_deltasSinceKeyframe = 0;
+}
+
+void RewindBuffer::refreshKeyframe() {
+    for (auto it = m_entries.rbegin(); it != m_entries.rend(); ++it) {
+        if (it->keyframe) {
+            if (it->id != m_keyframeId) {
+                decodeDelta(it->data, {}, m_keyframe);
+                m_keyframeId = it->id;
+            }
+            return;
+        }
+    }
+}
+
+void RewindBuffer::evictToBudget() {
+    // drop whole keyframe groups from the oldest end, the newest group always stays so pushes can reference it
+    while (m_bytesUsed > m_budgetBytes) {
+        auto groupEnd = std::find_if(m_entries.begin() + 1, m_entries.end(), [](const Entry& e) { return e.keyframe; });
+        if (groupEnd == m_entries.end()) {
+            return;
+        }
+        for (auto it = m_entries.begin(); it != groupEnd; ++it) {
+            m_bytesUsed -= it->data.size();
+        }
+        m_entries.erase(m_entries.begin(), groupEnd);
+    }
+}
+
+} // namespace ez
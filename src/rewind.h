@@ -0,0 +1,45 @@
+#pragma once
+#include "base.h"
+#include <deque>
+
+namespace ez {
+
+// history of per-frame snapshots inside a fixed memory budget. every keyframeInterval-th snapshot is a keyframe,
+// the ones in between are stored as run length encoded xor deltas against it so unchanged bytes cost next to nothing
+class RewindBuffer {
+  public:
+    RewindBuffer(size_t budgetBytes, int keyframeInterval);
+
+    void push(const std::vector<uint8_t>& snapshot);
+    // writes the most recent snapshot to out and drops it from the history, false once the history is empty
+    bool pop(std::vector<uint8_t>& out);
+    void clear();
+
+    size_t size() const { return m_entries.size(); }
+    size_t bytesUsed() const { return m_bytesUsed; }
+
+  private:
+    struct Entry {
+        std::vector<uint8_t> data;
+        uint64_t id = 0;
+        bool keyframe = false;
+    };
+
+    // makes m_keyframe hold the decoded form of the newest keyframe still in the history
+    void refreshKeyframe();
+    void evictToBudget();
+
+    size_t m_budgetBytes = 0;
+    int m_keyframeInterval = 0;
+
+    std::deque<Entry> m_entries;
+    size_t m_bytesUsed = 0;
+    uint64_t m_nextId = 0;
+    int m_deltasSinceKeyframe = 0;
+
+    std::vector<uint8_t> m_keyframe;
+    uint64_t m_keyframeId = 0;
+    bool m_hasKeyframe = false;
+};
+
+} // namespace ez
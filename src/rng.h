@@ -0,0 +1,20 @@
+#pragma once
+#include "base.h"
+
+namespace ez {
+
+// splitmix64, tiny state, cheap enough for every Cxkk and plain arithmetic so lanes of a batch vectorize
+struct Rng {
+    uint64_t state = 0;
+
+    constexpr uint64_t next() {
+        state += 0x9E3779B97F4A7C15ull;
+        auto z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    constexpr uint8_t nextByte() { return uint8_t(next() >> 56); }
+};
+
+} // namespace ez
@@ -0,0 +1,87 @@
+#include "savestate.h"
+
+namespace ez {
+
+void writeSnapshot(const SnapshotState& state, std::vector<uint8_t>& out) {
+    auto writer = SnapshotWriter(out);
+    writer.write(SNAPSHOT_MAGIC);
+    writer.write(SNAPSHOT_VERSION);
+
+    writer.write(state.regV);
+    writer.write(state.regI);
+    writer.write(state.pc);
+    writer.write(state.sp);
+    writer.write(state.delayTimer);
+    writer.write(state.soundTimer);
+    writer.write(uint8_t(state.waitingForKey));
+    writer.write(state.keyWaitRegIdx);
+    writer.write(state.keyWaitKeysDown);
+    writer.write(uint8_t(state.quirkProfile));
+    writer.write(state.cycleCount);
+    writer.write(state.frameCount);
+    writer.write(state.timerPhase);
+    writer.write(state.rngState);
+    writer.writeBytes(state.memory.data(), quirksOf(state.quirkProfile).memoryBytes());
+    writer.write(state.planes);
+    writer.write(uint8_t(state.hires));
+    writer.write(state.planeMask);
+    writer.write(state.flagRegisters);
+    writer.write(state.audioPattern);
+    writer.write(state.pitch);
+    writer.write(uint8_t(state.exited));
+
+    writer.write(uint16_t(state.stack.size()));
+    for (const auto address : state.stack) {
+        writer.write(address);
+    }
+}
+
+bool readSnapshot(const uint8_t* data, size_t size, SnapshotState& state) {
+    auto reader = SnapshotReader(data, size);
+    auto magic = decltype(SNAPSHOT_MAGIC){};
+    uint16_t version = 0;
+    if (!reader.read(magic) || magic != SNAPSHOT_MAGIC || !reader.read(version) || version != SNAPSHOT_VERSION) {
+        log_warn("Not a version {} snapshot", SNAPSHOT_VERSION);
+        return false;
+    }
+
+    uint8_t waitingForKey = 0, quirkProfile = 0, hires = 0, exited = 0;
+    uint16_t stackSize = 0;
+    bool ok = reader.read(state.regV) && reader.read(state.regI) && reader.read(state.pc) && reader.read(state.sp) && reader.read(state.delayTimer) &&
+              reader.read(state.soundTimer) && reader.read(waitingForKey) && reader.read(state.keyWaitRegIdx) && reader.read(state.keyWaitKeysDown) &&
+              reader.read(quirkProfile) && quirkProfile < uint8_t(QuirkProfile::Count) && reader.read(state.cycleCount) &&
+              reader.read(state.frameCount) && reader.read(state.timerPhase) && reader.read(state.rngState) &&
+              reader.readBytes(state.memory.data(), quirksOf(QuirkProfile(quirkProfile)).memoryBytes()) && reader.read(state.planes) &&
+              reader.read(hires) && reader.read(state.planeMask) && reader.read(state.flagRegisters) && reader.read(state.audioPattern) &&
+              reader.read(state.pitch) && reader.read(exited) && reader.read(stackSize) && stackSize <= Emu::STACK_DEPTH &&
+              stackSize == state.sp;
+    // the machine's stack is fixed size, a deeper one could never have been saved
+    state.stack.resize(ok ? stackSize : 0);
+    for (auto& address : state.stack) {
+        ok = ok && reader.read(address);
+    }
+    // lores frames only ever use the first word of the first HEIGHT_PX rows
+    const auto outsideLores = [&](const Display::Plane& plane) {
+        for (auto y = 0; y < Display::HIRES_HEIGHT_PX; ++y) {
+            for (auto w = 0; w < Display::WORDS_PER_ROW; ++w) {
+                if ((y >= Display::HEIGHT_PX || w > 0) && plane[y * Display::WORDS_PER_ROW + w] != 0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    if (!ok || !reader.atEnd() || state.keyWaitRegIdx >= state.regV.size() || state.pc >= quirksOf(QuirkProfile(quirkProfile)).memoryBytes() ||
+        state.timerPhase < 0 || state.timerPhase >= Emu::INSTRUCTIONS_PER_SECOND ||
+        state.planeMask >= 1 << Display::PLANES || (!hires && (outsideLores(state.planes[0]) || outsideLores(state.planes[1])))) {
+        log_warn("Malformed snapshot");
+        return false;
+    }
+    state.waitingForKey = waitingForKey;
+    state.quirkProfile = QuirkProfile(quirkProfile);
+    state.hires = hires;
+    state.exited = exited;
+    return true;
+}
+
+} // namespace ez
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+#include "emu.h"
+
+namespace ez {
+
+// snapshots are a magic + version header followed by raw little endian fields, every field is fixed size except the
+// trailing call stack so consecutive snapshots of one machine line up byte for byte and delta compress well
+static constexpr std::array<uint8_t, 4> SNAPSHOT_MAGIC = {'C', '8', 'S', 'S'};
+static constexpr uint16_t SNAPSHOT_VERSION = 4;
+
+class SnapshotWriter {
+  public:
+    explicit SnapshotWriter(std::vector<uint8_t>& out) : m_out(out) { m_out.clear(); }
+
+    template <typename T> void write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto bytes = reinterpret_cast<const uint8_t*>(&value);
+        m_out.insert(m_out.end(), bytes, bytes + sizeof(T));
+    }
+    void writeBytes(const uint8_t* data, size_t size) { m_out.insert(m_out.end(), data, data + size); }
+
+  private:
+    std::vector<uint8_t>& m_out;
+};
+
+class SnapshotReader {
+  public:
+    SnapshotReader(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+    // returns false and leaves value untouched if the snapshot is too short
+    template <typename T> bool read(T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (m_size - m_offset < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, m_data + m_offset, sizeof(T));
+        m_offset += sizeof(T);
+        return true;
+    }
+    bool readBytes(uint8_t* data, size_t size) {
+        if (m_size - m_offset < size) {
+            return false;
+        }
+        memcpy(data, m_data + m_offset, size);
+        m_offset += size;
+        return true;
+    }
+
+    bool atEnd() const { return m_offset == m_size; }
+
+  private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+};
+
+// the machine as stored in a snapshot, independent of how a backend lays its state out in memory
+struct SnapshotState {
+    std::array<uint8_t, 16> regV{};
+    uint16_t regI = 0;
+    uint16_t pc = 0;
+    uint8_t sp = 0;
+    uint8_t delayTimer = 0;
+    uint8_t soundTimer = 0;
+    bool waitingForKey = false;
+    uint8_t keyWaitRegIdx = 0;
+    KeypadInput keyWaitKeysDown = 0;
+    QuirkProfile quirkProfile = QuirkProfile::Chip8;
+    uint64_t cycleCount = 0;
+    uint64_t frameCount = 0;
+    int32_t timerPhase = 0;
+    uint64_t rngState = 0;
+    // only the part the profile can address is stored, the rest reads back as zero
+    std::array<uint8_t, Emu::MEM_SIZE_BYTES> memory{};
+    Display::Planes planes{};
+    bool hires = false;
+    uint8_t planeMask = 0b01;
+    std::array<uint8_t, 16> flagRegisters{};
+    std::array<uint8_t, 16> audioPattern{};
+    uint8_t pitch = 64;
+    bool exited = false;
+    std::vector<uint16_t> stack;
+};
+
+void writeSnapshot(const SnapshotState& state, std::vector<uint8_t>& out);
+// returns false if the snapshot is malformed or from another version
+bool readSnapshot(const uint8_t* data, size_t size, SnapshotState& state);
+
+} // namespace ez
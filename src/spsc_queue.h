@@ -0,0 +1,54 @@
+#pragma once
+#include "base.h"
+#include <atomic>
+#include <bit>
+
+namespace ez {
+
+// bounded wait free queue for exactly one producer thread and one consumer thread. each side caches the other
+// side's index and only reloads it when the queue looks full or empty, so the shared cache lines are touched
+// about once per batch rather than once per item
+template <typename T, size_t Capacity> class SpscQueue {
+    static_assert(std::has_single_bit(Capacity), "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+    // producer only, returns false if the queue is full
+    bool push(const T& item) {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == Capacity) {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == Capacity) {
+                return false;
+            }
+        }
+        m_items[tail & (Capacity - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only, the oldest item or null if the queue is empty. stays valid until pop
+    const T* front() {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache) {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache) {
+                return nullptr;
+            }
+        }
+        return &m_items[head & (Capacity - 1)];
+    }
+
+    // consumer only, drops the item front returned
+    void pop() { m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  private:
+    // indices only ever grow, wrapping is fine since capacity divides 2^64
+    alignas(64) std::atomic<size_t> m_head = 0;
+    size_t m_tailCache = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+    size_t m_headCache = 0;
+    alignas(64) std::array<T, Capacity> m_items{};
+};
+
+} // namespace ez
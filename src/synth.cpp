@@ -0,0 +1,105 @@
+#include "synth.h"
+#include <cmath>
+#include <numbers>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define EZ_SYNTH_KERNEL_SSE2 1
+#endif
+
+namespace ez {
+
+static constexpr auto FREQUENCIES = std::array<double, 3>{110.0, 130.81, 164.81}; // Am
+static constexpr float MAX_AMPLITUDE = 0.4f;
+// gain change per second when starting or stopping, ramps instead of cutting off abruptly
+static constexpr float GAIN_RAMP = 10.0f;
+// samples handled per pass, one sse register
+static constexpr size_t CHUNK = 4;
+
+// sines of a phase where 2^32 is one period: fold into [-pi/2, pi/2] and evaluate the taylor series up to x^9, the
+// error is below 4e-6 which is far under 16 bit output resolution. no table and no branches so it maps straight
+// onto simd lanes
+static constexpr float PI = std::numbers::pi_v<float>;
+static constexpr float PHASE_TO_RADIANS = PI / 2147483648.0f;
+static constexpr float SIN_C3 = -1.0f / 6;
+static constexpr float SIN_C5 = 1.0f / 120;
+static constexpr float SIN_C7 = -1.0f / 5040;
+static constexpr float SIN_C9 = 1.0f / 362880;
+
+// adds the voices at phase + i * step for i in [0, CHUNK) to mix
+static void mixChunk(const uint32_t* phases, const uint32_t* steps, size_t voices, float* mix) {
+#if defined(EZ_SYNTH_KERNEL_SSE2)
+    const auto halfPi = _mm_set1_ps(PI / 2);
+    const auto negHalfPi = _mm_set1_ps(-PI / 2);
+    const auto pi = _mm_set1_ps(PI);
+    const auto negPi = _mm_set1_ps(-PI);
+    auto sum = _mm_setzero_ps();
+    for (size_t v = 0; v < voices; ++v) {
+        const auto step = steps[v];
+        const auto phase = _mm_setr_epi32(int(phases[v]), int(phases[v] + step), int(phases[v] + 2 * step), int(phases[v] + 3 * step));
+        auto x = _mm_mul_ps(_mm_cvtepi32_ps(phase), _mm_set1_ps(PHASE_TO_RADIANS));
+        const auto above = _mm_cmpgt_ps(x, halfPi);
+        x = _mm_or_ps(_mm_and_ps(above, _mm_sub_ps(pi, x)), _mm_andnot_ps(above, x));
+        const auto below = _mm_cmplt_ps(x, negHalfPi);
+        x = _mm_or_ps(_mm_and_ps(below, _mm_sub_ps(negPi, x)), _mm_andnot_ps(below, x));
+        const auto x2 = _mm_mul_ps(x, x);
+        auto poly = _mm_add_ps(_mm_set1_ps(SIN_C7), _mm_mul_ps(x2, _mm_set1_ps(SIN_C9)));
+        poly = _mm_add_ps(_mm_set1_ps(SIN_C5), _mm_mul_ps(x2, poly));
+        poly = _mm_add_ps(_mm_set1_ps(SIN_C3), _mm_mul_ps(x2, poly));
+        poly = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(x2, poly));
+        sum = _mm_add_ps(sum, _mm_mul_ps(x, poly));
+    }
+    _mm_storeu_ps(mix, _mm_add_ps(_mm_loadu_ps(mix), sum));
+#else
+    for (size_t v = 0; v < voices; ++v) {
+        for (size_t i = 0; i < CHUNK; ++i) {
+            auto x = float(int32_t(phases[v] + uint32_t(i) * steps[v])) * PHASE_TO_RADIANS;
+            x = x > PI / 2 ? PI - x : x;
+            x = x < -PI / 2 ? -PI - x : x;
+            const auto x2 = x * x;
+            mix[i] += x * (1.0f + x2 * (SIN_C3 + x2 * (SIN_C5 + x2 * (SIN_C7 + x2 * SIN_C9))));
+        }
+    }
+#endif
+}
+
+Synth::Synth() {
+    for (size_t v = 0; v < VOICES; ++v) {
+        m_phaseSteps[v] = uint32_t(std::llround(FREQUENCIES[v] / SAMPLE_RATE * 4294967296.0));
+    }
+}
+
+void Synth::generate(float* out, size_t count) {
+    constexpr auto gainStep = GAIN_RAMP / SAMPLE_RATE;
+    constexpr auto scale = MAX_AMPLITUDE / float(VOICES);
+    const auto gainDelta = m_playing ? gainStep : -gainStep;
+
+    size_t done = 0;
+    while (done < count) {
+        if (m_gain == 0.0f && !m_playing) {
+            // silent, nothing to synthesize. phases keep running so a restart continues the same waveform
+            const auto rest = count - done;
+            std::fill(out + done, out + count, 0.0f);
+            for (size_t v = 0; v < VOICES; ++v) {
+                m_phases[v] += uint32_t(rest) * m_phaseSteps[v];
+            }
+            return;
+        }
+
+        const auto n = std::min(CHUNK, count - done);
+        auto mix = std::array<float, CHUNK>{};
+        mixChunk(m_phases.data(), m_phaseSteps.data(), VOICES, mix.data());
+        for (size_t v = 0; v < VOICES; ++v) {
+            m_phases[v] += uint32_t(n) * m_phaseSteps[v];
+        }
+        // the gain ramp is linear until it clamps, so every sample's gain follows from the chunk start
+        for (size_t i = 0; i < n; ++i) {
+            const auto gain = clamp(m_gain + gainDelta * float(i + 1), 0.0f, 1.0f);
+            out[done + i] = mix[i] * scale * gain;
+        }
+        m_gain = clamp(m_gain + gainDelta * float(n), 0.0f, 1.0f);
+        done += n;
+    }
+}
+
+} // namespace ez
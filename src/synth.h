@@ -0,0 +1,31 @@
+#pragma once
+#include "base.h"
+
+namespace ez {
+
+// the tone generator behind Audio, kept free of SDL and threads so it can be driven headless. an A minor chord from
+// integer phase accumulators, which stay exact however long it runs, fading in and out instead of clicking
+class Synth {
+  public:
+    static constexpr int SAMPLE_RATE = 44'100;
+
+    Synth();
+
+    // starts fading towards full volume or silence from the next generated sample
+    void setPlaying(bool playing) { m_playing = playing; }
+    bool isPlaying() const { return m_playing; }
+
+    // fills out with the next count samples
+    void generate(float* out, size_t count);
+
+  private:
+    static constexpr size_t VOICES = 3;
+
+    bool m_playing = false;
+    float m_gain = 0.0f;
+
+    // one full period is 2^32
+    std::array<uint32_t, VOICES> m_phases{};
+    std::array<uint32_t, VOICES> m_phaseSteps{};
+};
+} // namespace ez
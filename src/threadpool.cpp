@@ -0,0 +1,97 @@
+#include "threadpool.h"
+
+namespace ez {
+
+ThreadPool::ThreadPool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        auto lock = std::lock_guard(m_stateMutex);
+        m_shutdown = true;
+    }
+    m_workAvailable.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    // spread submissions round robin, stealing evens out whatever imbalance is left
+    const auto idx = m_nextQueue++ % m_queues.size();
+    {
+        auto lock = std::lock_guard(m_queues[idx]->mutex);
+        m_queues[idx]->tasks.push_back(std::move(task));
+    }
+    {
+        auto lock = std::lock_guard(m_stateMutex);
+        ++m_queuedTasks;
+        ++m_unfinishedTasks;
+    }
+    m_workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+    auto lock = std::unique_lock(m_stateMutex);
+    m_allDone.wait(lock, [this]() { return m_unfinishedTasks == 0; });
+}
+
+bool ThreadPool::popOwn(size_t idx, Task& task) {
+    auto& queue = *m_queues[idx];
+    auto lock = std::lock_guard(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    // oldest first, tasks start in the order they were submitted, see submit
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(size_t thiefIdx, Task& task) {
+    for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+        auto& queue = *m_queues[(thiefIdx + offset) % m_queues.size()];
+        auto lock = std::lock_guard(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t idx) {
+    for (;;) {
+        {
+            auto lock = std::unique_lock(m_stateMutex);
+            m_workAvailable.wait(lock, [this]() { return m_queuedTasks > 0 || m_shutdown; });
+            if (m_queuedTasks == 0 && m_shutdown) {
+                return;
+            }
+            // claim one task up front so exactly as many workers go looking as there are tasks to find
+            --m_queuedTasks;
+        }
+
+        auto task = Task{};
+        while (!popOwn(idx, task) && !steal(idx, task)) {
+            // the claimed task is still being pushed by submit
+            std::this_thread::yield();
+        }
+        task();
+
+        auto lock = std::lock_guard(m_stateMutex);
+        if (--m_unfinishedTasks == 0) {
+            m_allDone.notify_all();
+        }
+    }
+}
+
+} // namespace ez
@@ -0,0 +1,52 @@
+#pragma once
+#include "base.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace ez {
+
+// fixed set of workers, each with its own task deque. a worker pops its own oldest task and when it runs dry steals
+// the oldest task of another worker, so tasks start roughly in the order they were submitted. submitting the longest
+// ones first keeps a few long jobs from running alone at the end while the rest of the cores are idle
+class ThreadPool {
+  public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+
+    size_t threadCount() const { return m_queues.size(); }
+
+    void submit(Task task);
+    // blocks until every submitted task has finished
+    void wait();
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(size_t idx);
+    bool popOwn(size_t idx, Task& task);
+    bool steal(size_t thiefIdx, Task& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_nextQueue = 0;
+
+    std::mutex m_stateMutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_allDone;
+    size_t m_queuedTasks = 0;
+    size_t m_unfinishedTasks = 0;
+    bool m_shutdown = false;
+};
+
+} // namespace ez
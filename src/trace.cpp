@@ -0,0 +1,85 @@
+#include "trace.h"
+#include <fstream>
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ez {
+
+std::unique_ptr<TraceWriter> TraceWriter::create(const std::filesystem::path& path, QuirkProfile quirks, uint32_t capacity) {
+#if defined(_WIN32)
+    (void)quirks;
+    (void)capacity;
+    log_error("Failed to create trace {}: execution traces need mmap, which this platform doesn't have", path.string());
+    return nullptr;
+#else
+    capacity = std::bit_ceil(std::max<uint32_t>(capacity, 1));
+    const auto size = sizeof(TraceHeader) + size_t(capacity) * sizeof(TraceRecord);
+    const auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("Failed to create trace {}: {}", path.string(), strerror(errno));
+        return nullptr;
+    }
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        log_error("Failed to map trace {}: {}", path.string(), strerror(errno));
+        return nullptr;
+    }
+    auto* header = new (memory) TraceHeader{};
+    header->magic = TraceHeader::MAGIC;
+    header->version = TraceHeader::VERSION;
+    header->recordSize = sizeof(TraceRecord);
+    header->capacity = capacity;
+    header->quirks = quirks;
+    return std::unique_ptr<TraceWriter>(new TraceWriter(path, memory, size));
+#endif
+}
+
+TraceWriter::TraceWriter(std::filesystem::path path, void* mapping, size_t mappingSize)
+    : m_path(std::move(path)), m_mapping(mapping), m_mappingSize(mappingSize), m_header(static_cast<TraceHeader*>(mapping)),
+      m_records(reinterpret_cast<TraceRecord*>(static_cast<uint8_t*>(mapping) + sizeof(TraceHeader))), m_mask(m_header->capacity - 1) {}
+
+TraceWriter::~TraceWriter() {
+#if !defined(_WIN32)
+    munmap(m_mapping, m_mappingSize);
+#endif
+    log_info("Traced {} instructions to {}, the last {} are in the file", m_written, m_path.string(),
+             std::min<uint64_t>(m_written, m_mask + 1));
+}
+
+std::optional<Trace> Trace::load(const std::filesystem::path& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    if (!is) {
+        log_error("Failed to open trace {}", path.string());
+        return std::nullopt;
+    }
+    auto header = TraceHeader{};
+    is.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!is || header.magic != TraceHeader::MAGIC || header.version != TraceHeader::VERSION || header.recordSize != sizeof(TraceRecord) ||
+        !std::has_single_bit(header.capacity) || header.quirks >= QuirkProfile::Count) {
+        log_error("{} is not a version {} trace", path.string(), TraceHeader::VERSION);
+        return std::nullopt;
+    }
+    auto ring = std::vector<TraceRecord>(std::min<uint64_t>(header.written, header.capacity));
+    is.read(reinterpret_cast<char*>(ring.data()), std::streamsize(ring.size() * sizeof(TraceRecord)));
+    if (!is) {
+        log_error("Trace {} is truncated", path.string());
+        return std::nullopt;
+    }
+    auto trace = Trace{header.quirks, header.written, {}};
+    // once it wrapped, the oldest record is the one the next would have overwritten
+    const auto oldest = header.written > header.capacity ? size_t(header.written % header.capacity) : 0;
+    trace.records.reserve(ring.size());
+    trace.records.insert(trace.records.end(), ring.begin() + ptrdiff_t(oldest), ring.end());
+    trace.records.insert(trace.records.end(), ring.begin(), ring.begin() + ptrdiff_t(oldest));
+    return trace;
+}
+
+} // namespace ez
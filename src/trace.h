@@ -0,0 +1,129 @@
+#pragma once
+#include "quirks.h"
+#include <bit>
+
+namespace ez {
+
+// one executed instruction as the tracer saw it, fixed size so the writer is a couple of stores. i, vf and the
+// register in reg are as the instruction left them
+struct TraceRecord {
+    static constexpr uint8_t NO_REGISTER = 0xFF;
+    // set once the instruction ran to the end. a faulting instruction, or the one running when the process died,
+    // keeps the i and vf from before it
+    static constexpr uint8_t FINISHED = 0x01;
+    // more registers than reg changed, only the loads from memory do that
+    static constexpr uint8_t MORE_REGISTERS = 0x02;
+
+    // the emulated cycle it ran on, split so the record stays 16 bytes. 48 bits last years of emulated time
+    uint32_t cycleLow = 0;
+    uint16_t cycleHigh = 0;
+    uint16_t pc = 0;
+    uint16_t opcode = 0;
+    uint16_t regI = 0;
+    // the lowest of v0 - vE that changed, NO_REGISTER if none did. vf has a field of its own
+    uint8_t reg = NO_REGISTER;
+    uint8_t value = 0;
+    uint8_t vf = 0;
+    uint8_t flags = 0;
+
+    uint64_t cycle() const { return uint64_t(cycleHigh) << 32 | cycleLow; }
+};
+static_assert(sizeof(TraceRecord) == 16);
+
+// the start of a trace file, followed by capacity records. record n of the run sits at index n % capacity, so once
+// the ring wrapped the oldest one is at written % capacity. everything is little endian, mapped as it is
+struct TraceHeader {
+    static constexpr std::array<uint8_t, 4> MAGIC = {'C', '8', 'T', 'R'};
+    static constexpr uint16_t VERSION = 1;
+
+    std::array<uint8_t, 4> magic{};
+    uint16_t version = 0;
+    uint16_t recordSize = 0;
+    uint32_t capacity = 0;
+    // what the opcodes have to be decoded with
+    QuirkProfile quirks = QuirkProfile::Chip8;
+    // records started so far, updated with every one so the file is complete up to the last instruction even if the
+    // process is killed
+    alignas(8) uint64_t written = 0;
+    std::array<uint8_t, 40> reserved{};
+};
+static_assert(sizeof(TraceHeader) == 64);
+
+// appends a record per executed instruction to a memory mapped ring file, see Emu::setTrace. nothing is formatted
+// or written out on the emulation thread, the page cache takes care of getting the records to disk. read it back
+// with chip8-trace
+class TraceWriter {
+  public:
+    // records, 64 MB of file. sparse, pages are only allocated as the ring fills them
+    static constexpr uint32_t DEFAULT_CAPACITY = 4 * 1024 * 1024;
+
+    // creates or truncates the file, capacity is rounded up to a power of two. null and logged if it can't be mapped
+    static std::unique_ptr<TraceWriter> create(const std::filesystem::path& path, QuirkProfile quirks, uint32_t capacity = DEFAULT_CAPACITY);
+    ~TraceWriter();
+
+    TraceWriter(TraceWriter&) = delete;
+    TraceWriter(TraceWriter&&) = delete;
+
+    // starts the record of the instruction at pc, regs and regI are from before it ran
+    void begin(uint16_t pc, uint16_t opcode, uint64_t cycle, uint16_t regI, const std::array<uint8_t, 16>& regs) {
+        m_current = &m_records[m_written & m_mask];
+        *m_current = TraceRecord{uint32_t(cycle), uint16_t(cycle >> 32), pc, opcode, regI, TraceRecord::NO_REGISTER, 0, regs[0xF], 0};
+        m_before = regs;
+        m_header->written = ++m_written;
+    }
+
+    // completes the record begin started with what the instruction changed
+    void finish(uint16_t regI, const std::array<uint8_t, 16>& regs) {
+        auto& record = *m_current;
+        record.regI = regI;
+        record.vf = regs[0xF];
+        record.flags = TraceRecord::FINISHED;
+        // both halves at once rather than a loop over the registers, vf is the top byte of the high half
+        uint64_t before[2];
+        uint64_t after[2];
+        memcpy(before, m_before.data(), sizeof(before));
+        memcpy(after, regs.data(), sizeof(after));
+        const auto low = before[0] ^ after[0];
+        const auto high = (before[1] ^ after[1]) & 0x00FF'FFFF'FFFF'FFFF;
+        if (low == 0 && high == 0) {
+            return;
+        }
+        const auto reg = low != 0 ? std::countr_zero(low) / 8 : 8 + std::countr_zero(high) / 8;
+        record.reg = uint8_t(reg);
+        record.value = regs[size_t(reg)];
+        // whatever is left once the lowest changed byte is cleared
+        const auto rest = low != 0 ? (low & ~(uint64_t(0xFF) << (reg * 8))) | high : high & ~(uint64_t(0xFF) << ((reg - 8) * 8));
+        if (rest != 0) {
+            record.flags |= TraceRecord::MORE_REGISTERS;
+        }
+    }
+
+    uint64_t written() const { return m_written; }
+
+  private:
+    TraceWriter(std::filesystem::path path, void* mapping, size_t mappingSize);
+
+    const std::filesystem::path m_path;
+    void* const m_mapping;
+    const size_t m_mappingSize;
+    TraceHeader* const m_header;
+    TraceRecord* const m_records;
+    const uint64_t m_mask;
+    uint64_t m_written = 0;
+    TraceRecord* m_current = nullptr;
+    std::array<uint8_t, 16> m_before{};
+};
+
+// a trace file read back into memory
+struct Trace {
+    QuirkProfile quirks = QuirkProfile::Chip8;
+    // instructions traced in total, more than there are records once the ring wrapped
+    uint64_t written = 0;
+    // oldest first
+    std::vector<TraceRecord> records;
+
+    // nullopt and logged if the file is missing, malformed or from another version
+    static std::optional<Trace> load(const std::filesystem::path& path);
+};
+
+} // namespace ez
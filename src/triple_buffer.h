@@ -0,0 +1,41 @@
+#pragma once
+#include "base.h"
+#include <atomic>
+
+namespace ez {
+
+// hands the newest value from one writer thread to one reader thread without either ever waiting. the writer fills
+// the back slot and swaps it with the middle one, the reader swaps the middle slot for its front one whenever the
+// writer has published since. values the reader never got around to are simply overwritten
+template <typename T> class TripleBuffer {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+    // writer only, the slot to fill before the next publish
+    T& back() { return m_slots[m_back]; }
+    // writer only, makes the back slot the newest value
+    void publish() { m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+    // reader only, picks up the newest published value if there is one, returns false if nothing changed
+    bool update() {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    // reader only, the value picked up by the last update
+    const T& front() const { return m_slots[m_front]; }
+
+  private:
+    // the middle index carries a flag for whether the writer has published since the reader last looked
+    static constexpr uint8_t INDEX = 0b011;
+    static constexpr uint8_t FRESH = 0b100;
+
+    std::array<T, 3> m_slots{};
+    alignas(64) uint8_t m_back = 0;
+    alignas(64) std::atomic<uint8_t> m_middle = 1;
+    alignas(64) uint8_t m_front = 2;
+};
+
+} // namespace ez
@@ -0,0 +1,163 @@
+// checks BatchEmu against the interpreter, see BatchEmu::verifyAgainstEmu. every rom runs on a batch of lanes next
+// to one Emu per lane, all fed their own scripted input, and has to match it snapshot for snapshot. CTest runs every
+// bundled rom as a test of its own, once under each profile a lane can run
+//
+// usage: chip8-batch-verify [--roms dir] [--lanes n] [--cycles n] [--quirks chip8|schip] [--lane-fault] [rom]...
+//
+// with no rom names every file in --roms (roms by default) runs, spread across all cores. lanes press a key that
+// depends on the lane for a second, then let go for two, so key waits end and lanes drift apart at different times.
+// --lane-fault runs a built-in program instead, where one lane faults, and checks that the others still step as one
+// group afterwards
+
+#include "base.h"
+#include "batch.h"
+#include "threadpool.h"
+
+#include <fstream>
+
+using namespace ez;
+
+namespace {
+
+// cycles a key is held or released for, about a second
+constexpr uint64_t INPUT_PERIOD = Emu::INSTRUCTIONS_PER_SECOND;
+
+KeypadInput scriptedInput(size_t lane, uint64_t cycle) {
+    const auto period = cycle / INPUT_PERIOD;
+    if (period % 3 != 0) {
+        return 0;
+    }
+    return KeypadInput(1) << ((lane * 7 + period / 3 * 5) % 16);
+}
+
+// empty if the rom passed, otherwise why it didn't
+std::string verify(const std::filesystem::path& path, size_t lanes, QuirkProfile quirks, uint64_t cycles) {
+    auto is = std::ifstream(path, std::ios::binary);
+    if (!is) {
+        return std::format("failed to open rom {}", path.string());
+    }
+    const auto rom = std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+    if (rom.size() > size_t(BatchEmu::MEM_SIZE_BYTES - Emu::PROGRAM_START)) {
+        return std::format("{} bytes is too large for a batch lane", rom.size());
+    }
+    return BatchEmu::verifyAgainstEmu(rom.data(), rom.size(), lanes, quirks, cycles, scriptedInput);
+}
+
+// lane 0 holds key 0 and runs into a 00EE with nothing on the stack, every other lane jumps past it into a loop
+std::string verifyLaneFault(size_t lanes, uint64_t cycles) {
+    static constexpr uint8_t program[] = {
+        0x60, 0x00, // 200 ld v0, 0
+        0xE0, 0x9E, // 202 skp v0
+        0x12, 0x08, // 204 jp 208
+        0x00, 0xEE, // 206 ret, faults
+        0x71, 0x01, // 208 add v1, 1
+        0x81, 0x14, // 20A add v1, v1
+        0x12, 0x08, // 20C jp 208
+    };
+    const auto input = [](size_t lane, uint64_t) { return lane == 0 ? KeypadInput(1) : KeypadInput(0); };
+    if (auto failure = BatchEmu::verifyAgainstEmu(program, sizeof(program), lanes, QuirkProfile::Chip8, cycles, input); !failure.empty()) {
+        return failure;
+    }
+
+    auto batch = BatchEmu(program, sizeof(program), lanes);
+    auto keys = std::vector<KeypadInput>(lanes);
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        keys[lane] = input(lane, 0);
+    }
+    // ld, skp, then lane 0 is on the ret and the others on the jump
+    batch.runCycles(3, keys.data());
+    if (batch.getLaneFault(0) != Emu::Fault::StackUnderflow) {
+        return std::format("lane 0 has fault {} after its 00EE", to_string(batch.getLaneFault(0)));
+    }
+    const auto uniformBefore = batch.getUniformCycles();
+    const auto divergentBefore = batch.getDivergentCycles();
+    batch.runCycles(cycles, keys.data());
+    // every cycle after the fault is one group of all the other lanes, a lane on its own if there is only one other
+    const auto expectedUniform = lanes > 2 ? cycles : 0;
+    const auto expectedDivergent = lanes == 2 ? cycles : 0;
+    if (batch.getUniformCycles() - uniformBefore != expectedUniform || batch.getDivergentCycles() - divergentBefore != expectedDivergent) {
+        return std::format("{} uniform and {} divergent groups in {} cycles after lane 0 faulted", batch.getUniformCycles() - uniformBefore,
+                           batch.getDivergentCycles() - divergentBefore, cycles);
+    }
+    return {};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto romDir = std::filesystem::path("roms");
+    size_t lanes = 8;
+    uint64_t cycles = 20 * Emu::INSTRUCTIONS_PER_SECOND;
+    auto quirks = QuirkProfile::Chip8;
+    auto roms = std::vector<std::filesystem::path>{};
+    bool laneFault = false;
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--roms" && hasValue) {
+            romDir = argv[++i];
+        } else if (arg == "--lanes" && hasValue) {
+            lanes = std::max<size_t>(std::stoull(argv[++i]), 1);
+        } else if (arg == "--cycles" && hasValue) {
+            cycles = std::stoull(argv[++i]);
+        } else if (arg == "--quirks" && hasValue) {
+            const auto profile = parseQuirkProfile(argv[++i]);
+            // xochip's 64 KB don't fit in a lane
+            if (!profile || quirksOf(*profile).memoryBytes() > BatchEmu::MEM_SIZE_BYTES) {
+                log_error("Unknown quirk profile {}, expected chip8 or schip", argv[i]);
+                return 1;
+            }
+            quirks = *profile;
+        } else if (arg == "--lane-fault") {
+            laneFault = true;
+        } else if (arg.starts_with("--")) {
+            log_error("Unknown option {}", arg);
+            return 1;
+        } else {
+            roms.emplace_back(arg);
+        }
+    }
+
+    if (laneFault) {
+        const auto failure = verifyLaneFault(lanes, cycles);
+        if (!failure.empty()) {
+            log_error("lane fault: {}", failure);
+            return 1;
+        }
+        log_info("The other {} lanes kept running as one group after lane 0 faulted", lanes - 1);
+        return 0;
+    }
+
+    if (roms.empty()) {
+        auto ec = std::error_code{};
+        for (const auto& entry : std::filesystem::directory_iterator(romDir, ec)) {
+            if (entry.is_regular_file()) {
+                roms.push_back(entry.path());
+            }
+        }
+        if (ec || roms.empty()) {
+            log_error("No roms in {}", romDir.string());
+            return 1;
+        }
+        std::sort(roms.begin(), roms.end());
+    }
+
+    auto failures = std::vector<std::string>(roms.size());
+    {
+        auto pool = ThreadPool();
+        for (size_t idx = 0; idx < roms.size(); ++idx) {
+            pool.submit([&, idx]() { failures[idx] = verify(roms[idx], lanes, quirks, cycles); });
+        }
+        pool.wait();
+    }
+
+    size_t failed = 0;
+    for (size_t idx = 0; idx < roms.size(); ++idx) {
+        if (!failures[idx].empty()) {
+            log_error("{}: {}", roms[idx].filename().string(), failures[idx]);
+            ++failed;
+        }
+    }
+    log_info("{} of {} roms matched the interpreter on {} lanes under {}", roms.size() - failed, roms.size(), lanes, to_string(quirks));
+    return failed == 0 ? 0 : 1;
+}
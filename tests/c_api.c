@@ -0,0 +1,164 @@
+/* exercises the C interface of chip8core from C, the way an embedding program sees it: creating machines, loading
+ * and stepping roms, reading the display back, and every call turning bad arguments and bad programs into statuses
+ * rather than taking the process down. exits non zero if any check failed
+ *
+ * usage: chip8-c-api */
+
+#include "chip8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int g_failed = 0;
+static int g_logLines = 0;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                  \
+            ++g_failed;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+static void countLog(chip8_log_level level, const char* line, void* user) {
+    (void)level;
+    CHECK(line != NULL && strchr(line, '\n') == NULL);
+    CHECK(user == &g_logLines);
+    ++g_logLines;
+}
+
+/* registered before the library logs anything, so it runs after the library drained its log on exit */
+static void checkLogged(void) {
+    if (g_logLines == 0) {
+        fprintf(stderr, "the log callback never ran\n");
+        _Exit(1);
+    }
+}
+
+/* loads rom under quirks and steps it for frames, returning the status of the step */
+static chip8_status run(chip8_emu* emu, const uint8_t* rom, size_t size, chip8_quirks quirks, uint64_t frames) {
+    const uint32_t keys = 0;
+    const chip8_status loaded = chip8_load_rom(emu, rom, size, quirks, 0);
+    CHECK(loaded == CHIP8_OK);
+    return chip8_step(&emu, &keys, 1, frames, NULL);
+}
+
+static void testArguments(void) {
+    chip8_emu* emu = NULL;
+    chip8_cpu cpu;
+    chip8_display display;
+    const uint32_t keys = 0;
+    const uint8_t rom[2] = {0x12, 0x00};
+
+    CHECK(chip8_abi_version() == CHIP8_ABI_VERSION);
+    CHECK(strcmp(chip8_status_string(CHIP8_ERROR_ROM_TOO_LARGE), "rom too large") == 0);
+    CHECK(chip8_create(NULL) == CHIP8_ERROR_INVALID_ARGUMENT);
+    chip8_destroy(NULL);
+
+    CHECK(chip8_load_rom(NULL, rom, sizeof(rom), CHIP8_QUIRKS_AUTO, 0) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_set_jit(NULL, 1) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_get_cpu(NULL, &cpu) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_get_display(NULL, &display) == CHIP8_ERROR_INVALID_ARGUMENT);
+
+    CHECK(chip8_create(&emu) == CHIP8_OK && emu != NULL);
+    if (!emu) {
+        return;
+    }
+    CHECK(chip8_load_rom(emu, NULL, 2, CHIP8_QUIRKS_AUTO, 0) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_load_rom(emu, rom, sizeof(rom), (chip8_quirks)7, 0) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_load_rom(emu, NULL, 0, CHIP8_QUIRKS_AUTO, 0) == CHIP8_OK);
+    CHECK(chip8_get_cpu(emu, NULL) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_get_display(emu, NULL) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_step(NULL, &keys, 1, 1, NULL) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_step(&emu, NULL, 1, 1, NULL) == CHIP8_ERROR_INVALID_ARGUMENT);
+    CHECK(chip8_step(NULL, NULL, 0, 1, NULL) == CHIP8_OK);
+
+    /* a null machine in a batch fails on its own, the others still run */
+    {
+        chip8_emu* emus[2] = {emu, NULL};
+        const uint32_t batchKeys[2] = {0, 0};
+        chip8_status statuses[2] = {CHIP8_ERROR_INTERNAL, CHIP8_OK};
+        CHECK(chip8_load_rom(emu, rom, sizeof(rom), CHIP8_QUIRKS_CHIP8, 0) == CHIP8_OK);
+        CHECK(chip8_step(emus, batchKeys, 2, 1, statuses) == CHIP8_ERROR_INVALID_ARGUMENT);
+        CHECK(statuses[0] == CHIP8_OK && statuses[1] == CHIP8_ERROR_INVALID_ARGUMENT);
+    }
+    chip8_destroy(emu);
+}
+
+/* each profile takes programs up to the end of its memory and no further */
+static void testRomSizes(void) {
+    static uint8_t rom[0x10000 - 0x200 + 2];
+    chip8_emu* emu = NULL;
+    CHECK(chip8_create(&emu) == CHIP8_OK);
+    if (!emu) {
+        return;
+    }
+    /* a program of nothing but jumps to itself, whatever size it is cut to */
+    for (size_t i = 0; i < sizeof(rom); i += 2) {
+        rom[i] = 0x12;
+        rom[i + 1] = 0x00;
+    }
+    CHECK(chip8_load_rom(emu, rom, 0x1000 - 0x200, CHIP8_QUIRKS_CHIP8, 0) == CHIP8_OK);
+    CHECK(chip8_load_rom(emu, rom, 0x1000 - 0x200 + 1, CHIP8_QUIRKS_CHIP8, 0) == CHIP8_ERROR_ROM_TOO_LARGE);
+    CHECK(chip8_load_rom(emu, rom, 0x1000 - 0x200, CHIP8_QUIRKS_SCHIP, 0) == CHIP8_OK);
+    CHECK(chip8_load_rom(emu, rom, 0x1000 - 0x200 + 1, CHIP8_QUIRKS_SCHIP, 0) == CHIP8_ERROR_ROM_TOO_LARGE);
+    CHECK(chip8_load_rom(emu, rom, 6000, CHIP8_QUIRKS_XOCHIP, 0) == CHIP8_OK);
+    CHECK(chip8_load_rom(emu, rom, 0x10000 - 0x200, CHIP8_QUIRKS_XOCHIP, 0) == CHIP8_OK);
+    CHECK(chip8_load_rom(emu, rom, 0x10000 - 0x200 + 1, CHIP8_QUIRKS_XOCHIP, 0) == CHIP8_ERROR_ROM_TOO_LARGE);
+    /* an unknown rom runs as chip8 */
+    CHECK(chip8_load_rom(emu, rom, 6000, CHIP8_QUIRKS_AUTO, 0) == CHIP8_ERROR_ROM_TOO_LARGE);
+    chip8_destroy(emu);
+}
+
+static void testRun(int jit) {
+    /* draws the font's 0 at the top left and loops */
+    static const uint8_t draw[] = {0x60, 0x00, 0xF0, 0x29, 0xD0, 0x05, 0x12, 0x06};
+    static const uint8_t underflow[] = {0x00, 0xEE};
+    /* Bnnn to 0x10FE, past the end of 4 KB */
+    static const uint8_t wrap[] = {0x60, 0xFF, 0xBF, 0xFF};
+    /* a SYS call, which only logs */
+    static const uint8_t sys[] = {0x00, 0x00, 0x12, 0x00};
+    chip8_emu* emu = NULL;
+    chip8_display display;
+    const uint64_t* plane = NULL;
+    chip8_cpu cpu;
+    CHECK(chip8_create(&emu) == CHIP8_OK);
+    if (!emu) {
+        return;
+    }
+    CHECK(chip8_set_jit(emu, jit) == CHIP8_OK);
+
+    CHECK(run(emu, draw, sizeof(draw), CHIP8_QUIRKS_CHIP8, 2) == CHIP8_OK);
+    CHECK(chip8_get_display(emu, &display) == CHIP8_OK);
+    CHECK(display.width == 64 && display.height == 32 && !display.hires && display.words_per_row >= 1);
+    CHECK(display.planes[0][0] >> 56 == 0xF0 && display.planes[0][display.words_per_row] >> 56 == 0x90);
+    CHECK(chip8_get_cpu(emu, &cpu) == CHIP8_OK);
+    CHECK(cpu.pc == 0x206 && cpu.i == 0 && cpu.frames == 2);
+
+    CHECK(run(emu, underflow, sizeof(underflow), CHIP8_QUIRKS_CHIP8, 1) == CHIP8_FAULT_STACK_UNDERFLOW);
+    CHECK(chip8_get_cpu(emu, &cpu) == CHIP8_OK && cpu.pc == 0x200);
+    /* loading a rom powers the same machine back on, the planes stay where they were and start out blank */
+    plane = display.planes[0];
+    CHECK(chip8_get_display(emu, &display) == CHIP8_OK);
+    CHECK(display.planes[0] == plane && display.planes[0][0] == 0);
+
+    CHECK(run(emu, wrap, sizeof(wrap), CHIP8_QUIRKS_CHIP8, 10) == CHIP8_OK);
+    CHECK(run(emu, wrap, sizeof(wrap), CHIP8_QUIRKS_SCHIP, 10) == CHIP8_OK);
+    CHECK(run(emu, sys, sizeof(sys), CHIP8_QUIRKS_CHIP8, 1) == CHIP8_OK);
+    chip8_destroy(emu);
+}
+
+int main(void) {
+    atexit(checkLogged);
+    chip8_set_log(countLog, &g_logLines);
+    testArguments();
+    testRomSizes();
+    testRun(0);
+    testRun(1);
+    if (g_failed > 0) {
+        fprintf(stderr, "%d checks failed\n", g_failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+// conformance suite for the Timendus test roms and a few regression roms of its own. each case runs a rom headlessly
+// for a fixed number of frames with scripted input and checks the final framebuffer against a golden one, see
+// tests/conformance/cases.txt. CTest runs every case as a test of its own, so ctest -j spreads them across cores
+//
+// usage: chip8-conformance [--dir dir] [--roms dir] [--diffs dir] [--update] [case]...
+//
+// cases.txt in --dir (tests/conformance by default) holds one case per line, blank lines and anything after # are
+// ignored:
+//     <name> <rom> <chip8 | schip | xochip> <frames> [<frame>:<hex keys>]...
+// e.g. "60:1A 70:" holds keys 1 and A from frame 60 and releases them from frame 70. roms are looked up in roms/ under
+// --dir first and then in --roms.
+//
+// every case runs four times, on the interpreter, on the jit, on the jit checked against the interpreter and with idle
+// skipping off, and each run has to end on the hash in golden/<name>.txt. changes to the interpreter or Display that
+// are meant to be invisible have to keep all of them green. a mismatch writes <name>.ppm into --diffs, white where
+// both frames are lit, red where only the golden one is and green where only this run is. --update writes the goldens
+// from the interpreter run instead. with no case names every case runs, spread across all cores
+
+#include "base.h"
+#include "emu.h"
+#include "threadpool.h"
+
+#include <fstream>
+#include <sstream>
+
+using namespace ez;
+
+namespace {
+
+struct Case {
+    std::string name;
+    std::string rom;
+    QuirkProfile quirks = QuirkProfile::Chip8;
+    uint64_t frames = 0;
+    // sorted by frame, the keys held from that frame until the next entry
+    std::vector<std::pair<uint64_t, KeypadInput>> input;
+};
+
+// a final framebuffer as the golden files store it, one colour index per pixel at the resolution of its mode
+struct Frame {
+    uint64_t hash = 0;
+    bool hires = false;
+    std::vector<uint8_t> pixels;
+
+    int width() const { return hires ? Display::HIRES_WIDTH_PX : Display::WIDTH_PX; }
+    int height() const { return hires ? Display::HIRES_HEIGHT_PX : Display::HEIGHT_PX; }
+};
+
+struct Variant {
+    const char* name;
+    Emu::Backend backend;
+    bool idleSkipping;
+};
+
+// the first one writes the goldens
+constexpr std::array<Variant, 4> VARIANTS = {{
+    {"interpreter", Emu::Backend::Interpreter, true},
+    {"jit", Emu::Backend::Jit, true},
+    // compiles every block however short and compares the registers with the interpreter after each one
+    {"jit checked", Emu::Backend::JitChecked, true},
+    {"no idle skip", Emu::Backend::Interpreter, false},
+}};
+
+// colour index to golden file character
+constexpr std::array<char, 4> PIXEL_CHARS = {'.', '#', '+', '@'};
+
+std::optional<std::vector<Case>> readCases(const std::filesystem::path& path) {
+    auto is = std::ifstream(path);
+    if (!is) {
+        log_error("Failed to open {}", path.string());
+        return std::nullopt;
+    }
+    auto cases = std::vector<Case>{};
+    auto line = std::string{};
+    for (auto lineNum = 1; std::getline(is, line); ++lineNum) {
+        line = line.substr(0, line.find('#'));
+        auto fields = std::istringstream(line);
+        auto testCase = Case{};
+        auto quirks = std::string{};
+        if (!(fields >> testCase.name)) {
+            continue;
+        }
+        const auto profile = (fields >> testCase.rom >> quirks) ? parseQuirkProfile(quirks) : std::nullopt;
+        if (!profile || !(fields >> testCase.frames)) {
+            log_error("{}:{}: expected <name> <rom> <quirks> <frames>", path.string(), lineNum);
+            return std::nullopt;
+        }
+        testCase.quirks = *profile;
+        auto change = std::string{};
+        while (fields >> change) {
+            const auto colon = change.find(':');
+            auto frame = uint64_t{};
+            if (colon == std::string::npos || !(std::istringstream(change.substr(0, colon)) >> frame) ||
+                (!testCase.input.empty() && testCase.input.back().first >= frame)) {
+                log_error("{}:{}: '{}' is not <frame>:<hex keys> with frames increasing", path.string(), lineNum, change);
+                return std::nullopt;
+            }
+            KeypadInput keys = 0;
+            for (const auto key : change.substr(colon + 1)) {
+                if (!std::isxdigit(uint8_t(key))) {
+                    log_error("{}:{}: '{}' is not a hex key", path.string(), lineNum, key);
+                    return std::nullopt;
+                }
+                keys |= KeypadInput(1) << std::stoi(std::string(1, key), nullptr, 16);
+            }
+            testCase.input.emplace_back(frame, keys);
+        }
+        cases.push_back(std::move(testCase));
+    }
+    return cases;
+}
+
+Frame run(const Case& testCase, const std::vector<uint8_t>& rom, const Variant& variant) {
+    auto emu = Emu::fromRom(rom.data(), rom.size(), testCase.quirks);
+    emu.setBackend(variant.backend);
+    emu.setIdleSkipping(variant.idleSkipping);
+
+    auto keys = KeypadInput{0};
+    auto frame = uint64_t{0};
+    for (const auto& [changeFrame, changeKeys] : testCase.input) {
+        if (changeFrame >= testCase.frames) {
+            break;
+        }
+        emu.runFrames(changeFrame - frame, keys);
+        frame = changeFrame;
+        keys = changeKeys;
+    }
+    emu.runFrames(testCase.frames - frame, keys);
+
+    const auto& display = emu.getDisplay();
+    auto result = Frame{display.hash(), display.isHires(), {}};
+    for (auto y = 0; y < result.height(); ++y) {
+        for (auto x = 0; x < result.width(); ++x) {
+            result.pixels.push_back(uint8_t(display.pixel(x, y)));
+        }
+    }
+    return result;
+}
+
+// hash <16 hex digits>, then one line of PIXEL_CHARS per row
+std::optional<Frame> readGolden(const std::filesystem::path& path) {
+    auto is = std::ifstream(path);
+    auto label = std::string{};
+    auto frame = Frame{};
+    if (!(is >> label >> std::hex >> frame.hash) || label != "hash") {
+        return std::nullopt;
+    }
+    auto rows = std::vector<std::string>{};
+    for (auto row = std::string{}; is >> row;) {
+        rows.push_back(row);
+    }
+    frame.hires = rows.size() == size_t(Display::HIRES_HEIGHT_PX);
+    if (rows.size() != size_t(frame.height())) {
+        return std::nullopt;
+    }
+    for (const auto& row : rows) {
+        if (row.size() != size_t(frame.width())) {
+            return std::nullopt;
+        }
+        for (const auto c : row) {
+            const auto colour = std::find(PIXEL_CHARS.begin(), PIXEL_CHARS.end(), c);
+            if (colour == PIXEL_CHARS.end()) {
+                return std::nullopt;
+            }
+            frame.pixels.push_back(uint8_t(colour - PIXEL_CHARS.begin()));
+        }
+    }
+    return frame;
+}
+
+bool writeGolden(const std::filesystem::path& path, const Frame& frame) {
+    auto os = std::ofstream(path);
+    os << std::format("hash {:016x}\n", frame.hash);
+    for (auto y = 0; y < frame.height(); ++y) {
+        for (auto x = 0; x < frame.width(); ++x) {
+            os << PIXEL_CHARS[frame.pixels[size_t(y * frame.width() + x)]];
+        }
+        os << '\n';
+    }
+    return bool(os);
+}
+
+// both frames scaled up to hires size so a mode mismatch still lines up
+bool writeDiff(const std::filesystem::path& path, const Frame& golden, const Frame& actual) {
+    const auto lit = [](const Frame& frame, int x, int y) {
+        const auto scale = frame.hires ? 1 : 2;
+        return frame.pixels[size_t(y / scale * frame.width() + x / scale)] != 0;
+    };
+    auto os = std::ofstream(path, std::ios::binary);
+    os << std::format("P6\n{} {}\n255\n", Display::HIRES_WIDTH_PX, Display::HIRES_HEIGHT_PX);
+    for (auto y = 0; y < Display::HIRES_HEIGHT_PX; ++y) {
+        for (auto x = 0; x < Display::HIRES_WIDTH_PX; ++x) {
+            const auto wanted = lit(golden, x, y);
+            const auto got = lit(actual, x, y);
+            const char rgb[3] = {char(wanted ? 0xFF : 0), char(got ? 0xFF : 0), char(wanted && got ? 0xFF : 0)};
+            os.write(rgb, sizeof(rgb));
+        }
+    }
+    return bool(os);
+}
+
+struct Paths {
+    std::filesystem::path dir;
+    std::filesystem::path roms;
+    std::filesystem::path diffs;
+};
+
+// empty if the case passed, otherwise why it didn't
+std::string check(const Case& testCase, const Paths& paths, bool update) {
+    // roms written for the suite itself sit next to cases.txt, the Timendus ones are shared with the frontend
+    const auto ownRom = paths.dir / "roms" / testCase.rom;
+    const auto romPath = std::filesystem::exists(ownRom) ? ownRom : paths.roms / testCase.rom;
+    auto is = std::ifstream(romPath, std::ios::binary);
+    if (!is) {
+        return std::format("failed to open rom {}", romPath.string());
+    }
+    const auto rom = std::vector<uint8_t>(std::istreambuf_iterator<char>(is), {});
+
+    const auto goldenPath = paths.dir / "golden" / (testCase.name + ".txt");
+    if (update) {
+        return writeGolden(goldenPath, run(testCase, rom, VARIANTS[0])) ? "" : std::format("failed to write {}", goldenPath.string());
+    }
+    const auto golden = readGolden(goldenPath);
+    if (!golden) {
+        return std::format("{} is missing or malformed, --update writes it", goldenPath.string());
+    }
+    for (const auto& variant : VARIANTS) {
+        const auto frame = run(testCase, rom, variant);
+        if (frame.hash != golden->hash) {
+            const auto diffPath = paths.diffs / (testCase.name + ".ppm");
+            std::filesystem::create_directories(paths.diffs);
+            writeDiff(diffPath, *golden, frame);
+            return std::format("{} ended on {:016x}, expected {:016x}, see {}", variant.name, frame.hash, golden->hash, diffPath.string());
+        }
+    }
+    return "";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto paths = Paths{"tests/conformance", "roms", "conformance-diffs"};
+    bool update = false;
+    auto names = std::vector<std::string>{};
+    for (auto i = 1; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const auto hasValue = i + 1 < argc;
+        if (arg == "--dir" && hasValue) {
+            paths.dir = argv[++i];
+        } else if (arg == "--roms" && hasValue) {
+            paths.roms = argv[++i];
+        } else if (arg == "--diffs" && hasValue) {
+            paths.diffs = argv[++i];
+        } else if (arg == "--update") {
+            update = true;
+        } else if (arg.starts_with("--")) {
+            log_error("Unknown option {}", arg);
+            return 1;
+        } else {
+            names.emplace_back(arg);
+        }
+    }
+
+    auto cases = readCases(paths.dir / "cases.txt");
+    if (!cases) {
+        return 1;
+    }
+    if (!names.empty()) {
+        auto selected = std::vector<Case>{};
+        for (const auto& name : names) {
+            const auto found = std::find_if(cases->begin(), cases->end(), [&](const Case& testCase) { return testCase.name == name; });
+            if (found == cases->end()) {
+                log_error("No case named {}", name);
+                return 1;
+            }
+            selected.push_back(*found);
+        }
+        cases = std::move(selected);
+    }
+
+    auto failures = std::vector<std::string>(cases->size());
+    {
+        auto pool = ThreadPool();
+        for (size_t idx = 0; idx < cases->size(); ++idx) {
+            pool.submit([&, idx]() { failures[idx] = check((*cases)[idx], paths, update); });
+        }
+        pool.wait();
+    }
+
+    size_t failed = 0;
+    for (size_t idx = 0; idx < cases->size(); ++idx) {
+        if (!failures[idx].empty()) {
+            log_error("{}: {}", (*cases)[idx].name, failures[idx]);
+            ++failed;
+        }
+    }
+    log_info("{} of {} cases {}", cases->size() - failed, cases->size(), update ? "updated" : "passed");
+    return failed == 0 ? 0 : 1;
+}